@@ -22,10 +22,11 @@
 
 #include "accountoperationsobserver.h"
 #include "notificationmanager.h"
+#include "groupcache.h"
+#include "daemonstats.h"
 
 #include <TelepathyQt/PendingReady>
 
-#include <CommHistory/GroupModel>
 #include <CommHistory/CallModel>
 #include "debug.h"
 
@@ -33,7 +34,6 @@ using namespace RTComLogger;
 
 AccountOperationsObserver::AccountOperationsObserver(Tp::AccountManagerPtr accountManager, QObject* parent) :
     QObject(parent),
-    m_pGroupModel(0),
     m_AccountManager(accountManager)
 {
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "START";
@@ -167,20 +167,7 @@ void AccountOperationsObserver::slotAccountRemoved()
         callModel->getEvents();
         m_accountPathsForCalls.insert(accountPath, callModel);
 
-        if (!m_pGroupModel) {
-            // Notification manager already has a group model so using that instead of creating a separate one:
-            m_pGroupModel = NotificationManager::instance()->groupModel();
-        }
-
-        if (m_pGroupModel && !m_pGroupModel->isReady()) {
-            connect(m_pGroupModel,
-                    SIGNAL(modelReady(bool)),
-                    this,
-                    SLOT(slotDeleteConversations()),
-                    Qt::UniqueConnection);
-        } else {
-            slotDeleteConversations();
-        }
+        slotDeleteConversations();
     }
 
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "END";
@@ -190,23 +177,13 @@ void AccountOperationsObserver::slotDeleteConversations()
 {
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "START";
 
-    if (!m_pGroupModel)
-        return;
-
+    GroupCache *groups = GroupCache::instance();
     QList<int> groupsToBeDeleted;
 
     foreach (QString accountPath, m_accountPathsForConvs) {
-        for (int i=0;i<m_pGroupModel->rowCount();i++) {
-            QModelIndex index = m_pGroupModel->index(i,0);
-            if (index.isValid()) {
-                CommHistory::Group group = m_pGroupModel->group(index);
-                int groupId = group.id();
-                QString localId = group.localUid();
-                if (localId == accountPath) {
-                    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Group " << groupId << " to be deleted";
-                    groupsToBeDeleted.append(groupId);
-                }
-            }
+        foreach (const CommHistory::Group &group, groups->accountGroups(accountPath)) {
+            qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Group " << group.id() << " to be deleted";
+            groupsToBeDeleted.append(group.id());
         }
 
         // delete notifcations of this account
@@ -214,7 +191,7 @@ void AccountOperationsObserver::slotDeleteConversations()
     }
 
     if (!groupsToBeDeleted.isEmpty()) {
-        if (!m_pGroupModel->deleteGroups(groupsToBeDeleted)) {
+        if (!groups->deleteGroups(groupsToBeDeleted)) {
             qWarning() << "Error while deleting groups: " << groupsToBeDeleted;
         }
     }
@@ -248,6 +225,7 @@ void AccountOperationsObserver::slotDeleteCalls()
 
     foreach(CommHistory::Event callEvent, callsToBeDeleted) {
         // No deleteEvents implemented, so calling deleteEvent for every event to be removed:
+        DatabaseQueryTimer queryTimer;
         if (!callModel->deleteEvent(callEvent)) {
             qWarning() << "Error while deleting call " << callEvent.id();
         }
@@ -29,7 +29,6 @@
 
 namespace CommHistory
 {
-    class GroupModel;
     class CallModel;
     class Event;
 }
@@ -86,8 +85,8 @@ private Q_SLOTS:
      *
      * Adds path of the removed account into a list used when calling methods to
      * remove conversations and calls either a) directly or b) via signal from models
-     * indicating they are ready. Uses CommHistory::GroupModel from NotificationManager
-     * and creates and populates CommHistory::CallModel by itself. Additionally removes
+     * indicating they are ready. Conversations are looked up through GroupCache,
+     * calls with a CommHistory::CallModel created here. Additionally removes
      * all notifications of the account.
      *
      */
@@ -127,7 +126,6 @@ private:
     void connectToAccounts();
 
 private:
-    CommHistory::GroupModel *m_pGroupModel;
     Tp::AccountManagerPtr m_AccountManager;
     QList<QString> m_accountPathsForConvs; // Conversations of these account paths should be removed.
     QMap<QString,CommHistory::CallModel*> m_accountPathsForCalls; // Calls of these account paths should be removed.
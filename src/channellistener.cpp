@@ -44,6 +44,17 @@ ChannelListener::ChannelListener(const Tp::AccountPtr &account,
     : QObject(parent), m_Account(account), m_Channel(channel), m_InvocationContext(context),
       m_pEventModel(0)
 {
+    // Immutable properties are known before the channel is ready
+    if (m_Channel) {
+        const QVariantMap properties = m_Channel->immutableProperties();
+
+        if (properties.contains(TELEPATHY_CHANNEL_INTERFACE_PERSISTENT_ID)) {
+            m_TargetId = properties.value(TELEPATHY_CHANNEL_INTERFACE_PERSISTENT_ID).toString();
+        } else if (properties.contains(TP_QT_IFACE_CHANNEL+QLatin1String(".TargetID"))) {
+            m_TargetId = properties.value(TP_QT_IFACE_CHANNEL+QLatin1String(".TargetID")).toString();
+        }
+    }
+
     connect(m_Account.data(),
             SIGNAL(invalidated(Tp::DBusProxy*, const QString&, const QString&)),
             this,
@@ -153,19 +164,9 @@ CommHistory::EventModel& ChannelListener::eventModel()
     return *m_pEventModel;
 }
 
-QString ChannelListener::targetId() const
+const QString &ChannelListener::targetId() const
 {
-    QString targetId;
-
-    QVariantMap properties = m_Channel->immutableProperties();
-
-    if (properties.contains(TELEPATHY_CHANNEL_INTERFACE_PERSISTENT_ID)) {
-        targetId = properties.value(TELEPATHY_CHANNEL_INTERFACE_PERSISTENT_ID).toString();
-    } else if (properties.contains(TP_QT_IFACE_CHANNEL+QLatin1String(".TargetID"))) {
-        targetId = properties.value(TP_QT_IFACE_CHANNEL+QLatin1String(".TargetID")).toString();
-    }
-
-    return targetId;
+    return m_TargetId;
 }
 
 void ChannelListener::channelReady()
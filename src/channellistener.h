@@ -67,10 +67,11 @@ public:
     QString channel() const;
 
     /*!
-     * \brief returns target id from immutable properties
+     * \brief returns target id from immutable properties, read once when
+     * the listener is created
      * \return string with target id
      */
-    QString targetId() const;
+    const QString &targetId() const;
 
 public Q_SLOTS:
     /*!
@@ -126,6 +127,9 @@ protected:
     Tp::MethodInvocationContextPtr<> m_InvocationContext;
     CommHistory::Event::EventDirection m_Direction;
     CommHistory::EventModel* m_pEventModel;
+
+private:
+    QString m_TargetId;
 };
 
 } // namespace RTComLogger
@@ -39,6 +39,14 @@ void CommHistoryIfAdaptor::activateNotification(int groupId, const QString &remo
     QMetaObject::invokeMethod(parent(), "activateNotification", Q_ARG(int, groupId), Q_ARG(QString, remoteActionString));
 }
 
+QVariantMap CommHistoryIfAdaptor::ingestionLatency()
+{
+    // handle method call org.nemomobile.CommHistoryIf.ingestionLatency
+    QVariantMap stages;
+    QMetaObject::invokeMethod(parent(), "ingestionLatency", Q_RETURN_ARG(QVariantMap, stages));
+    return stages;
+}
+
 void CommHistoryIfAdaptor::setCallHistoryObserved(bool observed)
 {
     // handle method call org.nemomobile.CommHistoryIf.setCallHistoryObserved
@@ -49,6 +49,10 @@ class CommHistoryIfAdaptor: public QDBusAbstractAdaptor
 "    <method name=\"setCallHistoryObserved\">\n"
 "      <arg type=\"b\" name=\"observed\"/>\n"
 "    </method>\n"
+"    <method name=\"ingestionLatency\">\n"
+"      <arg direction=\"out\" type=\"a{sv}\" name=\"stages\"/>\n"
+"      <annotation value=\"QVariantMap\" name=\"org.qtproject.QtDBus.QtTypeName.Out0\"/>\n"
+"    </method>\n"
 "  </interface>\n"
         "")
 public:
@@ -58,6 +62,7 @@ public:
 public: // PROPERTIES
 public Q_SLOTS: // METHODS
     void activateNotification(int groupId, const QString &remoteActionString);
+    QVariantMap ingestionLatency();
     void setCallHistoryObserved(bool observed);
     void setInboxObserved(bool observed, const QString &filterAccount);
     void setInboxObserved(bool observed);
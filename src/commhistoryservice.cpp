@@ -24,6 +24,7 @@
 #include <QtDBus>
 #include <QCoreApplication>
 #include "commhistoryservice.h"
+#include "ingestionmetrics.h"
 #include "constants.h"
 
 CommHistoryService *CommHistoryService::instance()
@@ -123,3 +124,8 @@ bool CommHistoryService::isRegistered()
 {
     return m_IsRegistered;
 }
+
+QVariantMap CommHistoryService::ingestionLatency() const
+{
+    return IngestionMetrics::instance()->report();
+}
@@ -28,6 +28,7 @@
 
 #include <QObject>
 #include <QVariantList>
+#include <QVariantMap>
 
 class CommHistoryService : public QObject
 {
@@ -56,6 +57,8 @@ public Q_SLOTS:
     void setCallHistoryObserved(bool observed);
     void setInboxObserved(bool observed, const QString &filterAccount = QString());
     void setObservedConversations(const QVariantList &conversations);
+    /*! \brief count, p50, p99 and max of message ingestion stages, in microseconds */
+    QVariantMap ingestionLatency() const;
 
 Q_SIGNALS:
     void showAuthorizationDialog(const QString& contactId,
@@ -26,6 +26,7 @@
 #include <TelepathyQt/PendingReady>
 #include <TelepathyQt/AccountSet>
 
+#include "startupprofiler.h"
 #include "debug.h"
 
 using namespace RTComLogger;
@@ -58,6 +59,8 @@ void ConnectionUtils::prepareAccounts()
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO;
 
     if (!m_AccountManager.isNull() && m_AccountManager->isReady()) {
+        STARTUP_PROFILE_READY("accountManagerReady");
+
         // connect to new account signals
         connect(m_AccountManager.data(),
                 SIGNAL(newAccount(const Tp::AccountPtr &)),
@@ -78,6 +78,63 @@
 #define CLEANUP_PERIOD_DAYS 7
 // First clean up after boot in ms.
 #define BOOT_CLEANUP_MS 3600000
+// MMS read report candidates are collected for this many ms before processing
+#define READ_REPORT_BATCH_DELAY 200
+// Maximum number of outgoing MMS messages waiting to be handed over to the MMS engine
+#define MMS_SEND_QUEUE_LIMIT 32
+// Maximum number of outgoing MMS messages handed over to the MMS engine at a time, per modem
+#define MMS_SEND_MODEM_CONCURRENCY 2
+// Intermediate MMS transfer states are written to the database after this many ms
+#define MMS_TRANSFER_STATE_DELAY 1000
+// Max number of suspended MMS transfers being resumed at a time
+#define MMS_RESUME_CONCURRENCY 1
+// First full scan of message part directories starts this many ms after startup
+#define FS_CLEANUP_IDLE_DELAY 30000
+// Later full scans are only run as a consistency check, once a day
+#define FS_CLEANUP_FULL_SCAN_INTERVAL 86400000
+// Number of message part directories checked against the database at a time
+#define FS_CLEANUP_SLICE_SIZE 512
+// The full scan pauses for FS_CLEANUP_SLICE_PAUSE ms after running this many ms
+#define FS_CLEANUP_SLICE_BUDGET 50
+#define FS_CLEANUP_SLICE_PAUSE 20
+// Max number of incoming messages traced for ingestion latencies at a time
+#define INGESTION_METRICS_MAX_TRACES 512
+// Main loop heartbeat interval of the stall watchdog, in ms
+#define WATCHDOG_HEARTBEAT_INTERVAL 100
+// Number of worst main loop stalls remembered
+#define WATCHDOG_STALL_HISTORY 16
+// Number of trace records kept by the flight recorder, a power of two
+#define FLIGHT_RECORDER_SIZE 4096
+// Interval between creating deferred components at startup, in ms
+#define STARTUP_SLICE_INTERVAL 0
+// The startup profile is written at the latest this many ms after startup
+#define STARTUP_PROFILE_TIMEOUT 30000
+// Number of conversation groups kept in memory by GroupCache
+#define GROUP_CACHE_SIZE 64
+// Queued text messages are handled for at most this many ms per main loop iteration
+#define MESSAGE_HANDLING_BUDGET 20
+// Limits of the adaptive number of queued text messages handled per iteration
+#define MESSAGE_CHUNK_MIN 8
+#define MESSAGE_CHUNK_MAX 256
+// This many rescued or scrollback messages in a channel queue are a replayed backlog,
+// announced with a single summary
+#define MESSAGE_BACKLOG_THRESHOLD 20
+// Messages an account may handle per main loop iteration for each unit of its weight
+#define INGESTION_TURN_SHARE 16
+// Ingestion weights of the ring (SMS) account and of the others
+#define INGESTION_WEIGHT_RING 4
+#define INGESTION_WEIGHT_DEFAULT 1
+// Size of the duplicate message filter of a conversation and number of hash functions;
+// with two keys per event, a full filter gives about 0.2% false positives
+#define DUPLICATE_FILTER_BITS 32768
+#define DUPLICATE_FILTER_HASHES 4
+// A duplicate filter with more events than this is rebuilt from the latest events of the group
+#define DUPLICATE_FILTER_CAPACITY 1000
+#define DUPLICATE_FILTER_REBUILD_LIMIT 500
+// Number of duplicate filters kept in memory
+#define DUPLICATE_FILTER_GROUPS 32
+// Changed duplicate filters are saved this many ms after the first change
+#define DUPLICATE_FILTER_SAVE_DELAY 10000
 // This amount of days is counted back to determine how old calls should be deleted.
 #define REMOVAL_TARGET_DAYS -90
 
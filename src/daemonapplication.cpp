@@ -0,0 +1,89 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "daemonapplication.h"
+#include "flightrecorder.h"
+#include "ingestionmetrics.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <QThread>
+
+bool DaemonApplication::s_tracking = false;
+QAtomicPointer<const char> DaemonApplication::s_receiver;
+QAtomicPointer<const char> DaemonApplication::s_parent;
+QAtomicInt DaemonApplication::s_eventType;
+
+DaemonApplication::DaemonApplication(int &argc, char **argv)
+    : QCoreApplication(argc, argv)
+{
+}
+
+void DaemonApplication::setDispatchTracking(bool enabled)
+{
+    s_tracking = enabled;
+}
+
+DaemonApplication::Dispatch DaemonApplication::currentDispatch()
+{
+    Dispatch dispatch;
+    dispatch.receiver = s_receiver.loadAcquire();
+    dispatch.parent = s_parent.loadAcquire();
+    dispatch.eventType = s_eventType.loadAcquire();
+    return dispatch;
+}
+
+void DaemonApplication::handleUsrSignal(int fd)
+{
+    char a;
+    if (read(fd, &a, sizeof(a)) < 1)
+        return;
+
+    if (a == SIGUSR1)
+        FlightRecorder::instance()->dump();
+    else if (a == SIGUSR2)
+        IngestionMetrics::instance()->dump();
+}
+
+bool DaemonApplication::notify(QObject *receiver, QEvent *event)
+{
+    if (!s_tracking || receiver->thread() != thread())
+        return QCoreApplication::notify(receiver, event);
+
+    // Nested event loops dispatch from within a dispatch, restore the
+    // outer one when done
+    const char *outerReceiver = s_receiver.loadAcquire();
+    const char *outerParent = s_parent.loadAcquire();
+    const int outerEventType = s_eventType.loadAcquire();
+
+    QObject *parent = receiver->parent();
+    s_receiver.storeRelease(receiver->metaObject()->className());
+    s_parent.storeRelease(parent ? parent->metaObject()->className() : 0);
+    s_eventType.storeRelease(event->type());
+
+    bool result = QCoreApplication::notify(receiver, event);
+
+    s_receiver.storeRelease(outerReceiver);
+    s_parent.storeRelease(outerParent);
+    s_eventType.storeRelease(outerEventType);
+    return result;
+}
@@ -0,0 +1,74 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef DAEMONAPPLICATION_H
+#define DAEMONAPPLICATION_H
+
+#include <QCoreApplication>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+
+/*!
+ * \class DaemonApplication
+ * \brief Application object which can tell what the main loop is busy with.
+ *
+ * When dispatch tracking is enabled, the class names of the receiver of
+ * the event being delivered on the main thread (and of its parent, which
+ * usually owns timers and socket notifiers) are published for other
+ * threads to read. The fields are updated separately, so a reader may
+ * occasionally see a mix of two consecutive dispatches.
+ *
+ * It also dumps the diagnostics requested with SIGUSR1 and SIGUSR2, which
+ * the signal handler forwards through a socket.
+ */
+class DaemonApplication : public QCoreApplication
+{
+    Q_OBJECT
+
+public:
+    struct Dispatch {
+        const char *receiver;
+        const char *parent;
+        int eventType;
+    };
+
+    DaemonApplication(int &argc, char **argv);
+
+    bool notify(QObject *receiver, QEvent *event);
+
+    static void setDispatchTracking(bool enabled);
+    static Dispatch currentDispatch();
+
+public Q_SLOTS:
+    /*!
+     * \brief Reads a forwarded signal number from \a fd and dumps the
+     * flight recorder (SIGUSR1) or the ingestion latencies (SIGUSR2).
+     */
+    void handleUsrSignal(int fd);
+
+private:
+    static bool s_tracking;
+    static QAtomicPointer<const char> s_receiver;
+    static QAtomicPointer<const char> s_parent;
+    static QAtomicInt s_eventType;
+};
+
+#endif // DAEMONAPPLICATION_H
@@ -0,0 +1,81 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "daemonstats.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+
+DaemonStats *DaemonStats::instance()
+{
+    // Counters may be incremented from worker threads, don't race on creation
+    static DaemonStats *obj = new DaemonStats(qApp);
+    return obj;
+}
+
+DaemonStats::DaemonStats(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void DaemonStats::addGauge(QObject *owner, const QString &name, const Gauge &gauge)
+{
+    if (!m_gauges.contains(owner)) {
+        connect(owner, SIGNAL(destroyed(QObject*)), SLOT(onOwnerDestroyed(QObject*)));
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.gauge = gauge;
+    m_gauges.insert(owner, entry);
+}
+
+void DaemonStats::onOwnerDestroyed(QObject *owner)
+{
+    m_gauges.remove(owner);
+}
+
+void DaemonStats::increment(const QString &name, qint64 delta)
+{
+    QMutexLocker lock(&m_mutex);
+    m_counters[name] += delta;
+}
+
+QVariantMap DaemonStats::stats() const
+{
+    QHash<QString, qint64> values;
+    {
+        QMutexLocker lock(&m_mutex);
+        values = m_counters;
+    }
+
+    QMultiHash<QObject*, Entry>::const_iterator it = m_gauges.constBegin();
+    for (; it != m_gauges.constEnd(); ++it) {
+        values[it->name] += it->gauge();
+    }
+
+    QVariantMap result;
+    QHash<QString, qint64>::const_iterator v = values.constBegin();
+    for (; v != values.constEnd(); ++v) {
+        result.insert(v.key(), v.value());
+    }
+    return result;
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef DAEMONSTATS_H
+#define DAEMONSTATS_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMultiHash>
+#include <QMutex>
+#include <QVariantMap>
+
+#include <functional>
+
+/*!
+ * \class DaemonStats
+ * \brief Live counters and gauges of the daemon, exported over D-Bus.
+ *
+ * Counters only ever grow and may be incremented from any thread. Gauges
+ * are sampled on the main thread when the statistics are read; several
+ * objects may register a gauge with the same name, the values are summed
+ * up. A gauge is dropped when its owner is destroyed.
+ */
+class DaemonStats : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<qint64()> Gauge;
+
+    static DaemonStats *instance();
+
+    void addGauge(QObject *owner, const QString &name, const Gauge &gauge);
+    void increment(const QString &name, qint64 delta = 1);
+
+    QVariantMap stats() const;
+
+private Q_SLOTS:
+    void onOwnerDestroyed(QObject *owner);
+
+private:
+    DaemonStats(QObject *parent = 0);
+
+    struct Entry {
+        QString name;
+        Gauge gauge;
+    };
+
+    QMultiHash<QObject*, Entry> m_gauges;
+    mutable QMutex m_mutex;
+    QHash<QString, qint64> m_counters;
+};
+
+/*!
+ * \class DatabaseQueryTimer
+ * \brief Counts a synchronous database query and the time spent in it.
+ *
+ * The synchronous model and DatabaseIO calls of the daemon are wrapped
+ * in one, so that databaseQueries and databaseQueryTimeUs cover all of
+ * the database work done outside of asynchronous model queries.
+ */
+class DatabaseQueryTimer
+{
+public:
+    DatabaseQueryTimer() { m_timer.start(); }
+    ~DatabaseQueryTimer()
+    {
+        DaemonStats *stats = DaemonStats::instance();
+        stats->increment(QStringLiteral("databaseQueries"));
+        stats->increment(QStringLiteral("databaseQueryTimeUs"), m_timer.nsecsElapsed() / 1000);
+    }
+
+private:
+    QElapsedTimer m_timer;
+};
+
+#endif // DAEMONSTATS_H
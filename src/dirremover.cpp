@@ -0,0 +1,187 @@
+/****************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License version 2.1
+** as published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+****************************************************************************/
+
+#include "dirremover.h"
+#include "debug.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class DirRemover::RemoveTask : public QRunnable
+{
+public:
+    RemoveTask(DirRemover* aRemover) : iRemover(aRemover) {}
+
+    void run()
+    {
+        iRemover->drain();
+    }
+
+private:
+    DirRemover* iRemover;
+};
+
+DirRemover::DirRemover(QObject* aParent) :
+    QObject(aParent),
+    iRunning(false)
+{
+    iPool.setMaxThreadCount(1);
+}
+
+DirRemover::~DirRemover()
+{
+    iPool.waitForDone();
+}
+
+void DirRemover::remove(const QString &aDirPath)
+{
+    QMutexLocker lock(&iMutex);
+    iQueue.append(QFile::encodeName(aDirPath));
+    if (!iRunning) {
+        iRunning = true;
+        iPool.start(new RemoveTask(this));
+    }
+}
+
+void DirRemover::onBatchDone(int aCount, int aFailed, qint64 aBytes)
+{
+    qCDebug(lcCommhistoryd) << "DirRemover: removed" << aCount << "directories,"
+        << aBytes << "bytes reclaimed," << aFailed << "failed";
+    emit removed(aCount, aFailed, aBytes);
+}
+
+void DirRemover::drain()
+{
+    forever {
+        QList<QByteArray> batch;
+        {
+            QMutexLocker lock(&iMutex);
+            if (iQueue.isEmpty()) {
+                iRunning = false;
+                return;
+            }
+            batch.swap(iQueue);
+        }
+
+        // Directories of the same parent are removed relative to
+        // one open descriptor of it
+        int count = 0, failed = 0;
+        qint64 bytes = 0;
+        QByteArray parent;
+        int parentFd = -1;
+        foreach (const QByteArray &path, batch) {
+            const int slash = path.lastIndexOf('/');
+            const QByteArray dir(slash > 0 ? path.left(slash) : QByteArray("/"));
+            const QByteArray name(path.mid(slash + 1));
+            if (dir != parent || parentFd < 0) {
+                if (parentFd >= 0) {
+                    close(parentFd);
+                }
+                parent = dir;
+                parentFd = open(parent.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            }
+
+            if (parentFd < 0) {
+                if (errno != ENOENT) {
+                    qWarning() << "DirRemover: Failed to open" << parent << ":" << strerror(errno);
+                    failed++;
+                }
+            } else if (removeTree(parentFd, name.constData(), &bytes)) {
+                count++;
+            } else {
+                qWarning() << "DirRemover: Failed to remove" << path;
+                failed++;
+            }
+        }
+        if (parentFd >= 0) {
+            close(parentFd);
+        }
+
+        QMetaObject::invokeMethod(this, "onBatchDone", Qt::QueuedConnection,
+            Q_ARG(int, count), Q_ARG(int, failed), Q_ARG(qint64, bytes));
+    }
+}
+
+bool DirRemover::removeTree(int aParentFd, const char* aName, qint64* aBytes)
+{
+    int fd = openat(aParentFd, aName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            // Already gone
+            return true;
+        }
+        qWarning() << "DirRemover: Failed to open" << aName << ":" << strerror(errno);
+        return false;
+    }
+
+    DIR* dir = fdopendir(fd);
+    if (!dir) {
+        qWarning() << "DirRemover: Failed to read" << aName << ":" << strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            if (errno != ENOENT) {
+                qWarning() << "DirRemover: Failed to stat" << name << ":" << strerror(errno);
+                ok = false;
+            }
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (!removeTree(fd, name, aBytes)) {
+                ok = false;
+            }
+        } else if (unlinkat(fd, name, 0) == 0) {
+            *aBytes += qint64(st.st_blocks) * 512;
+        } else if (errno != ENOENT) {
+            qWarning() << "DirRemover: Failed to remove" << name << ":" << strerror(errno);
+            ok = false;
+        }
+    }
+    closedir(dir);
+
+    if (unlinkat(aParentFd, aName, AT_REMOVEDIR) < 0 && errno != ENOENT) {
+        if (ok) {
+            qWarning() << "DirRemover: Failed to remove" << aName << ":" << strerror(errno);
+        }
+        return false;
+    }
+    return ok;
+}
@@ -0,0 +1,68 @@
+/****************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License version 2.1
+** as published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+****************************************************************************/
+
+#ifndef DIRREMOVER_H
+#define DIRREMOVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+
+/*!
+ * \class DirRemover
+ * \brief Removes directory trees on a worker thread.
+ *
+ * Directories are queued with remove(), which may be called from any
+ * thread. The worker drains the queue in batches and reports the outcome
+ * of each batch with the removed() signal.
+ */
+class DirRemover: public QObject
+{
+    Q_OBJECT
+
+public:
+    DirRemover(QObject* aParent = 0);
+    ~DirRemover();
+
+    void remove(const QString &aDirPath);
+
+Q_SIGNALS:
+    void removed(int aCount, int aFailed, qint64 aBytes);
+
+private Q_SLOTS:
+    void onBatchDone(int aCount, int aFailed, qint64 aBytes);
+
+private:
+    class RemoveTask;
+
+    void drain();
+    static bool removeTree(int aParentFd, const char* aName, qint64* aBytes);
+
+private:
+    QThreadPool iPool;
+    QMutex iMutex;
+    QList<QByteArray> iQueue;
+    bool iRunning;
+};
+
+#endif // DIRREMOVER_H
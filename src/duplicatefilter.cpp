@@ -0,0 +1,379 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "duplicatefilter.h"
+#include "groupcache.h"
+#include "daemonstats.h"
+#include "readonlydatabase.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <CommHistory/Event>
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QTimer>
+
+namespace {
+
+const quint32 FileVersion = 2;
+const quint64 FnvOffset = Q_UINT64_C(14695981039346656037);
+const quint64 FnvPrime = Q_UINT64_C(1099511628211);
+
+// Separate read-only connection, DatabaseIO doesn't provide lookups by content
+const QLatin1String DatabaseConnection("commhistoryd-duplicates");
+
+// The keys are persisted, so qHash() with its per-process seed won't do
+quint64 fnv1a(quint64 hash, const void *data, int size)
+{
+    const uchar *p = static_cast<const uchar *>(data);
+    for (int i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= FnvPrime;
+    }
+    return hash;
+}
+
+quint64 hashString(quint64 hash, const QString &s)
+{
+    // The length keeps e.g. ("ab", "c") and ("a", "bc") apart
+    const int size = s.size();
+    hash = fnv1a(hash, &size, sizeof(size));
+    return fnv1a(hash, s.constData(), size * sizeof(QChar));
+}
+
+quint64 tokenKey(const QString &token)
+{
+    return hashString(fnv1a(FnvOffset, "t", 1), token);
+}
+
+quint64 contentKey(const QString &remoteUid, uint startTime, const QString &text)
+{
+    quint64 hash = hashString(fnv1a(FnvOffset, "c", 1), remoteUid);
+    hash = fnv1a(hash, &startTime, sizeof(startTime));
+    return hashString(hash, text);
+}
+
+quint64 contentKey(const CommHistory::Event &event)
+{
+    return contentKey(event.recipients().value(0).remoteUid(), event.startTime().toTime_t(),
+                      event.freeText());
+}
+
+uint bitIndex(quint64 key, int i)
+{
+    // Double hashing, the bits for all the hash functions from one key
+    const quint32 h1 = quint32(key);
+    const quint32 h2 = quint32(key >> 32) | 1;
+    return (h1 + quint32(i) * h2) % DUPLICATE_FILTER_BITS;
+}
+
+void insert(QByteArray &bits, quint64 key)
+{
+    char *data = bits.data();
+    for (int i = 0; i < DUPLICATE_FILTER_HASHES; i++) {
+        const uint bit = bitIndex(key, i);
+        data[bit >> 3] |= char(1 << (bit & 7));
+    }
+}
+
+bool test(const QByteArray &bits, quint64 key)
+{
+    for (int i = 0; i < DUPLICATE_FILTER_HASHES; i++) {
+        const uint bit = bitIndex(key, i);
+        if (!(bits.at(bit >> 3) & (1 << (bit & 7))))
+            return false;
+    }
+    return true;
+}
+
+}
+
+DuplicateFilter *DuplicateFilter::instance()
+{
+    static DuplicateFilter *obj = 0;
+    if (!obj)
+        obj = new DuplicateFilter(qApp);
+    return obj;
+}
+
+DuplicateFilter::DuplicateFilter(QObject *parent)
+    : QObject(parent)
+    , m_dir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+            + QStringLiteral("/commhistoryd/duplicate-filters"))
+    , m_saveTimer(new QTimer(this))
+{
+    m_saveTimer->setSingleShot(true);
+    m_saveTimer->setInterval(DUPLICATE_FILTER_SAVE_DELAY);
+    connect(m_saveTimer, SIGNAL(timeout()), SLOT(save()));
+    connect(GroupCache::instance(), SIGNAL(groupsDeleted(QList<int>)), SLOT(onGroupsDeleted(QList<int>)));
+
+    DaemonStats::instance()->addGauge(this, QStringLiteral("duplicateFilterGroups"),
+                                      [this] { return qint64(m_filters.count()); });
+}
+
+DuplicateFilter::~DuplicateFilter()
+{
+    save();
+    ReadOnlyDatabase::close(DatabaseConnection);
+}
+
+bool DuplicateFilter::isDuplicate(const CommHistory::Event &event, bool matchContent)
+{
+    if (event.groupId() < 0)
+        return false;
+
+    const Filter &f(filter(event.groupId()));
+    const QString &token(event.messageToken());
+    const bool tokenMatch = !token.isEmpty() && test(f.bits, tokenKey(token));
+    const bool contentMatch = matchContent && test(f.bits, contentKey(event));
+    if (!tokenMatch && !contentMatch)
+        return false;
+
+    // The filter may give false positives, confirm from the database
+    QSqlDatabase db;
+    if (!ReadOnlyDatabase::open(DatabaseConnection, db))
+        return false;
+
+    QStringList conditions;
+    if (tokenMatch)
+        conditions << QStringLiteral("messageToken = :token");
+    if (contentMatch)
+        conditions << QStringLiteral("(remoteUid = :remoteUid AND startTime = :startTime AND freeText = :freeText)");
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(QStringLiteral("SELECT id FROM Events WHERE groupId = :groupId AND (")
+                  + conditions.join(QStringLiteral(" OR ")) + QStringLiteral(") LIMIT 1"));
+    query.bindValue(QStringLiteral(":groupId"), event.groupId());
+    if (tokenMatch)
+        query.bindValue(QStringLiteral(":token"), token);
+    if (contentMatch) {
+        query.bindValue(QStringLiteral(":remoteUid"), event.recipients().value(0).remoteUid());
+        query.bindValue(QStringLiteral(":startTime"), event.startTime().toTime_t());
+        query.bindValue(QStringLiteral(":freeText"), event.freeText());
+    }
+
+    DatabaseQueryTimer queryTimer;
+    if (!query.exec()) {
+        qWarning() << "DuplicateFilter: Event query failed:" << query.lastError();
+        return false;
+    }
+
+    const bool found = query.next();
+    DaemonStats::instance()->increment(found ? QStringLiteral("duplicateMessages")
+                                             : QStringLiteral("duplicateFilterFalsePositives"));
+    return found;
+}
+
+void DuplicateFilter::add(const CommHistory::Event &event)
+{
+    if (event.groupId() < 0)
+        return;
+
+    Filter &f(filter(event.groupId()));
+    insert(f.bits, contentKey(event));
+    if (!event.messageToken().isEmpty())
+        insert(f.bits, tokenKey(event.messageToken()));
+    f.count++;
+    f.watermark = qMax(f.watermark, event.id());
+    f.dirty = true;
+
+    if (!m_saveTimer->isActive())
+        m_saveTimer->start();
+}
+
+DuplicateFilter::Filter &DuplicateFilter::filter(int groupId)
+{
+    QHash<int, Filter>::iterator it = m_filters.find(groupId);
+    if (it != m_filters.end()) {
+        m_groups.removeOne(groupId);
+        m_groups.append(groupId);
+        // Too full to be selective any more
+        if (it->count > DUPLICATE_FILTER_CAPACITY)
+            rebuild(groupId, *it);
+        return *it;
+    }
+
+    while (m_groups.count() >= DUPLICATE_FILTER_GROUPS) {
+        const int evicted = m_groups.takeFirst();
+        const Filter f(m_filters.take(evicted));
+        if (f.dirty)
+            write(evicted, f);
+    }
+
+    Filter f;
+    if (!read(groupId, f) || !topUp(groupId, f) || f.count > DUPLICATE_FILTER_CAPACITY)
+        rebuild(groupId, f);
+
+    m_groups.append(groupId);
+    return *m_filters.insert(groupId, f);
+}
+
+void DuplicateFilter::rebuild(int groupId, Filter &filter)
+{
+    filter.bits.fill(0, DUPLICATE_FILTER_BITS / 8);
+    filter.count = 0;
+    filter.watermark = 0;
+    // Not saved unless rebuilt, so that it's retried after a restart
+    filter.dirty = false;
+
+    QSqlDatabase db;
+    if (!ReadOnlyDatabase::open(DatabaseConnection, db))
+        return;
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(QStringLiteral("SELECT id, remoteUid, startTime, freeText, messageToken FROM Events "
+                                 "WHERE groupId = ? ORDER BY id DESC LIMIT ?"));
+    query.addBindValue(groupId);
+    query.addBindValue(DUPLICATE_FILTER_REBUILD_LIMIT);
+
+    DatabaseQueryTimer queryTimer;
+    if (!query.exec()) {
+        qWarning() << "DuplicateFilter: Event query failed:" << query.lastError();
+        return;
+    }
+
+    insertEvents(query, filter);
+    qCDebug(lcCommhistoryd) << "DuplicateFilter: rebuilt filter of group" << groupId
+                            << "from" << filter.count << "events";
+
+    filter.dirty = true;
+    if (!m_saveTimer->isActive())
+        m_saveTimer->start();
+}
+
+bool DuplicateFilter::topUp(int groupId, Filter &filter)
+{
+    QSqlDatabase db;
+    if (!ReadOnlyDatabase::open(DatabaseConnection, db))
+        return false;
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(QStringLiteral("SELECT id, remoteUid, startTime, freeText, messageToken FROM Events "
+                                 "WHERE groupId = ? AND id > ?"));
+    query.addBindValue(groupId);
+    query.addBindValue(filter.watermark);
+
+    DatabaseQueryTimer queryTimer;
+    if (!query.exec()) {
+        qWarning() << "DuplicateFilter: Event query failed:" << query.lastError();
+        return false;
+    }
+
+    const int count = filter.count;
+    insertEvents(query, filter);
+    if (filter.count != count) {
+        qCDebug(lcCommhistoryd) << "DuplicateFilter: added" << filter.count - count
+                                << "newer events to the filter of group" << groupId;
+        filter.dirty = true;
+        if (!m_saveTimer->isActive())
+            m_saveTimer->start();
+    }
+    return true;
+}
+
+void DuplicateFilter::insertEvents(QSqlQuery &query, Filter &filter)
+{
+    while (query.next()) {
+        insert(filter.bits, contentKey(query.value(1).toString(), query.value(2).toUInt(),
+                                       query.value(3).toString()));
+        const QString token(query.value(4).toString());
+        if (!token.isEmpty())
+            insert(filter.bits, tokenKey(token));
+        filter.count++;
+        filter.watermark = qMax(filter.watermark, query.value(0).toInt());
+    }
+}
+
+QString DuplicateFilter::filePath(int groupId) const
+{
+    return m_dir + QLatin1Char('/') + QString::number(groupId);
+}
+
+bool DuplicateFilter::read(int groupId, Filter &filter) const
+{
+    QFile file(filePath(groupId));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 version = 0;
+    qint32 count = 0;
+    qint32 watermark = 0;
+    QByteArray bits;
+    in >> version;
+    if (version == FileVersion)
+        in >> count >> watermark >> bits;
+    if (in.status() != QDataStream::Ok || version != FileVersion
+        || bits.size() != DUPLICATE_FILTER_BITS / 8) {
+        qWarning() << "DuplicateFilter: ignoring invalid filter" << file.fileName();
+        return false;
+    }
+
+    filter.bits = bits;
+    filter.count = count;
+    filter.watermark = watermark;
+    filter.dirty = false;
+    return true;
+}
+
+bool DuplicateFilter::write(int groupId, const Filter &filter) const
+{
+    QDir().mkpath(m_dir);
+    QSaveFile file(filePath(groupId));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "DuplicateFilter: cannot open" << file.fileName() << file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << FileVersion << qint32(filter.count) << qint32(filter.watermark) << filter.bits;
+    return file.commit();
+}
+
+void DuplicateFilter::save()
+{
+    QHash<int, Filter>::iterator it;
+    for (it = m_filters.begin(); it != m_filters.end(); ++it) {
+        if (it->dirty && write(it.key(), *it))
+            it->dirty = false;
+    }
+}
+
+void DuplicateFilter::onGroupsDeleted(const QList<int> &groupIds)
+{
+    foreach (int groupId, groupIds) {
+        m_filters.remove(groupId);
+        m_groups.removeOne(groupId);
+        QFile::remove(filePath(groupId));
+    }
+}
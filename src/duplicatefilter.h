@@ -0,0 +1,106 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef DUPLICATEFILTER_H
+#define DUPLICATEFILTER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+
+class QSqlQuery;
+class QTimer;
+
+namespace CommHistory {
+    class Event;
+}
+
+namespace RTComLogger {
+    class Ut_DuplicateFilter;
+}
+
+/*!
+ * \class DuplicateFilter
+ * \brief Tells whether a received message has already been logged.
+ *
+ * Every conversation group has a Bloom filter over the message tokens
+ * and the (sender, sent time, text) of its events. Only when the filter
+ * matches is the database queried to confirm, so checking a message
+ * which is not a duplicate, the common case, costs no database access.
+ *
+ * The filters are saved in the cache directory and loaded when the group
+ * is first used. A saved filter records the newest event it covers; events
+ * stored after that, before the save or by another process, are added from
+ * the database on load. A missing or overfull filter is rebuilt from the
+ * latest events of the group. Filters of deleted groups are removed.
+ */
+class DuplicateFilter : public QObject
+{
+    Q_OBJECT
+
+public:
+    static DuplicateFilter *instance();
+    ~DuplicateFilter();
+
+    /*!
+     * \brief Returns true if the event is already stored in its group.
+     * \param matchContent match also by sender, start time and text, not
+     * only by the message token
+     */
+    bool isDuplicate(const CommHistory::Event &event, bool matchContent);
+    void add(const CommHistory::Event &event);
+
+private Q_SLOTS:
+    void save();
+    void onGroupsDeleted(const QList<int> &groupIds);
+
+private:
+    DuplicateFilter(QObject *parent = 0);
+
+    struct Filter {
+        QByteArray bits;
+        int count;
+        // highest event id in the filter
+        int watermark;
+        bool dirty;
+    };
+
+    Filter &filter(int groupId);
+    QString filePath(int groupId) const;
+    bool read(int groupId, Filter &filter) const;
+    bool write(int groupId, const Filter &filter) const;
+    void rebuild(int groupId, Filter &filter);
+    bool topUp(int groupId, Filter &filter);
+    void insertEvents(QSqlQuery &query, Filter &filter);
+
+    QString m_dir;
+    QTimer *m_saveTimer;
+    QHash<int, Filter> m_filters;
+    // least recently used first
+    QList<int> m_groups;
+
+#ifdef UNIT_TEST
+    friend class RTComLogger::Ut_DuplicateFilter;
+#endif
+};
+
+#endif // DUPLICATEFILTER_H
@@ -0,0 +1,126 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "flightrecorder.h"
+#include "debug.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextStream>
+
+#include <string.h>
+
+FlightRecorder *FlightRecorder::instance()
+{
+    static FlightRecorder *obj = new FlightRecorder;
+    return obj;
+}
+
+FlightRecorder::FlightRecorder()
+{
+    memset(m_records, 0, sizeof(m_records));
+    m_clock.start();
+}
+
+const char *FlightRecorder::stageName(int stage)
+{
+    switch (stage) {
+    case MessageReceived: return "message-received";
+    case EventAdded: return "event-added";
+    case EventCommitted: return "event-committed";
+    case CommitFailed: return "commit-failed";
+    case MessageExpunged: return "message-expunged";
+    case DeliveryReport: return "delivery-report";
+    case NotificationShown: return "notification-shown";
+    case MmsNotification: return "mms-notification";
+    case MmsTransferState: return "mms-transfer-state";
+    case MmsTransferFinished: return "mms-transfer-finished";
+    case MmsReceived: return "mms-received";
+    case MmsSent: return "mms-sent";
+    case MmsSendQueued: return "mms-send-queued";
+    default: return "unknown";
+    }
+}
+
+void FlightRecorder::record(Stage stage, int eventId, const QString &token, int arg)
+{
+    // Sequence numbers start from 1, 0 marks an unused slot
+    const quint32 sequence = m_next.fetchAndAddRelaxed(1) + 1;
+    Record &r = m_records[sequence % FLIGHT_RECORDER_SIZE];
+    r.timestamp = m_clock.nsecsElapsed() / 1000;
+    r.eventId = eventId;
+    r.tokenHash = token.isEmpty() ? 0 : qHash(token);
+    r.stage = stage;
+    r.arg = qint16(arg);
+    r.sequence = sequence;
+}
+
+QString FlightRecorder::dump(const QString &path) const
+{
+    QString filePath(path);
+    if (filePath.isEmpty()) {
+        const QString dir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+                          + QStringLiteral("/commhistoryd"));
+        QDir().mkpath(dir);
+        filePath = dir + QStringLiteral("/flightrecorder-")
+                + QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmss"))
+                + QStringLiteral(".txt");
+    }
+
+    // Take a copy first so that the records don't move while formatting
+    Record *copy = new Record[FLIGHT_RECORDER_SIZE];
+    memcpy(copy, m_records, sizeof(m_records));
+    const quint32 last = m_next.loadAcquire();
+    const qint64 now = m_clock.nsecsElapsed() / 1000;
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "FlightRecorder: cannot open" << filePath << file.errorString();
+        delete[] copy;
+        return QString();
+    }
+
+    QTextStream out(&file);
+    out << "# commhistoryd flight recorder, " << last << " records total, now " << now << " us\n";
+    out << "# sequence timestamp_us stage event_id token_hash arg\n";
+    const quint32 first = last >= FLIGHT_RECORDER_SIZE ? last - FLIGHT_RECORDER_SIZE + 1 : 1;
+    for (quint32 sequence = first; sequence <= last; sequence++) {
+        const Record &r = copy[sequence % FLIGHT_RECORDER_SIZE];
+        // Skip slots overwritten or not yet completed while copying
+        if (r.sequence != sequence)
+            continue;
+        out << r.sequence << ' ' << r.timestamp << ' ' << stageName(r.stage) << ' '
+            << r.eventId << ' ' << hex << r.tokenHash << dec << ' ' << r.arg << '\n';
+    }
+    out.flush();
+    delete[] copy;
+
+    if (!file.commit()) {
+        qWarning() << "FlightRecorder: writing" << filePath << "failed:" << file.errorString();
+        return QString();
+    }
+
+    qWarning() << "FlightRecorder: dumped to" << filePath;
+    return filePath;
+}
@@ -0,0 +1,92 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef FLIGHTRECORDER_H
+#define FLIGHTRECORDER_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QString>
+
+#include "constants.h"
+
+/*!
+ * \class FlightRecorder
+ * \brief Always-on ring buffer of compact trace records.
+ *
+ * Recording a trace point copies a few integers into a preallocated
+ * ring, without any formatting or allocation. The contents are only
+ * turned into text when dumped.
+ */
+class FlightRecorder
+{
+public:
+    enum Stage {
+        MessageReceived = 1,
+        EventAdded,
+        EventCommitted,
+        CommitFailed,
+        MessageExpunged,
+        DeliveryReport,
+        NotificationShown,
+        MmsNotification,
+        MmsTransferState,
+        MmsTransferFinished,
+        MmsReceived,
+        MmsSent,
+        MmsSendQueued
+    };
+
+    static FlightRecorder *instance();
+
+    /*!
+     * \brief Records a trace point. Safe to call from any thread.
+     * \param token Message token, if any; only its hash is kept.
+     */
+    void record(Stage stage, int eventId, const QString &token = QString(), int arg = 0);
+
+    /*!
+     * \brief Writes the records to \a path, oldest first.
+     * Writes to the cache directory if \a path is empty. Returns the
+     * path written, empty on failure.
+     */
+    QString dump(const QString &path = QString()) const;
+
+    static const char *stageName(int stage);
+
+private:
+    FlightRecorder();
+
+    struct Record {
+        qint64 timestamp;   // us since start
+        qint32 eventId;
+        quint32 tokenHash;
+        quint16 stage;
+        qint16 arg;
+        quint32 sequence;
+    };
+
+    QElapsedTimer m_clock;
+    QAtomicInteger<quint32> m_next;
+    Record m_records[FLIGHT_RECORDER_SIZE];
+};
+
+#endif // FLIGHTRECORDER_H
@@ -21,6 +21,11 @@
 ****************************************************************************/
 
 #include "fscleanup.h"
+#include "dirremover.h"
+#include "daemonstats.h"
+#include "readonlydatabase.h"
+#include "startupprofiler.h"
+#include "constants.h"
 #include "debug.h"
 
 #include <CommHistory/commhistorydatabasepath.h>
@@ -28,24 +33,82 @@
 #include <CommHistory/constants.h>
 
 #include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
 #include <QDBusConnection>
 #include <QLoggingCategory>
+#include <QRunnable>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
 
 Q_LOGGING_CATEGORY(lcFsCleanup, "commhistoryd.fscleanup", QtWarningMsg)
 
+// Opened on the worker thread for each cleanup task
+static const QLatin1String DatabaseConnection("commhistoryd-fscleanup");
+
+class FsCleanup::CleanupTask : public QRunnable
+{
+public:
+    // Empty list of groups means full cleanup
+    CleanupTask(FsCleanup* aCleanup, const QList<int> &aGroupIds = QList<int>()) :
+        iCleanup(aCleanup), iGroupIds(aGroupIds) {}
+
+    void run()
+    {
+        int removed = iGroupIds.isEmpty() ? iCleanup->fullCleanup() :
+            iCleanup->groupCleanup(iGroupIds);
+        QMetaObject::invokeMethod(iCleanup, "onCleanupDone",
+            Qt::QueuedConnection, Q_ARG(int, removed));
+    }
+
+private:
+    FsCleanup* iCleanup;
+    QList<int> iGroupIds;
+};
+
 FsCleanup::FsCleanup(QObject* aParent) :
-    QObject(aParent)
+    QObject(aParent),
+    iRemover(new DirRemover(this)),
+    iFullCleanupTimer(new QTimer(this)),
+    iIndexedUpTo(-1)
 {
+    iPool.setMaxThreadCount(1);
+    iFullCleanupTimer->setSingleShot(true);
+    connect(iFullCleanupTimer, SIGNAL(timeout()), SLOT(startFullCleanup()));
+    connect(iRemover, SIGNAL(removed(int,int,qint64)), SLOT(onFilesRemoved(int,int,qint64)));
+
     QDBusConnection dbus(QDBusConnection::sessionBus());
     dbus.connect(QString(), QString(), COMM_HISTORY_INTERFACE,
         EVENT_DELETED_SIGNAL, this, SLOT(onEventDeleted(int)));
     dbus.connect(QString(), QString(), COMM_HISTORY_INTERFACE,
         GROUPS_DELETED_SIGNAL, this, SLOT(onGroupsDeleted(QList<int>)));
-    fullCleanup();
+
+    // The first full scan builds the index; stay out of the way during
+    // startup
+    iFullCleanupTimer->start(FS_CLEANUP_IDLE_DELAY);
+    STARTUP_PROFILE_READY("fsCleanupWatching");
+}
+
+FsCleanup::~FsCleanup()
+{
+    iCancelled.store(1);
+    iPool.waitForDone();
 }
 
 void FsCleanup::onEventDeleted(int aEventId)
 {
+    // Most events (calls, SMS, IM) never had any files, don't bother
+    // the database about them
+    if (!QFileInfo::exists(CommHistoryDatabasePath::dataDir(aEventId))) {
+        return;
+    }
+
     CommHistory::DatabaseIO* io = CommHistory::DatabaseIO::instance();
     if (!io->eventExists(aEventId)) {
         qCDebug(lcFsCleanup) << "FsCleanup: Event" << aEventId << "deleted";
@@ -59,57 +122,221 @@ void FsCleanup::onEventDeleted(int aEventId)
 void FsCleanup::onGroupsDeleted(QList<int> aGroupIds)
 {
     qCDebug(lcFsCleanup) << "FsCleanup:" << aGroupIds.count() << "group(s) deleted";
-    fullCleanup();
+    if (!aGroupIds.isEmpty()) {
+        iPool.start(new CleanupTask(this, aGroupIds));
+    }
 }
 
-void FsCleanup::fullCleanup()
+void FsCleanup::startFullCleanup()
 {
-    qCDebug(lcFsCleanup) << "FsCleanup: Running full cleanup";
-    CommHistory::DatabaseIO* io = CommHistory::DatabaseIO::instance();
+    iPool.start(new CleanupTask(this));
+    // From now on, only as an occasional consistency check
+    iFullCleanupTimer->start(FS_CLEANUP_FULL_SCAN_INTERVAL);
+}
+
+void FsCleanup::onCleanupDone(int aRemoved)
+{
+    qCDebug(lcFsCleanup) << "FsCleanup: Cleanup done," << aRemoved << "directories queued for removal";
+}
+
+void FsCleanup::onFilesRemoved(int aCount, int aFailed, qint64 aBytes)
+{
+    if (aFailed) {
+        qWarning() << "FsCleanup: Failed to remove" << aFailed << "message part directories";
+    }
+    qCDebug(lcFsCleanup) << "FsCleanup: Removed" << aCount << "directories," << aBytes << "bytes reclaimed";
+}
+
+QList<int> FsCleanup::listDirs(int aAfterId)
+{
+    QList<int> dirs;
     QDirIterator it(CommHistoryDatabasePath::dataDir(),
         QDir::Dirs | QDir::NoDotAndDotDot);
     while (it.hasNext()) {
         it.next();
         bool ok = false;
         int id = it.fileName().toInt(&ok);
-        if (ok && !io->eventExists(id)) {
-            deleteFiles(id);
+        if (ok && id > aAfterId) {
+            dirs.append(id);
         }
     }
-    qCDebug(lcFsCleanup) << "FsCleanup: Cleanup done";
+    std::sort(dirs.begin(), dirs.end());
+    return dirs;
 }
 
-void FsCleanup::deleteFiles(int aEventId)
+void FsCleanup::indexDir(int aEventId, int aGroupId)
 {
-    removeDir(CommHistoryDatabasePath::dataDir(aEventId));
+    QHash<int, int>::iterator it = iDirGroup.find(aEventId);
+    if (it != iDirGroup.end()) {
+        if (it.value() == aGroupId) {
+            return;
+        }
+        iGroupDirs[it.value()].remove(aEventId);
+        it.value() = aGroupId;
+    } else {
+        iDirGroup.insert(aEventId, aGroupId);
+    }
+    iGroupDirs[aGroupId].insert(aEventId);
 }
 
-bool FsCleanup::removeDir(QString aDirPath)
+void FsCleanup::unindexDir(int aEventId)
 {
-    bool result = true;
-    QDir dir(aDirPath);
-    if (dir.exists()) {
-        qCDebug(lcFsCleanup) << "FsCleanup: Removing" << aDirPath;
-        QFileInfoList list = dir.entryInfoList(QDir::NoDotAndDotDot |
-            QDir::System | QDir::Hidden  | QDir::AllDirs | QDir::Files,
-            QDir::DirsFirst);
-        for (int i=0; i<list.count(); i++) {
-            QFileInfo info(list.at(i));
-            QString path(info.absoluteFilePath());
-            if (info.isDir()) {
-                result = removeDir(path);
-            } else {
-                result = QFile::remove(path);
+    QHash<int, int>::iterator it = iDirGroup.find(aEventId);
+    if (it != iDirGroup.end()) {
+        QHash<int, QSet<int> >::iterator group = iGroupDirs.find(it.value());
+        if (group != iGroupDirs.end()) {
+            group->remove(aEventId);
+            if (group->isEmpty()) {
+                iGroupDirs.erase(group);
             }
-            if (!result) {
-                qWarning() << "FsCleanup: Failed to remove" << path;
-                return result;
+        }
+        iDirGroup.erase(it);
+    }
+}
+
+int FsCleanup::fullCleanup()
+{
+    qCDebug(lcFsCleanup) << "FsCleanup: Running full cleanup";
+    QElapsedTimer timer;
+    timer.start();
+
+    const QList<int> dirs(listDirs(-1));
+    iGroupDirs.clear();
+    iDirGroup.clear();
+    iIndexedUpTo = 0;
+
+    int removed = 0;
+    {
+        QSqlDatabase db;
+        if (!dirs.isEmpty() && ReadOnlyDatabase::open(DatabaseConnection, db)) {
+            QSqlQuery query(db);
+            query.setForwardOnly(true);
+            query.prepare(QStringLiteral("SELECT id, groupId FROM Events WHERE id BETWEEN ? AND ?"));
+
+            // Ids are looked up in ranges, a slice of directories at a time,
+            // yielding in between
+            int sliceStart = 0;
+            QElapsedTimer budget;
+            budget.start();
+            while (sliceStart < dirs.count() && !iCancelled.load()) {
+                const int sliceEnd = qMin(sliceStart + FS_CLEANUP_SLICE_SIZE, dirs.count());
+                query.bindValue(0, dirs.at(sliceStart));
+                query.bindValue(1, dirs.at(sliceEnd - 1));
+                DatabaseQueryTimer queryTimer;
+                if (!query.exec()) {
+                    qWarning() << "FsCleanup: Event query failed:" << query.lastError();
+                    break;
+                }
+
+                QHash<int, int> existing;
+                while (query.next()) {
+                    existing.insert(query.value(0).toInt(), query.value(1).toInt());
+                }
+                query.finish();
+
+                for (int i = sliceStart; i < sliceEnd; i++) {
+                    const int id = dirs.at(i);
+                    QHash<int, int>::const_iterator it = existing.constFind(id);
+                    if (it == existing.constEnd()) {
+                        deleteFiles(id);
+                        removed++;
+                    } else {
+                        indexDir(id, it.value());
+                    }
+                }
+                iIndexedUpTo = dirs.at(sliceEnd - 1);
+                sliceStart = sliceEnd;
+
+                if (budget.elapsed() > FS_CLEANUP_SLICE_BUDGET) {
+                    qCDebug(lcFsCleanup) << "FsCleanup:" << sliceStart << "of" << dirs.count() << "checked";
+                    QThread::msleep(FS_CLEANUP_SLICE_PAUSE);
+                    budget.restart();
+                }
             }
+            db.close();
+        }
+    }
+    ReadOnlyDatabase::close(DatabaseConnection);
+
+    qCDebug(lcFsCleanup) << "FsCleanup: Checked" << dirs.count() << "directories in" << timer.elapsed() << "ms";
+    return removed;
+}
+
+int FsCleanup::groupCleanup(const QList<int> &aGroupIds)
+{
+    if (iIndexedUpTo < 0) {
+        // No index yet, the pending full scan will take care of it
+        return 0;
+    }
+
+    // Directories of the deleted groups, plus the ones created since
+    // they were last indexed
+    QList<int> candidates;
+    foreach (int groupId, aGroupIds) {
+        foreach (int id, iGroupDirs.value(groupId)) {
+            candidates.append(id);
         }
-        result = dir.rmdir(aDirPath);
-        if (!result) {
-            qWarning() << "FsCleanup: Failed to remove" << aDirPath;
+    }
+    const QList<int> newDirs(listDirs(iIndexedUpTo));
+    candidates.append(newDirs);
+    if (candidates.isEmpty()) {
+        return 0;
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    qCDebug(lcFsCleanup) << "FsCleanup: Checking" << candidates.count() << "directories of"
+        << aGroupIds.count() << "deleted group(s)";
+
+    int removed = 0;
+    {
+        QSqlDatabase db;
+        if (ReadOnlyDatabase::open(DatabaseConnection, db)) {
+            QSqlQuery query(db);
+            query.setForwardOnly(true);
+            for (int start = 0; start < candidates.count() && !iCancelled.load(); start += FS_CLEANUP_SLICE_SIZE) {
+                const int end = qMin(start + FS_CLEANUP_SLICE_SIZE, candidates.count());
+                QStringList ids;
+                for (int i = start; i < end; i++) {
+                    ids.append(QString::number(candidates.at(i)));
+                }
+
+                DatabaseQueryTimer queryTimer;
+                if (!query.exec(QStringLiteral("SELECT id, groupId FROM Events WHERE id IN (%1)").arg(ids.join(',')))) {
+                    qWarning() << "FsCleanup: Event query failed:" << query.lastError();
+                    break;
+                }
+
+                QHash<int, int> existing;
+                while (query.next()) {
+                    existing.insert(query.value(0).toInt(), query.value(1).toInt());
+                }
+                query.finish();
+
+                for (int i = start; i < end; i++) {
+                    const int id = candidates.at(i);
+                    QHash<int, int>::const_iterator it = existing.constFind(id);
+                    if (it == existing.constEnd()) {
+                        unindexDir(id);
+                        deleteFiles(id);
+                        removed++;
+                    } else {
+                        // Still there, possibly moved to another group
+                        indexDir(id, it.value());
+                    }
+                }
+            }
+            if (!newDirs.isEmpty() && !iCancelled.load()) {
+                iIndexedUpTo = qMax(iIndexedUpTo, newDirs.last());
+            }
+            db.close();
         }
     }
-    return result;
+    ReadOnlyDatabase::close(DatabaseConnection);
+    return removed;
+}
+
+void FsCleanup::deleteFiles(int aEventId)
+{
+    qCDebug(lcFsCleanup) << "FsCleanup: Removing files of" << aEventId;
+    iRemover->remove(CommHistoryDatabasePath::dataDir(aEventId));
 }
@@ -26,6 +26,13 @@
 #include <QObject>
 #include <QString>
 #include <QList>
+#include <QHash>
+#include <QSet>
+#include <QAtomicInt>
+#include <QThreadPool>
+
+class DirRemover;
+class QTimer;
 
 class FsCleanup: public QObject
 {
@@ -33,15 +40,40 @@ class FsCleanup: public QObject
 
 public:
     FsCleanup(QObject* aParent);
+    ~FsCleanup();
 
 private Q_SLOTS:
     void onEventDeleted(int aEventId);
     void onGroupsDeleted(QList<int> aGroupIds);
+    void startFullCleanup();
+    void onCleanupDone(int aRemoved);
+    void onFilesRemoved(int aCount, int aFailed, qint64 aBytes);
+
+private:
+    class CleanupTask;
+
+    // These run on the worker thread
+    int fullCleanup();
+    int groupCleanup(const QList<int> &aGroupIds);
+    void indexDir(int aEventId, int aGroupId);
+    void unindexDir(int aEventId);
+    static QList<int> listDirs(int aAfterId);
+
+    // Thread safe
+    void deleteFiles(int aEventId);
 
 private:
-    static void fullCleanup();
-    static void deleteFiles(int aEventId);
-    static bool removeDir(QString aDirPath);
+    DirRemover* iRemover;
+    // All cleanup tasks run one at a time on a worker thread
+    QThreadPool iPool;
+    QTimer* iFullCleanupTimer;
+    QAtomicInt iCancelled;
+
+    // Group -> message part directory index, built by the full scan
+    // and owned by the worker thread
+    QHash<int, QSet<int> > iGroupDirs;
+    QHash<int, int> iDirGroup;
+    int iIndexedUpTo;
 };
 
 #endif // FSCLEANUP_H
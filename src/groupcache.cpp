@@ -0,0 +1,332 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "groupcache.h"
+#include "daemonstats.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <CommHistory/databaseio.h>
+#include <CommHistory/groupmanager.h>
+#include <CommHistory/constants.h>
+#include <CommHistory/commonutils.h>
+
+#include <QCoreApplication>
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusMessage>
+
+using namespace CommHistory;
+
+GroupCache *GroupCache::instance()
+{
+    static GroupCache *obj = 0;
+    if (!obj)
+        obj = new GroupCache(qApp);
+    return obj;
+}
+
+GroupCache::GroupCache(QObject *parent)
+    : QObject(parent)
+    , m_groups(GROUP_CACHE_SIZE)
+{
+    QDBusConnection dbus(QDBusConnection::sessionBus());
+    if (!dbus.connect(QString(), COMM_HISTORY_OBJECT_PATH, COMM_HISTORY_INTERFACE,
+        GROUP_ADDED_SIGNAL, this, SLOT(onGroupAdded(QDBusMessage)))) {
+        qWarning() << "GroupCache: failed to register" << GROUP_ADDED_SIGNAL << "handler";
+    }
+    if (!dbus.connect(QString(), COMM_HISTORY_OBJECT_PATH, COMM_HISTORY_INTERFACE,
+        GROUPS_UPDATED_FULL_SIGNAL, this, SLOT(onGroupsUpdatedFull(QDBusMessage)))) {
+        qWarning() << "GroupCache: failed to register" << GROUPS_UPDATED_FULL_SIGNAL << "handler";
+    }
+    if (!dbus.connect(QString(), COMM_HISTORY_OBJECT_PATH, COMM_HISTORY_INTERFACE,
+        GROUPS_DELETED_SIGNAL, this, SLOT(onGroupsDeleted(QList<int>)))) {
+        qWarning() << "GroupCache: failed to register" << GROUPS_DELETED_SIGNAL << "handler";
+    }
+
+    DaemonStats::instance()->addGauge(this, QStringLiteral("cachedGroups"),
+                                      [this] { return qint64(m_groups.count()); });
+}
+
+QString GroupCache::recipientKey(const QString &localUid, const QString &remoteUid)
+{
+    return localUid + QLatin1Char('\n') + remoteUid;
+}
+
+QSet<QString> GroupCache::recipientKeys(const Group &group)
+{
+    QSet<QString> keys;
+    foreach (const Recipient &recipient, group.recipients())
+        keys.insert(recipientKey(recipient.localUid(), recipient.remoteUid()));
+    return keys;
+}
+
+QString GroupCache::observerKey(const Recipient &recipient)
+{
+    // Phone numbers match by their minimized form, see Recipient::matches()
+    return recipientKey(recipient.localUid(), recipient.isPhoneNumber()
+                        ? minimizePhoneNumber(recipient.remoteUid()) : recipient.remoteUid());
+}
+
+void GroupCache::addObserver(GroupObserver *observer, const Recipient &recipient)
+{
+    removeObserver(observer);
+
+    Observer entry;
+    entry.recipient = recipient;
+    entry.key = observerKey(recipient);
+    entry.groupId = -1;
+    m_observers.insert(observer, entry);
+    m_observersByRecipient.insert(entry.key, observer);
+}
+
+void GroupCache::setObservedGroup(GroupObserver *observer, int groupId)
+{
+    QHash<GroupObserver*, Observer>::iterator it = m_observers.find(observer);
+    if (it == m_observers.end() || it->groupId == groupId)
+        return;
+
+    if (it->groupId >= 0)
+        m_observersByGroup.remove(it->groupId, observer);
+    it->groupId = groupId;
+    if (groupId >= 0)
+        m_observersByGroup.insert(groupId, observer);
+}
+
+void GroupCache::removeObserver(GroupObserver *observer)
+{
+    QHash<GroupObserver*, Observer>::iterator it = m_observers.find(observer);
+    if (it == m_observers.end())
+        return;
+
+    m_observersByRecipient.remove(it->key, observer);
+    if (it->groupId >= 0)
+        m_observersByGroup.remove(it->groupId, observer);
+    m_observers.erase(it);
+}
+
+void GroupCache::insert(const Group &group)
+{
+    if (group.isValid())
+        m_groups.insert(group.id(), new Group(group));
+}
+
+Group GroupCache::group(int groupId)
+{
+    if (groupId < 0)
+        return Group();
+
+    if (Group *cached = m_groups.object(groupId))
+        return *cached;
+
+    Group group;
+    bool found;
+    {
+        DatabaseQueryTimer queryTimer;
+        found = DatabaseIO::instance()->getGroup(groupId, group);
+    }
+    if (!found) {
+        qCDebug(lcCommhistoryd) << "GroupCache: no group" << groupId;
+        return Group();
+    }
+
+    insert(group);
+    return group;
+}
+
+QList<Group> GroupCache::findGroups(const QString &localUid, const QString &remoteUid)
+{
+    const QString key(recipientKey(localUid, remoteUid));
+    QHash<QString, QList<int> >::const_iterator it = m_recipients.constFind(key);
+    if (it != m_recipients.constEnd()) {
+        QList<Group> result;
+        foreach (int id, *it) {
+            Group *cached = m_groups.object(id);
+            if (!cached)
+                break;
+            result.append(*cached);
+        }
+        if (result.count() == it->count())
+            return result;
+    }
+
+    QList<Group> groups;
+    bool ok;
+    {
+        DatabaseQueryTimer queryTimer;
+        ok = DatabaseIO::instance()->getGroups(localUid, remoteUid, groups);
+    }
+    if (!ok) {
+        qWarning() << "GroupCache: failed to query groups of" << localUid << remoteUid;
+        return groups;
+    }
+
+    // Lookups which found nothing are not remembered, the conversation
+    // typically gets created right after
+    if (!groups.isEmpty()) {
+        if (m_recipients.count() >= 2 * GROUP_CACHE_SIZE)
+            m_recipients.clear();
+
+        QList<int> ids;
+        foreach (const Group &group, groups) {
+            insert(group);
+            ids.append(group.id());
+        }
+        m_recipients.insert(key, ids);
+    }
+    return groups;
+}
+
+Group GroupCache::findGroup(const Recipient &recipient)
+{
+    Group fallback;
+    foreach (const Group &group, findGroups(recipient.localUid(), recipient.remoteUid())) {
+        const RecipientList &recipients = group.recipients();
+        if (recipients.count() > 1) {
+            // This is a multi-member group; prefer to continue searching for an exact match
+            if (!fallback.isValid() && recipients.containsMatch(recipient))
+                fallback = group;
+        } else if (recipients.containsMatch(recipient)) {
+            return group;
+        }
+    }
+    return fallback;
+}
+
+QList<Group> GroupCache::accountGroups(const QString &localUid)
+{
+    QList<Group> groups;
+    DatabaseQueryTimer queryTimer;
+    if (!DatabaseIO::instance()->getGroups(localUid, QString(), groups))
+        qWarning() << "GroupCache: failed to query groups of" << localUid;
+    return groups;
+}
+
+bool GroupCache::addGroup(Group &group)
+{
+    // GroupManager also announces the change to everybody else
+    GroupManager manager;
+    if (!manager.addGroup(group))
+        return false;
+
+    // The new conversation may match earlier recipient lookups
+    m_recipients.clear();
+    insert(group);
+    return true;
+}
+
+bool GroupCache::modifyGroup(Group &group)
+{
+    GroupManager manager;
+    if (!manager.modifyGroup(group))
+        return false;
+
+    // Only the modified properties may be set; the full group comes with
+    // the update signal
+    m_groups.remove(group.id());
+    return true;
+}
+
+bool GroupCache::deleteGroups(const QList<int> &groupIds)
+{
+    GroupManager manager;
+    if (!manager.deleteGroups(groupIds))
+        return false;
+
+    foreach (int id, groupIds)
+        m_groups.remove(id);
+    return true;
+}
+
+void GroupCache::onGroupAdded(const QDBusMessage &message)
+{
+    const QVariantList args(message.arguments());
+    if (args.isEmpty())
+        return;
+
+    Group group;
+    args.first().value<QDBusArgument>() >> group;
+    if (!group.isValid())
+        return;
+
+    // A new conversation may match earlier recipient lookups
+    m_recipients.clear();
+    insert(group);
+
+    QList<GroupObserver*> observers;
+    foreach (const Recipient &recipient, group.recipients()) {
+        foreach (GroupObserver *observer, m_observersByRecipient.values(observerKey(recipient))) {
+            if (!observers.contains(observer)
+                    && group.recipients().containsMatch(m_observers.value(observer).recipient))
+                observers.append(observer);
+        }
+    }
+    // Observers may change their registration while being called
+    foreach (GroupObserver *observer, observers) {
+        if (m_observers.contains(observer))
+            observer->groupAdded(group);
+    }
+
+    emit groupAdded(group);
+}
+
+void GroupCache::onGroupsUpdatedFull(const QDBusMessage &message)
+{
+    const QVariantList args(message.arguments());
+    if (args.isEmpty())
+        return;
+
+    QList<Group> groups;
+    args.first().value<QDBusArgument>() >> groups;
+
+    foreach (const Group &group, groups) {
+        if (!group.isValid())
+            continue;
+
+        // Only refresh what's hot, don't pull everything in
+        if (Group *cached = m_groups.object(group.id())) {
+            // Recipient lookups listing the old members are stale
+            if (recipientKeys(*cached) != recipientKeys(group))
+                m_recipients.clear();
+            insert(group);
+        }
+
+        foreach (GroupObserver *observer, m_observersByGroup.values(group.id())) {
+            if (m_observers.contains(observer))
+                observer->groupUpdated(group);
+        }
+        emit groupUpdated(group);
+    }
+}
+
+void GroupCache::onGroupsDeleted(const QList<int> &groupIds)
+{
+    foreach (int id, groupIds) {
+        m_groups.remove(id);
+
+        foreach (GroupObserver *observer, m_observersByGroup.values(id)) {
+            if (m_observers.contains(observer))
+                observer->groupDeleted(id);
+        }
+    }
+
+    emit groupsDeleted(groupIds);
+}
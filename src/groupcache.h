@@ -0,0 +1,145 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef GROUPCACHE_H
+#define GROUPCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QHash>
+#include <QList>
+#include <QMultiHash>
+#include <QSet>
+
+#include <CommHistory/Group>
+#include <CommHistory/Recipient>
+
+class QDBusMessage;
+
+/*!
+ * \class GroupObserver
+ * \brief Receives the changes of a single conversation from GroupCache.
+ */
+class GroupObserver
+{
+public:
+    virtual ~GroupObserver() { }
+
+    /*!
+     * \brief A group matching the observed recipient was added.
+     */
+    virtual void groupAdded(const CommHistory::Group &group) = 0;
+    virtual void groupUpdated(const CommHistory::Group &group) = 0;
+    virtual void groupDeleted(int groupId) = 0;
+};
+
+/*!
+ * \class GroupCache
+ * \brief On demand access to conversation groups.
+ *
+ * Groups are read from the database one conversation at a time, by id or
+ * by recipient, and the most recently used ones are kept in a bounded
+ * cache. The daemon only ever needs a handful of them, unlike the UI
+ * which shows them all.
+ *
+ * Changes made by any process are observed through the commhistory D-Bus
+ * signals; cached groups are updated and the change is passed on. Each
+ * change is decoded once, and delivered to the observers of that group id
+ * or recipient only, in addition to the signals.
+ */
+class GroupCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    static GroupCache *instance();
+
+    /*!
+     * \brief Returns the group with the given id, or an invalid group.
+     */
+    CommHistory::Group group(int groupId);
+
+    /*!
+     * \brief Returns the groups of the given local and remote uid.
+     */
+    QList<CommHistory::Group> findGroups(const QString &localUid, const QString &remoteUid);
+
+    /*!
+     * \brief Returns the conversation with the recipient.
+     * A group with just the recipient is preferred over a multi-member group
+     * containing it.
+     */
+    CommHistory::Group findGroup(const CommHistory::Recipient &recipient);
+
+    /*!
+     * \brief Returns all groups of an account. Not cached.
+     */
+    QList<CommHistory::Group> accountGroups(const QString &localUid);
+
+    /*!
+     * \brief Delivers added groups matching the recipient to the observer.
+     */
+    void addObserver(GroupObserver *observer, const CommHistory::Recipient &recipient);
+    /*!
+     * \brief Delivers updates and deletion of the group to the observer.
+     * -1 stops observing a group.
+     */
+    void setObservedGroup(GroupObserver *observer, int groupId);
+    void removeObserver(GroupObserver *observer);
+
+    bool addGroup(CommHistory::Group &group);
+    bool modifyGroup(CommHistory::Group &group);
+    bool deleteGroups(const QList<int> &groupIds);
+
+Q_SIGNALS:
+    void groupAdded(const CommHistory::Group &group);
+    void groupUpdated(const CommHistory::Group &group);
+    void groupsDeleted(const QList<int> &groupIds);
+
+private Q_SLOTS:
+    void onGroupAdded(const QDBusMessage &message);
+    void onGroupsUpdatedFull(const QDBusMessage &message);
+    void onGroupsDeleted(const QList<int> &groupIds);
+
+private:
+    GroupCache(QObject *parent = 0);
+
+    void insert(const CommHistory::Group &group);
+    static QString recipientKey(const QString &localUid, const QString &remoteUid);
+    static QSet<QString> recipientKeys(const CommHistory::Group &group);
+    static QString observerKey(const CommHistory::Recipient &recipient);
+
+    struct Observer {
+        CommHistory::Recipient recipient;
+        QString key;
+        int groupId;
+    };
+
+    QCache<int, CommHistory::Group> m_groups;
+    // Results of recipient lookups; only valid while all the groups are cached
+    QHash<QString, QList<int> > m_recipients;
+
+    QHash<GroupObserver*, Observer> m_observers;
+    QMultiHash<QString, GroupObserver*> m_observersByRecipient;
+    QMultiHash<int, GroupObserver*> m_observersByGroup;
+};
+
+#endif // GROUPCACHE_H
@@ -0,0 +1,216 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "ingestionmetrics.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <QCoreApplication>
+
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::reset()
+{
+    memset(m_buckets, 0, sizeof(m_buckets));
+    m_count = 0;
+    m_max = 0;
+}
+
+int LatencyHistogram::bucketIndex(qint64 usec)
+{
+    if (usec < SubBuckets)
+        return usec < 0 ? 0 : int(usec);
+
+    int exponent = 63 - __builtin_clzll(quint64(usec));
+    if (exponent > MaxExponent)
+        return BucketCount - 1;
+
+    const int sub = int(usec >> (exponent - SubBucketBits)) & (SubBuckets - 1);
+    return SubBuckets + (exponent - SubBucketBits) * SubBuckets + sub;
+}
+
+qint64 LatencyHistogram::bucketValue(int index)
+{
+    // Upper bound of the bucket
+    if (index < SubBuckets)
+        return index;
+
+    const int exponent = (index - SubBuckets) / SubBuckets + SubBucketBits;
+    const int sub = (index - SubBuckets) % SubBuckets;
+    const qint64 width = Q_INT64_C(1) << (exponent - SubBucketBits);
+    return (Q_INT64_C(1) << exponent) + (sub + 1) * width - 1;
+}
+
+void LatencyHistogram::record(qint64 usec)
+{
+    m_buckets[bucketIndex(usec)]++;
+    m_count++;
+    if (usec > m_max)
+        m_max = usec;
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    if (!m_count)
+        return 0;
+
+    quint64 target = quint64(p * m_count + 0.5);
+    if (target < 1)
+        target = 1;
+
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; i++) {
+        seen += m_buckets[i];
+        if (seen >= target)
+            return qMin(bucketValue(i), m_max);
+    }
+    return m_max;
+}
+
+IngestionMetrics *IngestionMetrics::instance()
+{
+    static IngestionMetrics *obj = 0;
+    if (!obj)
+        obj = new IngestionMetrics(qApp);
+    return obj;
+}
+
+IngestionMetrics::IngestionMetrics(QObject *parent)
+    : QObject(parent)
+    , m_committed(false)
+{
+    m_clock.start();
+}
+
+const char *IngestionMetrics::stageName(Stage stage)
+{
+    switch (stage) {
+    case Queue: return "queue";
+    case Commit: return "commit";
+    case Expunge: return "expunge";
+    case Total: return "total";
+    case Store: return "store";
+    case Notify: return "notify";
+    case Publish: return "publish";
+    case Urgent: return "urgent";
+    case Inbound: return "inbound";
+    case Delivery: return "delivery";
+    case Scrollback: return "scrollback";
+    default: return "unknown";
+    }
+}
+
+void IngestionMetrics::begin(const QString &token)
+{
+    if (token.isEmpty() || m_traces.contains(token))
+        return;
+
+    // Traces of messages which never get expunged would pile up otherwise
+    if (m_traces.count() >= INGESTION_METRICS_MAX_TRACES) {
+        qCDebug(lcCommhistoryd) << "IngestionMetrics: dropping" << m_traces.count() << "stale traces";
+        m_traces.clear();
+    }
+
+    Trace trace;
+    trace.received = trace.last = now();
+    m_traces.insert(token, trace);
+}
+
+void IngestionMetrics::mark(const QString &token, Stage stage)
+{
+    QHash<QString, Trace>::iterator it = m_traces.find(token);
+    if (it == m_traces.end())
+        return;
+
+    const qint64 t = now();
+    m_histograms[stage].record(t - it->last);
+    it->last = t;
+
+    if (stage == Commit && !m_committed) {
+        m_committed = true;
+        emit firstCommit();
+    }
+}
+
+void IngestionMetrics::finish(const QString &token)
+{
+    QHash<QString, Trace>::iterator it = m_traces.find(token);
+    if (it == m_traces.end())
+        return;
+
+    m_histograms[Total].record(now() - it->received);
+    m_traces.erase(it);
+}
+
+void IngestionMetrics::record(Stage stage, qint64 usec)
+{
+    m_histograms[stage].record(usec);
+}
+
+void IngestionMetrics::record(const QString &token, Stage stage)
+{
+    QHash<QString, Trace>::const_iterator it = m_traces.constFind(token);
+    if (it != m_traces.constEnd())
+        m_histograms[stage].record(now() - it->received);
+}
+
+QVariantMap IngestionMetrics::report() const
+{
+    QVariantMap result;
+    for (int i = 0; i < StageCount; i++) {
+        const LatencyHistogram &h(m_histograms[i]);
+        QVariantMap stage;
+        stage.insert(QStringLiteral("count"), h.count());
+        stage.insert(QStringLiteral("p50"), h.percentile(0.5));
+        stage.insert(QStringLiteral("p99"), h.percentile(0.99));
+        stage.insert(QStringLiteral("max"), h.max());
+        result.insert(QLatin1String(stageName(Stage(i))), stage);
+    }
+    return result;
+}
+
+QStringList IngestionMetrics::reportLines() const
+{
+    QStringList lines;
+    for (int i = 0; i < StageCount; i++) {
+        const LatencyHistogram &h(m_histograms[i]);
+        lines.append(QString::fromLatin1("%1: count %2 p50 %3us p99 %4us max %5us")
+                     .arg(QLatin1String(stageName(Stage(i))), -8)
+                     .arg(h.count())
+                     .arg(h.percentile(0.5))
+                     .arg(h.percentile(0.99))
+                     .arg(h.max()));
+    }
+    lines.append(QString::fromLatin1("%1 message(s) in flight").arg(m_traces.count()));
+    return lines;
+}
+
+void IngestionMetrics::dump()
+{
+    qWarning() << "IngestionMetrics: message ingestion latencies";
+    foreach (const QString &line, reportLines())
+        qWarning().noquote() << "   " << line;
+}
@@ -0,0 +1,161 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef INGESTIONMETRICS_H
+#define INGESTIONMETRICS_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QStringList>
+#include <QVariantMap>
+
+/*!
+ * \class LatencyHistogram
+ * \brief Log-linear latency histogram in microseconds.
+ *
+ * Every power of two range is split into linear sub-buckets, which keeps
+ * the relative error of reported percentiles within a few percent at a
+ * fixed memory cost.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 usec);
+    void reset();
+
+    quint64 count() const { return m_count; }
+    qint64 max() const { return m_max; }
+    qint64 percentile(double p) const;
+
+private:
+    enum {
+        SubBucketBits = 4,
+        SubBuckets = 1 << SubBucketBits,
+        MaxExponent = 40,
+        BucketCount = SubBuckets + (MaxExponent - SubBucketBits + 1) * SubBuckets
+    };
+
+    static int bucketIndex(qint64 usec);
+    static qint64 bucketValue(int index);
+
+    quint32 m_buckets[BucketCount];
+    quint64 m_count;
+    qint64 m_max;
+};
+
+/*!
+ * \class IngestionMetrics
+ * \brief Per-stage latencies of the incoming message path.
+ *
+ * Messages are traced by their message token from the moment they're
+ * picked up from the channel until they are expunged from the stored
+ * messages of the connection. Stages which are not tied to a single
+ * message are recorded as spans.
+ */
+class IngestionMetrics : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Stage {
+        Queue,      // received -> turned into an event
+        Commit,     // turned into an event -> committed to the database
+        Expunge,    // committed -> expunged from the connection
+        Total,      // received -> expunged
+        Store,      // span: EventModel::addEvents call
+        Notify,     // span: NotificationManager::showNotification
+        Publish,    // span: PersonalNotification::publishNotification
+        Urgent,     // received -> handled, class 0 and voicemail lane
+        Inbound,    // received -> handled, new message lane
+        Delivery,   // received -> handled, delivery report lane
+        Scrollback, // received -> handled, scrollback lane
+        StageCount
+    };
+
+    static IngestionMetrics *instance();
+
+    qint64 now() const { return m_clock.nsecsElapsed() / 1000; }
+
+    void begin(const QString &token);
+    void mark(const QString &token, Stage stage);
+    void finish(const QString &token);
+    void record(Stage stage, qint64 usec);
+    /*!
+     * \brief Records the time since the message was received, without
+     * moving its trace to the next stage.
+     */
+    void record(const QString &token, Stage stage);
+
+    /*!
+     * \brief Count, p50, p99 and max in microseconds of each stage, by stage name.
+     */
+    QVariantMap report() const;
+    QStringList reportLines() const;
+
+    static const char *stageName(Stage stage);
+
+public Q_SLOTS:
+    void dump();
+
+Q_SIGNALS:
+    /*!
+     * \brief Emitted when the first traced message has been committed.
+     */
+    void firstCommit();
+
+private:
+    IngestionMetrics(QObject *parent = 0);
+
+    struct Trace {
+        qint64 received;
+        qint64 last;
+    };
+
+    QElapsedTimer m_clock;
+    QHash<QString, Trace> m_traces;
+    LatencyHistogram m_histograms[StageCount];
+    bool m_committed;
+};
+
+/*!
+ * \class IngestionSpan
+ * \brief Records the lifetime of the object as a span of the given stage.
+ */
+class IngestionSpan
+{
+public:
+    explicit IngestionSpan(IngestionMetrics::Stage stage)
+        : m_stage(stage), m_start(IngestionMetrics::instance()->now()) { }
+    ~IngestionSpan()
+    {
+        IngestionMetrics *metrics = IngestionMetrics::instance();
+        metrics->record(m_stage, metrics->now() - m_start);
+    }
+
+private:
+    IngestionMetrics::Stage m_stage;
+    qint64 m_start;
+};
+
+#endif // INGESTIONMETRICS_H
@@ -0,0 +1,175 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "ingestionscheduler.h"
+#include "daemonstats.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTimer>
+
+IngestionScheduler *IngestionScheduler::instance()
+{
+    static IngestionScheduler *obj = 0;
+    if (!obj)
+        obj = new IngestionScheduler(qApp);
+    return obj;
+}
+
+IngestionScheduler::IngestionScheduler(QObject *parent)
+    : QObject(parent)
+    , m_timer(new QTimer(this))
+{
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(0);
+    connect(m_timer, SIGNAL(timeout()), SLOT(runTurn()));
+
+    m_weights.insert(QStringLiteral("ring"), INGESTION_WEIGHT_RING);
+
+    const QString config(QString::fromLatin1(qgetenv("COMMHISTORYD_INGESTION_WEIGHTS")));
+    foreach (const QString &entry, config.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        bool ok = false;
+        const int weight = entry.section(QLatin1Char('='), 1).toInt(&ok);
+        if (!ok || weight <= 0) {
+            qWarning() << "IngestionScheduler: invalid weight" << entry;
+            continue;
+        }
+        m_weights.insert(entry.section(QLatin1Char('='), 0, 0).trimmed(), weight);
+    }
+}
+
+int IngestionScheduler::weight(const QString &accountPath) const
+{
+    // /org/freedesktop/Telepathy/Account/<connection manager>/<protocol>/<account>
+    const QString manager(accountPath.section(QLatin1Char('/'), 5, 5));
+    return m_weights.value(manager, INGESTION_WEIGHT_DEFAULT);
+}
+
+IngestionScheduler::Account &IngestionScheduler::account(const QString &accountPath)
+{
+    QHash<QString, Account>::iterator it = m_accounts.find(accountPath);
+    if (it != m_accounts.end())
+        return *it;
+
+    Account account;
+    account.weight = weight(accountPath);
+    account.gaugeOwner = new QObject(this);
+    qCDebug(lcCommhistoryd) << "IngestionScheduler: weight of" << accountPath << "is" << account.weight;
+
+    DaemonStats::instance()->addGauge(account.gaugeOwner,
+            QStringLiteral("ingestionQueueDepth:") + accountPath.section(QLatin1Char('/'), 5),
+            [this, accountPath] {
+                qint64 depth = 0;
+                foreach (IngestionClient *client, m_accounts.value(accountPath).clients)
+                    depth += client->pendingMessages();
+                return depth;
+            });
+
+    return *m_accounts.insert(accountPath, account);
+}
+
+void IngestionScheduler::schedule(IngestionClient *client, const QString &accountPath)
+{
+    QHash<IngestionClient*, QString>::const_iterator it = m_clientAccounts.constFind(client);
+    if (it != m_clientAccounts.constEnd() && *it != accountPath) {
+        qWarning() << "IngestionScheduler: client moved from" << *it << "to" << accountPath;
+        removeClient(client);
+        it = m_clientAccounts.constEnd();
+    }
+
+    Account &a(account(accountPath));
+    if (it == m_clientAccounts.constEnd()) {
+        m_clientAccounts.insert(client, accountPath);
+        a.clients.append(client);
+    }
+
+    if (!a.ready.contains(client))
+        a.ready.append(client);
+    if (!m_readyAccounts.contains(accountPath))
+        m_readyAccounts.append(accountPath);
+
+    if (!m_timer->isActive())
+        m_timer->start();
+}
+
+void IngestionScheduler::removeClient(IngestionClient *client)
+{
+    const QString accountPath(m_clientAccounts.take(client));
+    QHash<QString, Account>::iterator it = m_accounts.find(accountPath);
+    if (it == m_accounts.end())
+        return;
+
+    it->clients.removeOne(client);
+    it->ready.removeOne(client);
+    if (it->ready.isEmpty())
+        m_readyAccounts.removeOne(accountPath);
+
+    // The account has gone away, or at least all of its channels
+    if (it->clients.isEmpty()) {
+        qCDebug(lcCommhistoryd) << "IngestionScheduler: no more clients of" << accountPath;
+        delete it->gaugeOwner;
+        m_accounts.erase(it);
+    }
+}
+
+void IngestionScheduler::runTurn()
+{
+    QElapsedTimer turn;
+    turn.start();
+
+    const int accounts = m_readyAccounts.count();
+    for (int i = 0; i < accounts && !m_readyAccounts.isEmpty(); i++) {
+        if (i > 0 && turn.elapsed() >= MESSAGE_HANDLING_BUDGET)
+            break;
+
+        const QString accountPath(m_readyAccounts.takeFirst());
+        QHash<QString, Account>::iterator it = m_accounts.find(accountPath);
+        if (it == m_accounts.end() || it->ready.isEmpty())
+            continue;
+
+        QList<IngestionClient*> ready;
+        ready.swap(it->ready);
+        const int share = qMax(1, it->weight * INGESTION_TURN_SHARE / ready.count());
+
+        QList<IngestionClient*> pending;
+        foreach (IngestionClient *client, ready) {
+            // Clients may go away while others are handled
+            if (m_clientAccounts.contains(client) && client->ingest(share))
+                pending.append(client);
+        }
+
+        // Clients scheduled meanwhile are already back in the ready list
+        it = m_accounts.find(accountPath);
+        if (it == m_accounts.end())
+            continue;
+        foreach (IngestionClient *client, pending) {
+            if (m_clientAccounts.contains(client) && !it->ready.contains(client))
+                it->ready.append(client);
+        }
+        if (!it->ready.isEmpty() && !m_readyAccounts.contains(accountPath))
+            m_readyAccounts.append(accountPath);
+    }
+
+    if (!m_readyAccounts.isEmpty())
+        m_timer->start();
+}
@@ -0,0 +1,107 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef INGESTIONSCHEDULER_H
+#define INGESTIONSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+class QTimer;
+
+/*!
+ * \class IngestionClient
+ * \brief Source of pending messages handled by IngestionScheduler.
+ */
+class IngestionClient
+{
+public:
+    virtual ~IngestionClient() { }
+
+    /*!
+     * \brief Handles and commits at most \a quota pending messages.
+     * \return true if messages are left that can be handled on the next turn
+     */
+    virtual bool ingest(int quota) = 0;
+    virtual int pendingMessages() const = 0;
+};
+
+/*!
+ * \class IngestionScheduler
+ * \brief Shares the main loop between the accounts and channels with
+ * pending messages.
+ *
+ * On every main loop turn each account with pending messages may handle
+ * up to its weight times INGESTION_TURN_SHARE messages, split evenly
+ * among its channels. Accounts are served round robin, and once the turn
+ * has used MESSAGE_HANDLING_BUDGET the remaining ones go first on the
+ * next turn. This way a flooded chat room can't hold back the SMS of
+ * another account.
+ *
+ * Weights are looked up by the connection manager of the account, by
+ * default the ring account has INGESTION_WEIGHT_RING and the others
+ * INGESTION_WEIGHT_DEFAULT. They can be overridden with e.g.
+ * COMMHISTORYD_INGESTION_WEIGHTS="ring=8,gabble=2". The queue depth of
+ * each account is reported as the ingestionQueueDepth:<account> gauge,
+ * for as long as the account has clients.
+ */
+class IngestionScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static IngestionScheduler *instance();
+
+    /*!
+     * \brief Gives the client a share of the next main loop turn.
+     */
+    void schedule(IngestionClient *client, const QString &accountPath);
+    void removeClient(IngestionClient *client);
+
+    int weight(const QString &accountPath) const;
+
+private Q_SLOTS:
+    void runTurn();
+
+private:
+    IngestionScheduler(QObject *parent = 0);
+
+    struct Account {
+        int weight;
+        QList<IngestionClient*> clients;
+        QList<IngestionClient*> ready;
+        // owner of the queue depth gauge, deleted with the account
+        QObject *gaugeOwner;
+    };
+
+    Account &account(const QString &accountPath);
+
+    QTimer *m_timer;
+    QHash<QString, int> m_weights;
+    QHash<QString, Account> m_accounts;
+    QHash<IngestionClient*, QString> m_clientAccounts;
+    // accounts with ready clients, in the order they are served
+    QStringList m_readyAccounts;
+};
+
+#endif // INGESTIONSCHEDULER_H
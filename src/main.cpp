@@ -33,6 +33,12 @@
 #include "notificationmanager.h"
 #include "commhistoryservice.h"
 #include "commhistoryifadaptor.h"
+#include "statsifadaptor.h"
+#include "daemonstats.h"
+#include "daemonapplication.h"
+#include "stallwatchdog.h"
+#include "startupscheduler.h"
+#include "startupprofiler.h"
 #include "accountpresenceservice.h"
 #include "accountpresenceifadaptor.h"
 #include "messagereviver.h"
@@ -44,6 +50,7 @@
 #include "mmshandler.h"
 #include "mmshandler_adaptor.h"
 #include "smartmessaging.h"
+#include "flightrecorder.h"
 #include "debug.h"
 
 Q_LOGGING_CATEGORY(lcCommhistoryd, "commhistoryd", QtWarningMsg)
@@ -52,6 +59,7 @@ using namespace RTComLogger;
 
 namespace {
 bool toggleDebug = false;
+bool profileStartup = false;
 
 QLoggingCategory::CategoryFilter defaultCategoryFilter;
 
@@ -88,21 +96,57 @@ void setupSigtermHandler()
         qFatal("Failed setup SIGTERM signal handler");
 }
 
+// SIGUSR1 dumps the flight recorder, SIGUSR2 message ingestion latencies
+int sigusrFd[2];
+
+void usrSignalHandler(int sig)
+{
+    char a = sig;
+    if (write(sigusrFd[0], &a, sizeof(a)) < 1) {
+        qWarning("Failed to handle usr signal.");
+    }
+}
+
+void setupSigusrHandler()
+{
+    struct sigaction usr;
+
+    usr.sa_handler = usrSignalHandler;
+    sigemptyset(&usr.sa_mask);
+    usr.sa_flags = SA_RESTART;
+
+    if (::sigaction(SIGUSR1, &usr, 0) || ::sigaction(SIGUSR2, &usr, 0))
+        qFatal("Failed setup SIGUSR signal handlers");
+}
+
 }
 
 Q_DECL_EXPORT int main(int argc, char **argv)
 {
-    if (argc > 1) {
-        if (strcmp(argv[1], "-d") == 0) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
             toggleDebug = true;
+        } else if (strcmp(argv[i], "--profile-startup") == 0) {
+            profileStartup = true;
         }
     }
 
     defaultCategoryFilter = QLoggingCategory::installFilter(categoryFilter);
 
-    QCoreApplication app(argc, argv);
+    DaemonApplication app(argc, argv);
     qCDebug(lcCommhistoryd) << "Commhistoryd application created";
 
+    if (profileStartup) {
+#ifdef COMMHISTORYD_STARTUP_PROFILER
+        StartupProfiler::enable();
+#else
+        qWarning() << "Startup profiling is not available, build with CONFIG+=startup_profiler";
+#endif
+    }
+
+    // Startup is timed from here
+    StartupScheduler *startup = StartupScheduler::instance();
+
     if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sigtermFd))
         qFatal("Couldn't create TERM socketpair");
 
@@ -110,64 +154,111 @@ Q_DECL_EXPORT int main(int argc, char **argv)
     QObject::connect(snTerm, SIGNAL(activated(int)), &app, SLOT(quit()));
     setupSigtermHandler();
 
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sigusrFd))
+        qFatal("Couldn't create USR socketpair");
+
+    QSocketNotifier *snUsr = new QSocketNotifier(sigusrFd[1], QSocketNotifier::Read, &app);
+    QObject::connect(snUsr, SIGNAL(activated(int)), &app, SLOT(handleUsrSignal(int)));
+    FlightRecorder::instance();
+    setupSigusrHandler();
+
     QScopedPointer<QTranslator> engineeringEnglish(new QTranslator);
-    engineeringEnglish->load("commhistoryd_eng_en", "/usr/share/translations");
     QScopedPointer<QTranslator> translator(new QTranslator);
-    translator->load(QLocale(), "commhistoryd", "-", "/usr/share/translations");
+    {
+        STARTUP_PROFILE_SCOPE("translations");
+        engineeringEnglish->load("commhistoryd_eng_en", "/usr/share/translations");
+        translator->load(QLocale(), "commhistoryd", "-", "/usr/share/translations");
 
-    app.installTranslator(engineeringEnglish.data());
-    app.installTranslator(translator.data());
+        app.installTranslator(engineeringEnglish.data());
+        app.installTranslator(translator.data());
+    }
 
-    CommHistoryService *chService = CommHistoryService::instance();
+    CommHistoryService *chService;
+    {
+        STARTUP_PROFILE_SCOPE("CommHistoryService");
+        chService = CommHistoryService::instance();
+    }
     if (!chService->isRegistered()) {
         qCritical() << "CommHistoryService registration failed (already running or DBus not found), exiting";
         _exit(1);
     }
     new CommHistoryIfAdaptor(chService);
+    // Created up front, worker threads update its counters
+    DaemonStats::instance();
+    new StatsIfAdaptor(chService);
     qCDebug(lcCommhistoryd) << "CommHistoryService created";
 
-    ConnectionUtils *utils = new ConnectionUtils(&app);
+    ConnectionUtils *utils;
+    {
+        STARTUP_PROFILE_SCOPE("ConnectionUtils");
+        utils = new ConnectionUtils(&app);
+    }
 
     // ContactAuthorizationListener needs to be updated with nemo-notifications and new UI handling
     //new ContactAuthorizationListener(utils, chService);
 
-    AccountPresenceService *apService = new AccountPresenceService(utils->accountManager(), &app);
-    if (!apService->isRegistered()) {
-        qCritical() << "AccountPresenceService registration failed (already running or DBus not found), exiting";
-        _exit(1);
+    MessageReviver *reviver;
+    {
+        STARTUP_PROFILE_SCOPE("MessageReviver");
+        reviver = new MessageReviver(utils, &app);
     }
-    new AccountPresenceIfAdaptor(apService);
-    qCDebug(lcCommhistoryd) << "AccountPresenceService created";
-
-    MessageReviver *reviver = new MessageReviver(utils, &app);
-    qCDebug(lcCommhistoryd) << "Message reviver created, starting main loop";
+    qCDebug(lcCommhistoryd) << "Message reviver created";
 
     if (toggleDebug) {
         Tp::enableDebug(true);
         Tp::enableWarnings(true);
     }
-    new Logger(utils->accountManager(),
-               reviver,
-               &app);
+    {
+        STARTUP_PROFILE_SCOPE("Logger");
+        new Logger(utils->accountManager(),
+                   reviver,
+                   &app);
+    }
     qCDebug(lcCommhistoryd) << "Logger created";
 
-    NotificationManager::instance();
-    qCDebug(lcCommhistoryd) << "NotificationManager created";
-
-    new LastDialedCache(&app);
-    qCDebug(lcCommhistoryd) << "LastDialedCache created";
-
+    // The rest isn't needed to accept channels and is created once the
+    // main loop runs. Listeners create NotificationManager on demand if a
+    // message arrives before it's scheduled.
+    startup->schedule("NotificationManager", StartupScheduler::High, [] {
+        NotificationManager::instance();
+    });
+    startup->schedule("MmsHandler", StartupScheduler::High, [&app] {
+        new MmsHandlerAdaptor(new MmsHandler(&app));
+    });
+    startup->schedule("SmartMessaging", StartupScheduler::High, [&app] {
+        new SmartMessaging(&app);
+    });
+    startup->schedule("AccountPresenceService", StartupScheduler::Normal, [&app, utils] {
+        AccountPresenceService *apService = new AccountPresenceService(utils->accountManager(), &app);
+        if (!apService->isRegistered()) {
+            qCritical() << "AccountPresenceService registration failed (already running or DBus not found), exiting";
+            _exit(1);
+        }
+        new AccountPresenceIfAdaptor(apService);
+    });
+    startup->schedule("LastDialedCache", StartupScheduler::Normal, [&app] {
+        new LastDialedCache(&app);
+    });
     // Init account operations observer to monitor account removals and to react to them.
-    new AccountOperationsObserver(utils->accountManager(), &app);
-
-    new MmsHandlerAdaptor(new MmsHandler(&app));
-    new SmartMessaging(&app);
-    new FsCleanup(&app);
-
+    startup->schedule("AccountOperationsObserver", StartupScheduler::Low, [&app, utils] {
+        new AccountOperationsObserver(utils->accountManager(), &app);
+    });
+    startup->schedule("FsCleanup", StartupScheduler::Low, [&app] {
+        new FsCleanup(&app);
+    });
+    // Optional, see StallWatchdog
+    startup->schedule("StallWatchdog", StartupScheduler::Low, [&app] {
+        StallWatchdog::create(&app);
+    });
+
+    qCDebug(lcCommhistoryd) << "Starting main loop after" << startup->elapsed() << "ms";
+    STARTUP_PROFILE_READY("enteringMainLoop");
     int result = app.exec();
 
     close(sigtermFd[0]);
     close(sigtermFd[1]);
+    close(sigusrFd[0]);
+    close(sigusrFd[1]);
 
     qCDebug(lcCommhistoryd) << "exit";
 
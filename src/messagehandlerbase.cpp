@@ -20,11 +20,12 @@
 ******************************************************************************/
 
 #include "messagehandlerbase.h"
+#include "groupcache.h"
 #include "constants.h"
 #include "debug.h"
 
 #include <CommHistory/event.h>
-#include <CommHistory/groupmanager.h>
+#include <CommHistory/group.h>
 #include <CommHistory/commhistorydatabasepath.h>
 
 #include <QDBusConnection>
@@ -38,8 +39,7 @@ using namespace CommHistory;
 MessageHandlerBase::MessageHandlerBase(QObject* parent, QString objectPath,
     QString serviceName) :
     QObject(parent),
-    m_isRegistered(false),
-    groupManager(NULL)
+    m_isRegistered(false)
 {
     QDBusConnection dbus = QDBusConnection::systemBus();
     if (!dbus.isConnected()) {
@@ -71,30 +71,21 @@ QString MessageHandlerBase::messagePartPath(int eventId, QString contentId)
 
 bool MessageHandlerBase::setGroupForEvent(Event& event)
 {
-    if (!groupManager) {
-        groupManager = new GroupManager(this);
-        if (!groupManager->getGroups()) {
-            delete groupManager;
-            groupManager = NULL;
-            return false;
-        }
-    }
-
-    GroupObject* group = groupManager->findGroup(event.localUid(), event.recipients().value(0).remoteUid());
-    if (group) {
-        event.setGroupId(group->id());
+    const Recipient recipient(event.localUid(), event.recipients().value(0).remoteUid());
+    Group group = GroupCache::instance()->findGroup(recipient);
+    if (group.isValid()) {
+        event.setGroupId(group.id());
         return true;
     }
 
-    qCDebug(lcCommhistoryd) << "Creating new group for event" << event.recipients().value(0).remoteUid();
-    Group newGroup;
-    newGroup.setLocalUid(event.localUid());
-    newGroup.setRecipients(Recipient(event.localUid(), event.recipients().value(0).remoteUid()));
-    if (!groupManager->addGroup(newGroup)) {
-        qCritical() << "Failed adding new group for event" << newGroup.toString();
+    qCDebug(lcCommhistoryd) << "Creating new group for event" << recipient.remoteUid();
+    group.setLocalUid(event.localUid());
+    group.setRecipients(recipient);
+    if (!GroupCache::instance()->addGroup(group)) {
+        qCritical() << "Failed adding new group for event" << group.toString();
         return false;
     }
 
-    event.setGroupId(newGroup.id());
+    event.setGroupId(group.id());
     return true;
 }
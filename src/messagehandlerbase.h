@@ -26,7 +26,6 @@
 
 namespace CommHistory {
     class Event;
-    class GroupManager;
 }
 
 // Base class for MmsHandler and SmartMessaging
@@ -45,7 +44,6 @@ protected:
 
 private:
     bool m_isRegistered;
-    CommHistory::GroupManager* groupManager;
 };
 
 #endif // MESSAGEHANDLERBASE_H
@@ -0,0 +1,189 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "messageheader.h"
+#include "constants.h"
+
+#include <QHash>
+#include <QtDBus/QtDBus>
+
+#include <TelepathyQt/Message>
+
+// delivery report
+#define DELIVERY_STATUS       QLatin1String("delivery-status")
+#define DELIVERY_TOKEN        QLatin1String("delivery-token")
+#define DELIVERY_DBUSERROR    QLatin1String("delivery-dbus-error")
+#define DELIVERY_ERRORMESSAGE QLatin1String("delivery-error-message")
+#define DELIVERY_ECHO         QLatin1String("delivery-echo")
+
+// voicemail
+#define TXT_VOICE            QLatin1String("voice")
+#define MAILBOX_NOTIFICATION QLatin1String("x-nokia-mailbox-notification")
+#define VOICEMAIL_TYPE       QLatin1String("x-nokia-voicemail-type")
+#define MAILBOX_UNREAD_COUNT QLatin1String("x-nokia-mailbox-unread-count")
+#define MAILBOX_HAS_UNREAD   QLatin1String("x-nokia-mailbox-has-unread")
+
+// message editing support
+#define SUPERSEDES_TOKEN    QLatin1String("supersedes")
+
+#define PENDING_MESSAGE_ID_PROPERTY_NAME QLatin1String("pending-message-id")
+#define SUBSCRIBER_IDENTITY_HEADER_KEY QLatin1String("subscriber-identity")
+#define EXISTING_EVENT_ID QLatin1String("x-commhistory-event-id")
+
+using namespace RTComLogger;
+
+namespace {
+
+enum HeaderKey {
+    PendingMessageId,
+    ReplaceType,
+    Supersedes,
+    SubscriberIdentity,
+    MailboxNotification,
+    VoicemailType,
+    MailboxHasUnread,
+    MailboxUnreadCount,
+    DeliveryToken,
+    DeliveryStatus,
+    DeliveryDBusError,
+    DeliveryErrorMessage,
+    DeliveryEcho,
+    ExistingEventId
+};
+
+const QHash<QString, int> &headerKeys()
+{
+    static const QHash<QString, int> keys {
+        { PENDING_MESSAGE_ID_PROPERTY_NAME, PendingMessageId },
+        { REPLACE_TYPE, ReplaceType },
+        { SUPERSEDES_TOKEN, Supersedes },
+        { SUBSCRIBER_IDENTITY_HEADER_KEY, SubscriberIdentity },
+        { MAILBOX_NOTIFICATION, MailboxNotification },
+        { VOICEMAIL_TYPE, VoicemailType },
+        { MAILBOX_HAS_UNREAD, MailboxHasUnread },
+        { MAILBOX_UNREAD_COUNT, MailboxUnreadCount },
+        { DELIVERY_TOKEN, DeliveryToken },
+        { DELIVERY_STATUS, DeliveryStatus },
+        { DELIVERY_DBUSERROR, DeliveryDBusError },
+        { DELIVERY_ERRORMESSAGE, DeliveryErrorMessage },
+        { DELIVERY_ECHO, DeliveryEcho },
+        { EXISTING_EVENT_ID, ExistingEventId }
+    };
+    return keys;
+}
+
+}
+
+MessageHeader::MessageHeader()
+    : pendingMessageId(0),
+      voicemail(false),
+      mailboxHasUnread(false),
+      mailboxUnreadCount(0),
+      hasDeliveryStatus(false),
+      deliveryStatus(0),
+      existingEventId(-1)
+{
+}
+
+MessageHeader::MessageHeader(const Tp::MessagePart &header)
+    : MessageHeader()
+{
+    decode(header);
+}
+
+MessageHeader::MessageHeader(const Tp::Message &message)
+    : MessageHeader()
+{
+    decode(message.header());
+}
+
+uint MessageHeader::pendingId(const Tp::MessagePart &header)
+{
+    Tp::MessagePart::const_iterator it = header.constFind(PENDING_MESSAGE_ID_PROPERTY_NAME);
+    if (it == header.constEnd())
+        return 0;
+
+    const QVariant value(it.value().variant());
+    return value.isValid() ? value.toUInt() : 0;
+}
+
+void MessageHeader::decode(const Tp::MessagePart &header)
+{
+    const QHash<QString, int> &keys(headerKeys());
+
+    for (Tp::MessagePart::const_iterator it = header.constBegin(); it != header.constEnd(); ++it) {
+        QHash<QString, int>::const_iterator key = keys.constFind(it.key());
+        if (key == keys.constEnd())
+            continue;
+
+        const QVariant value(it.value().variant());
+        if (!value.isValid())
+            continue;
+
+        switch (key.value()) {
+        case PendingMessageId:
+            pendingMessageId = value.toUInt();
+            break;
+        case ReplaceType:
+            replaceType = value.toString();
+            break;
+        case Supersedes:
+            supersedes = value.toString();
+            break;
+        case SubscriberIdentity:
+            subscriberIdentity = value.toString();
+            break;
+        case MailboxNotification:
+            voicemail = (value.toString() == TXT_VOICE);
+            break;
+        case VoicemailType:
+            // "skype" or "tel", both SMS and Skype voicemail notifications
+            // MUST have this header
+            voicemailType = value.toString();
+            break;
+        case MailboxHasUnread:
+            mailboxHasUnread = value.toBool();
+            break;
+        case MailboxUnreadCount:
+            mailboxUnreadCount = value.toUInt();
+            break;
+        case DeliveryToken:
+            deliveryToken = value.toString();
+            break;
+        case DeliveryStatus:
+            hasDeliveryStatus = true;
+            deliveryStatus = value.toInt();
+            break;
+        case DeliveryDBusError:
+            deliveryDBusError = value.toString();
+            break;
+        case DeliveryErrorMessage:
+            deliveryErrorMessage = value.toString();
+            break;
+        case DeliveryEcho:
+            deliveryEcho = qdbus_cast<Tp::MessagePartList>(value);
+            break;
+        case ExistingEventId:
+            existingEventId = value.toInt();
+            break;
+        }
+    }
+}
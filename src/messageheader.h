@@ -0,0 +1,86 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef MESSAGEHEADER_H
+#define MESSAGEHEADER_H
+
+#include <QString>
+#include <QVariant>
+
+#include <TelepathyQt/Types>
+
+namespace Tp {
+    class Message;
+}
+
+namespace RTComLogger
+{
+
+/*!
+ * \class MessageHeader
+ * \brief Header fields of a Telepathy message the text channel listener
+ * cares about.
+ *
+ * The header part is walked once and every known key is unwrapped from its
+ * QDBusVariant on the way, instead of looking up each field separately.
+ */
+class MessageHeader
+{
+public:
+    MessageHeader();
+    explicit MessageHeader(const Tp::MessagePart &header);
+    explicit MessageHeader(const Tp::Message &message);
+
+    /*!
+     * \brief Reads only the pending message id, for callers which need
+     * nothing else from the header.
+     */
+    static uint pendingId(const Tp::MessagePart &header);
+
+    uint pendingMessageId;
+    QString replaceType;
+    QString supersedes;
+    QString subscriberIdentity;
+
+    // voicemail notification
+    bool voicemail;
+    QString voicemailType;
+    bool mailboxHasUnread;
+    uint mailboxUnreadCount;
+
+    // delivery report
+    QString deliveryToken;
+    bool hasDeliveryStatus;
+    int deliveryStatus;
+    QString deliveryDBusError;
+    QString deliveryErrorMessage;
+    Tp::MessagePartList deliveryEcho;
+
+    // set for messages sent through commhistoryd
+    int existingEventId;
+
+private:
+    void decode(const Tp::MessagePart &header);
+};
+
+} // namespace RTComLogger
+
+#endif // MESSAGEHEADER_H
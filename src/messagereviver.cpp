@@ -29,6 +29,7 @@
 #include "constants.h"
 #include "messagereviver.h"
 #include "connectionutils.h"
+#include "daemonstats.h"
 #include "debug.h"
 
 using namespace RTComLogger;
@@ -155,7 +156,12 @@ void MessageReviver::handleMessages(Tp::ConnectionPtr &connection)
 
     foreach (QString token, messageTokens) {
         Event event;
-        if (model.databaseIO().getEventByMessageToken(token, event)) {
+        bool found;
+        {
+            DatabaseQueryTimer queryTimer;
+            found = model.databaseIO().getEventByMessageToken(token, event);
+        }
+        if (found) {
             qCDebug(lcCommhistoryd) << "bury " << token;
             toBury << token;
         } else {
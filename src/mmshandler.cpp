@@ -21,6 +21,13 @@
 ******************************************************************************/
 
 #include "mmshandler.h"
+#include "modemregistry.h"
+#include "roamingwatcher.h"
+#include "mmssendqueue.h"
+#include "mmstransfermanager.h"
+#include "daemonstats.h"
+#include "flightrecorder.h"
+#include "structurepeek.h"
 #include "constants.h"
 #include "notificationmanager.h"
 #include "debug.h"
@@ -32,16 +39,16 @@
 #include <CommHistory/constants.h>
 #include <CommHistory/mmsconstants.h>
 
+#include <QDBusArgument>
 #include <QDBusConnection>
 #include <QDBusMessage>
 #include <QDBusPendingCall>
 #include <QDBusPendingCallWatcher>
+#include <QElapsedTimer>
 #include <QLoggingCategory>
+#include <QTimer>
 
 #include <mdconfgroup.h>
-#include <qofonosimmanager.h>
-#include <qofononetworkregistration.h>
-#include <qofonoconnectionmanager.h>
 #include <unistd.h>
 
 using namespace RTComLogger;
@@ -52,39 +59,49 @@ Q_LOGGING_CATEGORY(lcMmsHandler, "commhistoryd.mmshandler", QtWarningMsg)
 static const QString kSettingSendFlags("/mms/send-flags");
 static const QString kSettingAutomaticDownload("/mms/automatic-download");
 static const QString kSettingSendReadReports("/mms/send-read-reports");
-static const QString kNetworkStatusRoaming("roaming");
 static const char *kCallPropertyEventId = "mms-event-id";
 
-class MmsHandlerModem
+// Synchronous model calls, counted in the daemon statistics
+static Event getEventById(SingleEventModel &model, int eventId)
 {
-public:
-    MmsHandlerModem(const QString &path, QObject *parent) :
-        sim(new QOfonoSimManager(parent)),
-        network(new QOfonoNetworkRegistration(parent)),
-        connection(new QOfonoConnectionManager(parent))
-    {
-        sim->setModemPath(path);
-        network->setModemPath(path);
-        connection->setModemPath(path);
-    }
+    DatabaseQueryTimer queryTimer;
+    return model.getEventById(eventId) ? model.event() : Event();
+}
 
-    ~MmsHandlerModem()
-    {
-        delete sim;
-        delete network;
-        delete connection;
-    }
+static Event getEventByMmsId(SingleEventModel &model, const QString &mmsId)
+{
+    DatabaseQueryTimer queryTimer;
+    return model.getEventByTokens(QString(), mmsId, -1) ? model.event() : Event();
+}
 
-    QOfonoSimManager *sim;
-    QOfonoNetworkRegistration *network;
-    QOfonoConnectionManager *connection;
-};
+static bool addEvent(EventModel &model, Event &event)
+{
+    DatabaseQueryTimer queryTimer;
+    return model.addEvent(event);
+}
+
+static bool modifyEvent(EventModel &model, Event &event)
+{
+    DatabaseQueryTimer queryTimer;
+    return model.modifyEvent(event);
+}
+
+static bool modifyEvents(EventModel &model, QList<Event> &events)
+{
+    DatabaseQueryTimer queryTimer;
+    return model.modifyEvents(events);
+}
 
 MmsHandler::MmsHandler(QObject* parent)
     : MessageHandlerBase(parent, MMS_HANDLER_PATH, MMS_HANDLER_SERVICE)
-    , m_ofonoManager(QOfonoManager::instance())
+    , m_modemRegistry(ModemRegistry::instance())
+    , m_roamingWatcher(new RoamingWatcher(this))
     , m_ofonoExtModemManager(QOfonoExtModemManager::instance())
     , m_imsiSettings(new MDConfGroup("/imsi", this))
+    , m_transfers(new MmsTransferManager(m_roamingWatcher, this))
+    , m_sendQueue(new MmsSendQueue(this))
+    , m_transferStateTimer(new QTimer(this))
+    , m_readReportTimer(new QTimer(this))
 {
     qDBusRegisterMetaType<MmsPart>();
     qDBusRegisterMetaType<MmsPartFd>();
@@ -92,22 +109,43 @@ MmsHandler::MmsHandler(QObject* parent)
     qDBusRegisterMetaType<MmsPartFdList>();
     qDBusRegisterMetaType<QList<CommHistory::Event> >();
 
-    QOfonoManager* ofonoManager = m_ofonoManager.data();
-    connect(ofonoManager, SIGNAL(modemAdded(QString)), SLOT(onModemAdded(QString)));
-    connect(ofonoManager, SIGNAL(modemRemoved(QString)), SLOT(onModemRemoved(QString)));
+    connect(m_roamingWatcher, SIGNAL(dataProhibitedChanged(QString,bool)),
+            SLOT(onDataProhibitedChanged(QString,bool)));
+
+    // Read reports postponed for lack of a modem can be sent once it appears
+    connect(m_modemRegistry, SIGNAL(modemAdded(QString)), SLOT(onModemsChanged()));
+    connect(m_modemRegistry, SIGNAL(subscriberIdentityChanged(QString,QString)), SLOT(onModemsChanged()));
 
-    if (m_ofonoManager->available())
-        addAllModems();
+    connect(m_transfers, SIGNAL(cancelRequested(QList<int>)), SLOT(onTransfersCancelRequested(QList<int>)));
 
-    connect(ofonoManager, SIGNAL(availableChanged(bool)), SLOT(onOfonoAvailableChanged(bool)));
+    DaemonStats *stats = DaemonStats::instance();
+    stats->addGauge(this, QStringLiteral("mmsActiveTransfers"),
+                    [this] { return qint64(m_transfers->activeCount()); });
+    stats->addGauge(this, QStringLiteral("mmsSuspendedTransfers"),
+                    [this] { return qint64(m_transfers->suspendedCount()); });
+    stats->addGauge(this, QStringLiteral("mmsSendQueue"),
+                    [this] { return qint64(m_sendQueue->count()); });
+    connect(m_transfers, SIGNAL(resumeRequested(int,int)), SLOT(onTransferResumeRequested(int,int)));
+
+    connect(m_sendQueue, SIGNAL(partsCopied(int,bool,QList<CommHistory::MessagePart>,QString)),
+            SLOT(onSendPartsCopied(int,bool,QList<CommHistory::MessagePart>,QString)));
+    connect(m_sendQueue, SIGNAL(dispatchRequested(int)), SLOT(onSendDispatchRequested(int)));
+
+    m_transferStateTimer->setSingleShot(true);
+    m_transferStateTimer->setInterval(MMS_TRANSFER_STATE_DELAY);
+    connect(m_transferStateTimer, SIGNAL(timeout()), SLOT(flushTransferStates()));
+
+    m_readReportTimer->setSingleShot(true);
+    m_readReportTimer->setInterval(READ_REPORT_BATCH_DELAY);
+    connect(m_readReportTimer, SIGNAL(timeout()), SLOT(processReadReports()));
 
     QDBusConnection dbus(QDBusConnection::sessionBus());
     if (!dbus.connect(QString(), COMM_HISTORY_OBJECT_PATH, COMM_HISTORY_INTERFACE,
-        EVENTS_UPDATED_SIGNAL, this, SLOT(onEventsUpdated(QList<CommHistory::Event>)))) {
+        EVENTS_UPDATED_SIGNAL, this, SLOT(onEventsUpdated(QDBusMessage)))) {
         qWarning() << "MmsHandler: failed to register" << EVENTS_UPDATED_SIGNAL << "handler";
     }
     if (!dbus.connect(QString(), COMM_HISTORY_OBJECT_PATH, COMM_HISTORY_INTERFACE,
-        GROUPS_UPDATED_FULL_SIGNAL, this, SLOT(onGroupsUpdatedFull(QList<CommHistory::Group>)))) {
+        GROUPS_UPDATED_FULL_SIGNAL, this, SLOT(onGroupsUpdatedFull(QDBusMessage)))) {
         qWarning() << "MmsHandler: failed to register" << GROUPS_UPDATED_FULL_SIGNAL << "handler";
     }
 }
@@ -120,54 +158,6 @@ QDBusPendingCall MmsHandler::callEngine(const QString &method, const QVariantLis
     return MMS_ENGINE_BUS.asyncCall(call);
 }
 
-void MmsHandler::onOfonoAvailableChanged(bool available)
-{
-    qCDebug(lcMmsHandler) << "MmsHandler: ofono available changed to" << available;
-    if (available) {
-        addAllModems();
-    } else {
-        qDeleteAll(m_modems.values());
-        m_modems.clear();
-    }
-}
-
-void MmsHandler::onModemAdded(QString path)
-{
-    qCDebug(lcMmsHandler) << "MmsHandler: onModemAdded" << path;
-    addModem(path);
-}
-
-void MmsHandler::onModemRemoved(QString path)
-{
-    qCDebug(lcMmsHandler) << "MmsHandler: onModemRemoved" << path;
-    delete m_modems.take(path);
-}
-
-
-void MmsHandler::addAllModems()
-{
-    QStringList modems = m_ofonoManager->modems();
-    foreach (QString path, modems) {
-        addModem(path);
-    }
-}
-
-void MmsHandler::addModem(const QString &path)
-{
-    if (m_modems.contains(path))
-        return;
-
-    qCDebug(lcMmsHandler) << "MmsHandler: addModem" << path;
-
-    MmsHandlerModem *m = new MmsHandlerModem(path, this);
-    m_modems.insert(path, m);
-
-    connect(m->network, SIGNAL(statusChanged(const QString &)),
-                     SLOT(onStatusChanged(const QString &)));
-    connect(m->connection, SIGNAL(roamingAllowedChanged(bool)),
-                        SLOT(onRoamingAllowedChanged(bool)));
-}
-
 QString MmsHandler::getModemPath(const CommHistory::Event &event) const
 {
     return getModemPath(event.subscriberIdentity());
@@ -175,19 +165,13 @@ QString MmsHandler::getModemPath(const CommHistory::Event &event) const
 
 QString MmsHandler::getModemPath(const QString &imsi) const
 {
-    QString path;
-
-    QHash<QString, MmsHandlerModem*>::const_iterator i = m_modems.constBegin();
-    while (i != m_modems.constEnd()) {
-        const MmsHandlerModem *m = i.value();
-        if (m->sim->isValid() && m->sim->subscriberIdentity() == imsi) {
-            path = m->sim->modemPath();
-            break;
-        }
-        ++i;
-    }
+    return m_modemRegistry->modemPath(imsi);
+}
 
-    return path;
+QString MmsHandler::getSendModemPath(const Event &event) const
+{
+    const QString imsi(event.subscriberIdentity());
+    return getModemPath(imsi.isEmpty() ? getDefaultVoiceSim() : imsi);
 }
 
 QString MmsHandler::getDefaultVoiceSim() const
@@ -195,9 +179,8 @@ QString MmsHandler::getDefaultVoiceSim() const
     if (m_ofonoExtModemManager->valid()) {
         QString path = m_ofonoExtModemManager->defaultVoiceModem();
         if (!path.isEmpty()) {
-            MmsHandlerModem *modem = m_modems.value(path);
-            if (modem && modem->sim->isValid()) {
-                QString imsi(modem->sim->subscriberIdentity());
+            QString imsi(m_modemRegistry->subscriberIdentity(path));
+            if (!imsi.isEmpty()) {
                 qCDebug(lcMmsHandler) << "default voice sim for" << path << "is" << imsi;
                 return imsi;
             }
@@ -224,7 +207,12 @@ QString MmsHandler::messageNotification(const QString &imsi, const QString &from
 
     if (!location.isEmpty()) {
         Event event;
-        if (CommHistory::DatabaseIO::instance()->getEventByMmsId(location, event)) {
+        bool found;
+        {
+            DatabaseQueryTimer queryTimer;
+            found = CommHistory::DatabaseIO::instance()->getEventByMmsId(location, event);
+        }
+        if (found) {
             qWarning() << "MmsHandler: MMS event" << location
                        << "is already in the database, id =" << event.id();
             return QString();
@@ -258,13 +246,17 @@ QString MmsHandler::messageNotification(const QString &imsi, const QString &from
     }
 
     EventModel model;
-    if (!model.addEvent(event)) {
+    if (!addEvent(model, event)) {
         qCritical() << "Failed to save MMS notification event; message dropped" << event.toString();
         return QString();
     }
+    FlightRecorder::instance()->record(FlightRecorder::MmsNotification, event.id(), location, event.status());
 
     if (!manualDownload) {
-        m_activeEvents.insert(modemPath, event.id());
+        m_transfers->add(event.id(), imsi, MmsTransferManager::Receive);
+        TransferState state;
+        state.committed = state.pending = event.status();
+        m_transferStates.insert(event.id(), state);
     } else {
         // Show a notification when manual download is needed
         NotificationManager::instance()->showNotification(event, from, Group::ChatTypeP2P);
@@ -285,18 +277,15 @@ enum MessageReceiveState {
 
 void MmsHandler::messageReceiveStateChanged(const QString &recId, int state)
 {
-    Event event;
-    SingleEventModel model;
-    if (model.getEventById(recId.toInt()))
-        event = model.event();
-
-    if (!event.isValid()) {
+    const int id = recId.toInt();
+    Event::EventStatus status;
+    if (!transferStatus(id, &status)) {
         qWarning() << "Ignoring MMS message receive state for unknown event" << recId;
-        m_activeEvents.remove(getModemPath(event), recId.toInt());
+        m_transfers->remove(id);
         return;
     }
 
-    Event::EventStatus newStatus = event.status();
+    Event::EventStatus newStatus = status;
     switch (state) {
         case Deferred:
             newStatus = Event::WaitingStatus;
@@ -307,9 +296,12 @@ void MmsHandler::messageReceiveStateChanged(const QString &recId, int state)
             break;
         case NoSpace:
         case RecvError:
-            // Avoid overwriting the status for cancelled receive calls
-            if (event.status() == Event::ManualNotificationStatus)
+            // Avoid overwriting the status for cancelled receive calls,
+            // finishTransfer() checks the database for the same reason
+            if (status == Event::ManualNotificationStatus) {
+                m_transferStates.remove(id);
                 return;
+            }
             newStatus = Event::TemporarilyFailedStatus;
             break;
         case Garbage:
@@ -317,15 +309,122 @@ void MmsHandler::messageReceiveStateChanged(const QString &recId, int state)
             break;
     }
 
-    if (newStatus != event.status()) {
-        event.setStatus(newStatus);
-        if (!model.modifyEvent(event))
-            qWarning() << "Failed updating MMS event status for" << recId;
+    if (newStatus == Event::WaitingStatus || newStatus == Event::DownloadingStatus) {
+        setTransferStatus(id, newStatus);
+    } else {
+        finishTransfer(id, newStatus);
+    }
+}
 
-        if (newStatus != Event::WaitingStatus && newStatus != Event::DownloadingStatus) {
-            m_activeEvents.remove(getModemPath(event), event.id());
-            NotificationManager::instance()->showNotification(event, event.recipients().value(0).remoteUid(), Group::ChatTypeP2P);
+bool MmsHandler::transferStatus(int eventId, Event::EventStatus *status)
+{
+    QHash<int, TransferState>::const_iterator it = m_transferStates.constFind(eventId);
+    if (it != m_transferStates.constEnd()) {
+        *status = it->pending;
+        return true;
+    }
+
+    SingleEventModel model;
+    const Event event(getEventById(model, eventId));
+    if (!event.isValid())
+        return false;
+
+    *status = event.status();
+    TransferState state;
+    state.committed = state.pending = *status;
+    m_transferStates.insert(eventId, state);
+    return true;
+}
+
+void MmsHandler::setTransferStatus(int eventId, Event::EventStatus status)
+{
+    // Intermediate states are only kept in memory for a while, and get
+    // written only if the status visible to the user has changed
+    FlightRecorder::instance()->record(FlightRecorder::MmsTransferState, eventId, QString(), status);
+    TransferState &state(m_transferStates[eventId]);
+    state.pending = status;
+    if (state.pending != state.committed && !m_transferStateTimer->isActive())
+        m_transferStateTimer->start();
+}
+
+void MmsHandler::finishTransfer(int eventId, Event::EventStatus status, const QString &details)
+{
+    // Final states are written right away
+    FlightRecorder::instance()->record(FlightRecorder::MmsTransferFinished, eventId, QString(), status);
+
+    // The call cancelled due to roaming reported back only after the
+    // transfer was resumed; the resumed call is still going on
+    if (m_transfers->takeCancelled(eventId) && !m_transfers->isSuspended(eventId)) {
+        qCDebug(lcMmsHandler) << "MmsHandler: ignoring final state of cancelled call for resumed transfer" << eventId;
+        return;
+    }
+
+    m_transferStates.remove(eventId);
+
+    SingleEventModel model;
+    Event event(getEventById(model, eventId));
+
+    if (!event.isValid()) {
+        qWarning() << "Ignoring final MMS transfer state for unknown event" << eventId;
+        m_transfers->remove(eventId);
+        return;
+    }
+
+    // Transfers cancelled because of roaming restrictions fail quietly,
+    // they will be resumed later
+    const bool suspended = m_transfers->isSuspended(eventId);
+    if (!suspended)
+        m_transfers->remove(eventId);
+
+    // The receive was cancelled from the UI after the cached state was
+    // read, don't overwrite the status it set
+    if (event.status() == Event::ManualNotificationStatus) {
+        qCDebug(lcMmsHandler) << "MmsHandler: ignoring final state of cancelled transfer" << eventId;
+        return;
+    }
+
+    if (status != event.status()) {
+        event.setStatus(status);
+        if (!modifyEvent(model, event))
+            qWarning() << "Failed updating MMS event status for" << eventId;
+
+        if (!suspended)
+            NotificationManager::instance()->showNotification(event, event.recipients().value(0).remoteUid(), Group::ChatTypeP2P, details);
+    }
+}
+
+void MmsHandler::flushTransferStates()
+{
+    QList<Event> events;
+    SingleEventModel model;
+
+    QHash<int, TransferState>::iterator it = m_transferStates.begin();
+    while (it != m_transferStates.end()) {
+        TransferState &state(it.value());
+        if (state.pending == state.committed) {
+            ++it;
+            continue;
         }
+
+        state.committed = state.pending;
+        Event event(getEventById(model, it.key()));
+        // Cancelled from the UI meanwhile
+        if (event.isValid() && event.status() == Event::ManualNotificationStatus) {
+            it = m_transferStates.erase(it);
+            continue;
+        }
+        if (event.isValid() && event.status() != state.pending) {
+            event.setStatus(state.pending);
+            events.append(event);
+        }
+        ++it;
+    }
+
+    if (!events.isEmpty()) {
+        qCDebug(lcMmsHandler) << "MmsHandler: updating status of" << events.count() << "MMS transfer(s)";
+        EventModel eventModel;
+        if (!modifyEvents(eventModel, events))
+            qWarning() << "Failed updating status of" << events.count() << "MMS event(s)";
     }
 }
 
@@ -333,12 +432,14 @@ void MmsHandler::messageReceived(const QString &recId, const QString &mmsId, con
         const QStringList &to, const QStringList &cc, const QString &subj, uint date, int priority,
         const QString &cls, bool readReport, MmsPartList parts)
 {
-    Event event;
+    FlightRecorder::instance()->record(FlightRecorder::MmsReceived, recId.toInt(), mmsId, parts.count());
+    // Final status is written below
+    m_transferStates.remove(recId.toInt());
+
     SingleEventModel model;
-    if (model.getEventById(recId.toInt()))
-        event = model.event();
+    Event event(getEventById(model, recId.toInt()));
 
-    m_activeEvents.remove(getModemPath(event), recId.toInt());
+    m_transfers->remove(recId.toInt());
 
     if (!event.isValid()) {
         qWarning() << "Received messageReceived with unknown recId. Setting localUid to currently active account path.";
@@ -385,6 +486,7 @@ void MmsHandler::messageReceived(const QString &recId, const QString &mmsId, con
         if (oldGroup != event.groupId()) {
             int newGroup = event.groupId();
             event.setGroupId(oldGroup);
+            DatabaseQueryTimer queryTimer;
             if (!model.moveEvent(event, newGroup))
                 qCritical() << "Failed moving MMS received event from group" << oldGroup << "to" << newGroup << event.toString();
             event.setGroupId(newGroup);
@@ -392,7 +494,7 @@ void MmsHandler::messageReceived(const QString &recId, const QString &mmsId, con
     }
 
     // If there wasn't a matching notification, save first to get the event ID before message parts
-    if (event.id() < 0 && !model.addEvent(event)) {
+    if (event.id() < 0 && !addEvent(model, event)) {
         qCritical() << "Failed adding MMS received event; message dropped: " << event.toString();
         return;
     }
@@ -404,7 +506,7 @@ void MmsHandler::messageReceived(const QString &recId, const QString &mmsId, con
         event.setMessageParts(eventParts);
         event.setFreeText(freeText);
 
-        if (!model.modifyEvent(event)) {
+        if (!modifyEvent(model, event)) {
             qCritical() << "Failed updating MMS received event:" << event.toString();
             ok = false;
         }
@@ -416,13 +518,11 @@ void MmsHandler::messageReceived(const QString &recId, const QString &mmsId, con
             QFile::remove(part.path());
 
         // Re-query event to avoid wiping out notification data
-        if (model.getEventById(event.id())) {
-            event = model.event();
-            if (event.isValid()) {
-                event.setStatus(Event::TemporarilyFailedStatus);
-                model.modifyEvent(event);
-                NotificationManager::instance()->showNotification(event, from, Group::ChatTypeP2P);
-            }
+        event = getEventById(model, event.id());
+        if (event.isValid()) {
+            event.setStatus(Event::TemporarilyFailedStatus);
+            modifyEvent(model, event);
+            NotificationManager::instance()->showNotification(event, from, Group::ChatTypeP2P);
         }
 
         return;
@@ -433,7 +533,6 @@ void MmsHandler::messageReceived(const QString &recId, const QString &mmsId, con
                           << "parts:" << event.toString();
 }
 
-// Caller is responsible for cleaning up copied files on failure
 bool MmsHandler::copyMmsPartFiles(const MmsPartList &parts, int eventId, QList<MessagePart> &eventParts, QString &freeText)
 {
     foreach (const MmsPart &part, parts) {
@@ -496,18 +595,15 @@ void MmsHandler::messageSendStateChanged(const QString &recId, int state, const
 
     qCDebug(lcMmsHandler) << "MmsHandler: message" << recId << "state" << state << details;
 
-    Event event;
-    SingleEventModel model;
-    if (model.getEventById(recId.toInt()))
-        event = model.event();
-
-    if (!event.isValid()) {
+    const int id = recId.toInt();
+    Event::EventStatus status;
+    if (!transferStatus(id, &status)) {
         qWarning() << "Ignoring MMS message send state for unknown event" << recId;
-        m_activeEvents.remove(getModemPath(event), recId.toInt());
+        m_transfers->remove(id);
         return;
     }
 
-    Event::EventStatus newStatus = event.status();
+    Event::EventStatus newStatus = status;
     switch (state) {
         case Encoding:
         case Sending:
@@ -524,26 +620,23 @@ void MmsHandler::messageSendStateChanged(const QString &recId, int state, const
             break;
     }
 
-    if (newStatus != event.status()) {
-        event.setStatus(newStatus);
-        if (!model.modifyEvent(event))
-            qWarning() << "Failed updating MMS event status for" << recId;
-
-        if (newStatus != Event::SendingStatus) {
-            m_activeEvents.remove(getModemPath(event), event.id());
-            NotificationManager::instance()->showNotification(event, event.recipients().value(0).remoteUid(), Group::ChatTypeP2P, details);
-        }
+    if (newStatus == Event::SendingStatus) {
+        setTransferStatus(id, newStatus);
+    } else {
+        finishTransfer(id, newStatus, details);
     }
 }
 
 void MmsHandler::messageSent(const QString &recId, const QString &mmsId)
 {
-    Event event;
+    FlightRecorder::instance()->record(FlightRecorder::MmsSent, recId.toInt(), mmsId);
+    // Final status is written below
+    m_transferStates.remove(recId.toInt());
+
     SingleEventModel model;
-    if (model.getEventById(recId.toInt()))
-        event = model.event();
+    Event event(getEventById(model, recId.toInt()));
 
-    m_activeEvents.remove(getModemPath(event), recId.toInt());
+    m_transfers->remove(recId.toInt());
 
     if (!event.isValid()) {
         qWarning() << "Ignoring MMS message sent state for unknown event" << recId;
@@ -552,7 +645,7 @@ void MmsHandler::messageSent(const QString &recId, const QString &mmsId)
 
     event.setStatus(Event::SentStatus);
     event.setMmsId(mmsId);
-    if (!model.modifyEvent(event))
+    if (!modifyEvent(model, event))
         qWarning() << "Failed updating MMS event sent status for" << recId;
 }
 
@@ -570,10 +663,8 @@ void MmsHandler::deliveryReport(const QString &imsi, const QString &mmsId, const
         Forwarded
     };
 
-    Event event;
     SingleEventModel model;
-    if (model.getEventByTokens(QString(), mmsId, -1))
-        event = model.event();
+    Event event(getEventByMmsId(model, mmsId));
 
     if (!event.isValid()) {
         qWarning() << "Ignoring MMS message delivery state for unknown event" << mmsId;
@@ -598,7 +689,7 @@ void MmsHandler::deliveryReport(const QString &imsi, const QString &mmsId, const
             break;
     }
 
-    if (!model.modifyEvent(event))
+    if (!modifyEvent(model, event))
         qWarning() << "Failed updating MMS event sent status for" << mmsId;
 }
 
@@ -606,10 +697,8 @@ void MmsHandler::readReport(const QString &imsi, const QString &mmsId, const QSt
 {
     Q_UNUSED(recipient); // No handling for read/delivery reports from multiple recipients
 
-    Event event;
     SingleEventModel model;
-    if (model.getEventByTokens(QString(), mmsId, -1))
-        event = model.event();
+    Event event(getEventByMmsId(model, mmsId));
 
     if (!event.isValid()) {
         qWarning() << "Ignoring MMS message read state for unknown event" << mmsId;
@@ -623,7 +712,7 @@ void MmsHandler::readReport(const QString &imsi, const QString &mmsId, const QSt
     else
         event.setReadStatus(Event::ReadStatusDeleted);
 
-    if (!model.modifyEvent(event))
+    if (!modifyEvent(model, event))
         qWarning() << "Failed updating MMS event sent status for" << mmsId;
 }
 
@@ -636,21 +725,24 @@ void MmsHandler::readReportSendStatus(const QString &recId, int status)
     };
 
     qCDebug(lcMmsHandler) << "MmsHandler:" << recId << "read report status" << status;
+    const int id = recId.toInt();
+    // Reports sent before a restart or by someone else aren't in flight
+    // here, their flag is cleared all the same
+    QHash<int, int>::iterator it = m_readReportsInFlight.find(id);
+    const int groupId = it != m_readReportsInFlight.end() ? it.value() : -1;
+    if (it != m_readReportsInFlight.end())
+        m_readReportsInFlight.erase(it);
+
     if (status != ReadReportTransientError) {
-        SingleEventModel model;
-        if (model.getEventById(recId.toInt())) {
-            Event event(model.event());
-            if (!event.isValid()) {
-                qWarning() << "Failed to find sent MMS by id";
-                return;
-            }
-            event.removeExtraProperty(MMS_PROPERTY_UNREAD);
-            if (!model.modifyEvent(event)) {
-                qWarning() << "Failed to update MMS event" << event.id();
-            }
+        // Done with this one, drop the flag with the next batch from the
+        // event as it is then
+        if (groupId >= 0) {
+            m_readReportsToClear.insert(id);
+            m_readReportGroups.insert(groupId);
         } else {
-            qWarning() << "Ignoring read report completion for unknown event" << recId;
+            m_unknownReadReportsToClear.insert(id);
         }
+        scheduleReadReports();
     }
 }
 
@@ -702,20 +794,37 @@ int MmsHandler::sendMessage(const QString &imsi, const QStringList &to, const QS
 
     // Save to get an event ID
     SingleEventModel model;
-    if (!model.addEvent(event)) {
+    if (!addEvent(model, event)) {
         qCritical() << "Failed adding outgoing MMS event:" << event.toString();
         return -1;
     }
 
-    // Copy message parts
-    QList<MessagePart> eventParts;
-    QString freeText;
-    bool ok = copyMmsPartFiles(parts, event.id(), eventParts, freeText);
-    if (ok) {
-        event.setMessageParts(eventParts);
+    // Parts are copied and the message is handed over to the engine
+    // asynchronously, the caller only needs the event id
+    if (!m_sendQueue->enqueue(event.id(), getSendModemPath(event), parts)) {
+        event.setStatus(Event::TemporarilyFailedStatus);
+        modifyEvent(model, event);
+        NotificationManager::instance()->showNotification(event, event.recipients().value(0).remoteUid(), Group::ChatTypeP2P);
+    }
+
+    return event.id();
+}
+
+void MmsHandler::onSendPartsCopied(int eventId, bool ok, const QList<MessagePart> &parts,
+        const QString &freeText)
+{
+    // Re-query event to avoid wiping out changes made in the meantime
+    SingleEventModel model;
+    Event event(getEventById(model, eventId));
+
+    if (!event.isValid()) {
+        qWarning() << "Outgoing MMS event" << eventId << "has disappeared";
+        ok = false;
+    } else if (ok) {
+        event.setMessageParts(parts);
         event.setFreeText(freeText);
 
-        if (!model.modifyEvent(event)) {
+        if (!modifyEvent(model, event)) {
             qCritical() << "Failed modifying outgoing MMS event:" << event.toString();
             ok = false;
         }
@@ -723,39 +832,60 @@ int MmsHandler::sendMessage(const QString &imsi, const QStringList &to, const QS
 
     if (!ok) {
         // Clean up copied MMS parts
-        foreach (const MessagePart &part, eventParts)
+        foreach (const MessagePart &part, parts)
             QFile::remove(part.path());
-        // Re-query event to avoid wiping out notification data
-        if (event.id() >= 0 && model.getEventById(event.id())) {
-            event = model.event();
-            if (event.isValid()) {
-                event.setStatus(Event::PermanentlyFailedStatus);
-                model.modifyEvent(event);
-            }
+
+        m_sendQueue->finished(eventId);
+        if (event.isValid()) {
+            event.setMessageParts(QList<MessagePart>());
+            event.setStatus(Event::PermanentlyFailedStatus);
+            modifyEvent(model, event);
+            NotificationManager::instance()->showNotification(event, event.recipients().value(0).remoteUid(), Group::ChatTypeP2P);
         }
-    } else if (isDataProhibited(m_ofonoExtModemManager->defaultVoiceModem())) {
+    }
+}
+
+void MmsHandler::onSendDispatchRequested(int eventId)
+{
+    SingleEventModel model;
+    Event event(getEventById(model, eventId));
+
+    if (!event.isValid()) {
+        qWarning() << "Outgoing MMS event" << eventId << "has disappeared";
+        m_sendQueue->finished(eventId);
+        return;
+    }
+
+    Event::EventStatus eventStatus;
+    if (isDataProhibited(getSendModemPath(event))) {
         qWarning() << "Refusing to send MMS message due to data roaming restrictions";
-        event.setStatus(Event::TemporarilyFailedStatus);
-        model.modifyEvent(event);
+        eventStatus = Event::TemporarilyFailedStatus;
     } else {
-        Event::EventStatus eventStatus = sendMessageFromEvent(event);
-        if (event.status() != eventStatus) {
-            event.setStatus(eventStatus);
-            model.modifyEvent(event);
-        }
+        eventStatus = sendMessageFromEvent(event);
     }
 
-    if (event.status() >= Event::TemporarilyFailedStatus)
+    if (eventStatus != Event::SendingStatus) {
+        // Nothing was handed over to the engine
+        m_sendQueue->finished(eventId);
+    } else {
+        TransferState state;
+        state.committed = state.pending = eventStatus;
+        m_transferStates.insert(eventId, state);
+    }
+
+    if (event.status() != eventStatus) {
+        event.setStatus(eventStatus);
+        modifyEvent(model, event);
+    }
+
+    if (eventStatus >= Event::TemporarilyFailedStatus)
         NotificationManager::instance()->showNotification(event, event.recipients().value(0).remoteUid(), Group::ChatTypeP2P);
-    return event.id();
 }
 
 void MmsHandler::sendMessageFromEvent(int eventId)
 {
-    Event event;
     SingleEventModel model;
-    if (model.getEventById(eventId))
-        event = model.event();
+    Event event(getEventById(model, eventId));
 
     if (!event.isValid() || event.type() != Event::MMSEvent || event.direction() != Event::Outbound) {
         qCritical() << "Ignoring MMS sendMessageFromEvent with irrelevant event:" << event.toString();
@@ -772,10 +902,16 @@ void MmsHandler::sendMessageFromEvent(int eventId)
         return;
     }
 
-    Event::EventStatus eventStatus = sendMessageFromEvent(event);
+    if (m_sendQueue->contains(eventId)) {
+        qWarning() << "Ignoring MMS sendMessageFromEvent for a message that is already being sent:" << eventId;
+        return;
+    }
+
+    Event::EventStatus eventStatus = m_sendQueue->enqueue(eventId, getSendModemPath(event)) ?
+                Event::SendingStatus : Event::TemporarilyFailedStatus;
     if (event.status() != eventStatus) {
         event.setStatus(eventStatus);
-        model.modifyEvent(event);
+        modifyEvent(model, event);
     }
 }
 
@@ -803,7 +939,7 @@ Event::EventStatus MmsHandler::sendMessageFromEvent(Event &event)
         args << event.id() << imsi << event.toList() << event.ccList() << event.bccList()
              << event.subject() << flags << QVariant::fromValue(parts);
 
-        m_activeEvents.insert(getModemPath(imsi), event.id());
+        m_transfers->add(event.id(), imsi, MmsTransferManager::Send);
 
         QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(callEngine("sendMessageFd", args), this);
         watcher->setProperty(kCallPropertyEventId, event.id());
@@ -820,20 +956,24 @@ void MmsHandler::onSendMessageFinished(QDBusPendingCallWatcher *call)
     bool ok = false;
     int eventId = call->property(kCallPropertyEventId).toInt(&ok);
 
+    // The engine has taken it over (or failed to), let the next one in
+    if (ok)
+        m_sendQueue->finished(eventId);
+
     SingleEventModel model;
-    if (ok && model.getEventById(eventId)) {
-        Event event = model.event();
+    if (ok) {
+        Event event(getEventById(model, eventId));
         if (reply.isError()) {
             qWarning() << "Call to MmsEngine sendMessage failed:" << reply.error();
             event.setStatus(Event::TemporarilyFailedStatus);
             // Commit the changes, in case if showNotification requires it
             // or will require in the future:
-            model.modifyEvent(event);
+            modifyEvent(model, event);
             NotificationManager::instance()->showNotification(event, event.recipients().value(0).remoteUid(), Group::ChatTypeP2P);
         } else {
             if (event.isValid()) {
                 event.setSubscriberIdentity(reply.value());
-                model.modifyEvent(event);
+                modifyEvent(model, event);
             } else {
                 qWarning() << "Cannot find sent message by id" << eventId;
             }
@@ -844,126 +984,272 @@ void MmsHandler::onSendMessageFinished(QDBusPendingCallWatcher *call)
 
 bool MmsHandler::isDataProhibited(const QString &path)
 {
-    if (!m_modems.contains(path))
-        return true;
-
-    MmsHandlerModem *m = m_modems[path];
-
-    if (m->network->status() != kNetworkStatusRoaming)
-        return false;
-    if (!m->connection->roamingAllowed())
-        return true;
-
-    // TODO: This property should be monitored asynchronously to avoid blocking dbus queries
-    QDBusInterface interface("com.jolla.Connectiond", "/Connectiond");
-    // For now, treat "always ask" like "never"
-    if (interface.property("askRoaming").toBool())
-        return true;
-    return false;
+    return m_roamingWatcher->isDataProhibited(path);
 }
 
 bool MmsHandler::canSendReadReports(const QString &path)
 {
-    if (!m_modems.contains(path))
+    if (!m_modemRegistry->modem(path))
         return false;
 
     return !isDataProhibited(path);
 }
 
-void MmsHandler::dataProhibitedChanged(const QString &path)
+void MmsHandler::onDataProhibitedChanged(const QString &path, bool prohibited)
 {
-    if (m_activeEvents.contains(path) && isDataProhibited(path)) {
-        qWarning() << "Cancelling" << m_activeEvents.count(path) << "active MMS events due to roaming restrictions";
-        // Cancel any active events to prevent automatic retries
-        QMultiMap<QString, int>::iterator i = m_activeEvents.find(path);
-        while (i != m_activeEvents.end() && i.key() == path) {
-            callEngine("cancel", QVariantList() << i.value());
-            ++i;
-        }
+    qCDebug(lcMmsHandler) << "MmsHandler: data prohibited changed for" << path << "to" << prohibited;
+    // Active transfers are taken care of by MmsTransferManager
+    if (!prohibited)
+        retryPostponedReadReports();
+}
 
-        m_activeEvents.remove(path);
-    }
+void MmsHandler::onModemsChanged()
+{
+    retryPostponedReadReports();
 }
 
-void MmsHandler::onStatusChanged(const QString &status)
+void MmsHandler::retryPostponedReadReports()
 {
-    QOfonoNetworkRegistration *network = (QOfonoNetworkRegistration*) sender();
+    // The groups are queried again, the events may have been deleted or
+    // handled meanwhile
+    if (!m_postponedReadReportGroups.isEmpty()) {
+        m_readReportGroups += m_postponedReadReportGroups;
+        m_postponedReadReportGroups.clear();
+        scheduleReadReports();
+    }
+}
 
-    qCDebug(lcMmsHandler) << "MmsHandler: status changed for" << network->modemPath() << "to" << status;
-    dataProhibitedChanged(network->modemPath());
+void MmsHandler::onTransfersCancelRequested(const QList<int> &eventIds)
+{
+    // The engine only knows how to cancel one transfer at a time; issue
+    // all the calls in one go to prevent automatic retries
+    foreach (int eventId, eventIds) {
+        m_transferStates.remove(eventId);
+        callEngine("cancel", QVariantList() << eventId);
+    }
 }
 
-void MmsHandler::onRoamingAllowedChanged(bool roaming)
+void MmsHandler::onTransferResumeRequested(int eventId, int direction)
 {
-    QOfonoConnectionManager *connection = (QOfonoConnectionManager*) sender();
+    SingleEventModel model;
+    Event event(getEventById(model, eventId));
+
+    if (!event.isValid() || event.type() != Event::MMSEvent) {
+        qWarning() << "Not resuming MMS transfer for unknown event" << eventId;
+        m_transfers->remove(eventId);
+        return;
+    }
+
+    if (direction == MmsTransferManager::Send) {
+        if (event.status() == Event::SentStatus || m_sendQueue->contains(eventId)
+                || !m_sendQueue->enqueue(eventId, getSendModemPath(event))) {
+            m_transfers->remove(eventId);
+            return;
+        }
+    } else {
+        const QByteArray pushData(QByteArray::fromBase64(event.extraProperty(MMS_PROPERTY_PUSH_DATA).toByteArray()));
+        if (event.status() == Event::ReceivedStatus || pushData.isEmpty()) {
+            m_transfers->remove(eventId);
+            return;
+        }
+
+        TransferState state;
+        state.committed = state.pending = event.status();
+        m_transferStates.insert(eventId, state);
+        callEngine("receiveMessage", QVariantList() << eventId << event.subscriberIdentity() << true << pushData);
+    }
 
-    qCDebug(lcMmsHandler) << "MmsHandler: roaming allowed changed for" << connection->modemPath() << "to" << roaming;
-    dataProhibitedChanged(connection->modemPath());
+    qCDebug(lcMmsHandler) << "MmsHandler: resumed MMS transfer" << eventId;
 }
 
-void MmsHandler::eventMarkedAsRead(CommHistory::Event &event)
+void MmsHandler::scheduleReadReports()
 {
-    const QString imsi = event.subscriberIdentity();
+    if (!m_readReportTimer->isActive())
+        m_readReportTimer->start();
+}
 
-    // Caller already checked canSendReadReports() so mobile data is allowed
-    const bool sendReadReports = m_imsiSettings->value(
-                imsi + kSettingSendReadReports, false).toBool();
+void MmsHandler::onEventsUpdated(const QDBusMessage &message)
+{
+    const QVariantList args(message.arguments());
+    if (args.isEmpty())
+        return;
 
-    if (sendReadReports) {
-        qCDebug(lcMmsHandler) << "MmsHandler: sending read report for" << event.id();
-        QVariantList args;
-        args << event.id() << imsi << event.mmsId() << event.recipients().value(0).remoteUid() << 0;
-        callEngine("sendReadReport", args);
-    } else {
-        qCDebug(lcMmsHandler) << "MmsHandler: not allowed to send read report for" << event.id();
-        event.removeExtraProperty(MMS_PROPERTY_UNREAD);
-        SingleEventModel model;
-        if (!model.modifyEvent(event)) {
-            qWarning() << "Failed to update MMS event" << event.id();
+    // Every event modification in the system ends up here, but only MMS
+    // events are interesting. Look at the type first and fully demarshal
+    // only those.
+    QElapsedTimer timer;
+    timer.start();
+
+    const QDBusArgument arg(args.first().value<QDBusArgument>());
+    int total = 0;
+    int decoded = 0;
+
+    arg.beginArray();
+    while (!arg.atEnd()) {
+        const QDBusArgument element(arg.asVariant().value<QDBusArgument>());
+        int id = 0;
+        int type = Event::UnknownType;
+        total++;
+        if (peekStructureFields(element, &id, &type) && type != Event::MMSEvent)
+            continue;
+
+        Event event;
+        element >> event;
+        decoded++;
+        if (MmsReadReportModel::acceptsEvent(event)) {
+            qCDebug(lcMmsHandler) << "MmsHandler: read report candidate" << event.id();
+            m_readReportCandidates.insert(event.id(), event);
         }
     }
+    arg.endArray();
+
+    qCDebug(lcMmsHandler) << "MmsHandler:" << total << "event(s) updated," << decoded << "decoded in"
+                          << timer.nsecsElapsed() / 1000 << "us";
+
+    if (!m_readReportCandidates.isEmpty())
+        scheduleReadReports();
 }
 
-void MmsHandler::onEventsUpdated(const QList<CommHistory::Event> &events)
+void MmsHandler::onGroupsUpdatedFull(const QDBusMessage &message)
 {
-    const int count = events.count();
-    qCDebug(lcMmsHandler) << "MmsHandler:" << count << "event(s) updated";
+    const QVariantList args(message.arguments());
+    if (args.isEmpty())
+        return;
 
-    for (int i=0; i<count; i++) {
-        Event event(events.at(i));
-        qCDebug(lcMmsHandler) << "MmsHandler:" << i << ":" << event.toString();
-        if (canSendReadReports(getModemPath(event))) {
-            if (MmsReadReportModel::acceptsEvent(event)) {
-                eventMarkedAsRead(event);
-            }
-        } else if (event.type() == Event::MMSEvent)
-            qCDebug(lcMmsHandler) << "MmsHandler: can't send read report for" << event.id();
+    // Only the group ids are needed, the MMS events are queried later
+    const QDBusArgument arg(args.first().value<QDBusArgument>());
+    int total = 0;
+
+    arg.beginArray();
+    while (!arg.atEnd()) {
+        const QDBusArgument element(arg.asVariant().value<QDBusArgument>());
+        int id = -1;
+        if (!peekStructureFields(element, &id)) {
+            Group group;
+            element >> group;
+            id = group.id();
+        }
+        if (id >= 0)
+            m_readReportGroups.insert(id);
+        total++;
     }
+    arg.endArray();
+
+    qCDebug(lcMmsHandler) << "MmsHandler:" << total << "group(s) updated";
+
+    if (!m_readReportGroups.isEmpty())
+        scheduleReadReports();
 }
 
-void MmsHandler::onGroupsUpdatedFull(const QList<CommHistory::Group> &groups)
+void MmsHandler::processReadReports()
 {
-    qCDebug(lcMmsHandler) << "MmsHandler:" << groups.count() << "group(s) updated";
-    for (int i=0; i<groups.count(); i++) {
-        Group group(groups.at(i));
-        qCDebug(lcMmsHandler) << "MmsHandler:" << i << ":" << group.toString();
-        const int gid = group.id();
+    // Candidates are collected over a short period, so that a burst of
+    // updates (e.g. marking all conversations read) is handled in one go
+    if (!m_readReportGroups.isEmpty()) {
+        // MmsReadReportModel can only query one group at a time; at least
+        // query every group only once per batch, with the same model
         MmsReadReportModel model;
-        if (model.getEvents(gid)) {
-            const int count = model.count();
-            qCDebug(lcMmsHandler) << "MmsHandler:" << count << "MMS event(s) found in group" << gid;
-            for (int j=0; j<count; j++) {
-                Event event(model.event(j));
-                if (canSendReadReports(getModemPath(event))) {
-                    eventMarkedAsRead(event);
-                } else {
-                    qCDebug(lcMmsHandler) << "MmsHandler: can't send read report at the moment for" << event.id();
+        foreach (int gid, m_readReportGroups) {
+            bool found;
+            {
+                DatabaseQueryTimer queryTimer;
+                found = model.getEvents(gid);
+            }
+            if (found) {
+                const int count = model.count();
+                qCDebug(lcMmsHandler) << "MmsHandler:" << count << "MMS event(s) found in group" << gid;
+                for (int j=0; j<count; j++) {
+                    const Event event(model.event(j));
+                    m_readReportCandidates.insert(event.id(), event);
                 }
+            } else {
+                qWarning() << "Failed to query MMS events in group" << gid;
             }
+        }
+        m_readReportGroups.clear();
+    }
+
+    QList<Event> updated;
+    int sent = 0;
+    int postponed = 0;
+
+    foreach (Event event, m_readReportCandidates) {
+        const int id = event.id();
+        if (m_readReportsToClear.remove(id)) {
+            // The report is done, the event was just read
+            event.removeExtraProperty(MMS_PROPERTY_UNREAD);
+            updated.append(event);
+            continue;
+        }
+        if (m_readReportsInFlight.contains(id))
+            continue;
+
+        const QString imsi(event.subscriberIdentity());
+        if (!canSendReadReports(getModemPath(imsi))) {
+            // Read reports may become possible later, see retryPostponedReadReports()
+            qCDebug(lcMmsHandler) << "MmsHandler: can't send read report at the moment for" << id;
+            m_postponedReadReportGroups.insert(event.groupId());
+            postponed++;
+            continue;
+        }
+
+        // canSendReadReports() was checked above so mobile data is allowed
+        if (m_imsiSettings->value(imsi + kSettingSendReadReports, false).toBool()) {
+            qCDebug(lcMmsHandler) << "MmsHandler: sending read report for" << id;
+            QVariantList args;
+            args << id << imsi << event.mmsId() << event.recipients().value(0).remoteUid() << 0;
+            QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(callEngine("sendReadReport", args), this);
+            watcher->setProperty(kCallPropertyEventId, id);
+            connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), SLOT(onSendReadReportFinished(QDBusPendingCallWatcher*)));
+            m_readReportsInFlight.insert(id, event.groupId());
+            sent++;
         } else {
-            qWarning() << "Failed to query MMS events in group" << gid;
+            qCDebug(lcMmsHandler) << "MmsHandler: not allowed to send read report for" << id;
+            event.removeExtraProperty(MMS_PROPERTY_UNREAD);
+            updated.append(event);
         }
     }
+    m_readReportCandidates.clear();
+
+    // The rest of the finished reports are no longer candidates; the flag
+    // is gone already, or the event was deleted
+    m_readReportsToClear.clear();
+
+    // Only reports sent before a restart have to be looked up one by one
+    if (!m_unknownReadReportsToClear.isEmpty()) {
+        SingleEventModel single;
+        foreach (int id, m_unknownReadReportsToClear) {
+            Event event(getEventById(single, id));
+            if (!event.isValid()) {
+                qWarning() << "Failed to find sent MMS by id" << id;
+                continue;
+            }
+            event.removeExtraProperty(MMS_PROPERTY_UNREAD);
+            updated.append(event);
+        }
+        m_unknownReadReportsToClear.clear();
+    }
+
+    if (!updated.isEmpty()) {
+        EventModel model;
+        if (!modifyEvents(model, updated))
+            qWarning() << "Failed to update" << updated.count() << "MMS event(s)";
+    }
+
+    qCDebug(lcMmsHandler) << "MmsHandler:" << sent << "read report(s) sent," << updated.count()
+                          << "event(s) updated," << postponed << "postponed";
+}
+
+void MmsHandler::onSendReadReportFinished(QDBusPendingCallWatcher *call)
+{
+    QDBusPendingReply<> reply = *call;
+    if (reply.isError()) {
+        const int id = call->property(kCallPropertyEventId).toInt();
+        qWarning() << "Call to MmsEngine sendReadReport failed:" << reply.error();
+        // Allow it to be retried with the next update
+        m_readReportsInFlight.remove(id);
+    }
+    call->deleteLater();
 }
 
 QString MmsHandler::accountPath(const QString &modemPath)
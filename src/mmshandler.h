@@ -24,9 +24,8 @@
 #define MMSHANDLER_H
 
 #include <QHash>
-#include <QMultiMap>
+#include <QSet>
 #include <CommHistory/event.h>
-#include <qofonomanager.h>
 #include <qofonoextmodemmanager.h>
 #include "messagehandlerbase.h"
 #include "mmspart.h"
@@ -35,9 +34,14 @@ namespace CommHistory {
     class Group;
 }
 
+class QDBusMessage;
 class QDBusPendingCallWatcher;
+class QTimer;
 class MDConfGroup;
-class MmsHandlerModem;
+class ModemRegistry;
+class MmsSendQueue;
+class MmsTransferManager;
+class RoamingWatcher;
 
 class MmsHandler : public MessageHandlerBase
 {
@@ -46,6 +50,11 @@ class MmsHandler : public MessageHandlerBase
 public:
     explicit MmsHandler(QObject *parent);
 
+    // Caller is responsible for cleaning up copied files on failure.
+    // Safe to call from worker threads.
+    static bool copyMmsPartFiles(const MmsPartList &parts, int eventId,
+            QList<CommHistory::MessagePart> &eventParts, QString &freeText);
+
 public Q_SLOTS:
     QString messageNotification(const QString &imsi, const QString &from, const QString &subject,
             uint expiry, const QByteArray &data);
@@ -69,28 +78,36 @@ public Q_SLOTS:
     void sendMessageFromEvent(int eventId);
 
 private Q_SLOTS:
-    void onOfonoAvailableChanged(bool available);
-    void onModemAdded(QString path);
-    void onModemRemoved(QString path);
     void onSendMessageFinished(QDBusPendingCallWatcher *call);
-    void onEventsUpdated(const QList<CommHistory::Event> &events);
-    void onGroupsUpdatedFull(const QList<CommHistory::Group> &groups);
-    void onStatusChanged(const QString &status);
-    void onRoamingAllowedChanged(bool roaming);
+    void onSendPartsCopied(int eventId, bool ok, const QList<CommHistory::MessagePart> &parts,
+            const QString &freeText);
+    void onSendDispatchRequested(int eventId);
+    void onEventsUpdated(const QDBusMessage &message);
+    void onGroupsUpdatedFull(const QDBusMessage &message);
+    void onDataProhibitedChanged(const QString &path, bool prohibited);
+    void onModemsChanged();
+    void onTransfersCancelRequested(const QList<int> &eventIds);
+    void onTransferResumeRequested(int eventId, int direction);
+    void onSendReadReportFinished(QDBusPendingCallWatcher *call);
+    void processReadReports();
+    void flushTransferStates();
 
 private:
-    void addAllModems();
-    void addModem(const QString &path);
     QString getModemPath(const CommHistory::Event &event) const;
     QString getModemPath(const QString &imsi) const;
     QString getDefaultVoiceSim() const;
-    void dataProhibitedChanged(const QString &path);
+    QString getSendModemPath(const CommHistory::Event &event) const;
     static QDBusPendingCall callEngine(const QString &method, const QVariantList &args);
-    void eventMarkedAsRead(CommHistory::Event &event);
+    void scheduleReadReports();
+    void retryPostponedReadReports();
+
+    bool transferStatus(int eventId, CommHistory::Event::EventStatus *status);
+    void setTransferStatus(int eventId, CommHistory::Event::EventStatus status);
+    void finishTransfer(int eventId, CommHistory::Event::EventStatus status,
+            const QString &details = QString());
 
     CommHistory::Event::EventStatus sendMessageFromEvent(CommHistory::Event &event);
-    bool copyMmsPartFiles(const MmsPartList &parts, int eventId, QList<CommHistory::MessagePart> &eventParts, QString &freeText);
-    QString copyMessagePartFile(const QString &sourcePath, int eventId, const QString &contentId);
+    static QString copyMessagePartFile(const QString &sourcePath, int eventId, const QString &contentId);
 
     bool isDataProhibited(const QString &path);
     bool canSendReadReports(const QString &path);
@@ -98,11 +115,34 @@ private:
     QString accountPath(const QString &modemPath);
 
 private:
-    QSharedPointer<QOfonoManager> m_ofonoManager;
+    ModemRegistry *m_modemRegistry;
+    RoamingWatcher *m_roamingWatcher;
     QSharedPointer<QOfonoExtModemManager> m_ofonoExtModemManager;
-    QHash<QString, MmsHandlerModem*> m_modems;
     MDConfGroup *m_imsiSettings;
-    QMultiMap<QString, int> m_activeEvents;
+    MmsTransferManager *m_transfers;
+    MmsSendQueue *m_sendQueue;
+
+    // Last known status of ongoing transfers, intermediate states are
+    // written to the database with a delay
+    struct TransferState {
+        CommHistory::Event::EventStatus committed;
+        CommHistory::Event::EventStatus pending;
+    };
+    QHash<int, TransferState> m_transferStates;
+    QTimer *m_transferStateTimer;
+
+    // Read reports are processed in batches
+    QTimer *m_readReportTimer;
+    QSet<int> m_readReportGroups;
+    // groups with candidates that had to wait for a modem or mobile data
+    QSet<int> m_postponedReadReportGroups;
+    QHash<int, CommHistory::Event> m_readReportCandidates;
+    // event id -> group id
+    QHash<int, int> m_readReportsInFlight;
+    // reports done, the flag is dropped when the group is queried next
+    QSet<int> m_readReportsToClear;
+    // reports sent before a restart, the group isn't known
+    QSet<int> m_unknownReadReportsToClear;
 };
 
 #endif // MMSHANDLER_H
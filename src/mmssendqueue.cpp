@@ -0,0 +1,222 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "mmssendqueue.h"
+#include "mmshandler.h"
+#include "constants.h"
+#include "flightrecorder.h"
+#include "debug.h"
+
+#include <QFile>
+#include <QRunnable>
+
+using namespace CommHistory;
+
+class MmsSendQueue::Job
+{
+public:
+    enum State {
+        Copying,
+        Ready,
+        Active
+    };
+
+    Job(int id, const QString &path, const MmsPartList &source)
+        : eventId(id), modemPath(path), sourceParts(source),
+          state(source.isEmpty() ? Ready : Copying), ok(true), cancelled(false)
+    {
+    }
+
+    int eventId;
+    QString modemPath;
+    MmsPartList sourceParts;
+    State state;
+
+    // Written by the copy task
+    QList<MessagePart> parts;
+    QString freeText;
+    bool ok;
+
+    bool cancelled;
+};
+
+class MmsSendQueue::CopyTask : public QRunnable
+{
+public:
+    CopyTask(MmsSendQueue *queue, Job *job) : m_queue(queue), m_job(job) { }
+
+    void run()
+    {
+        m_job->ok = MmsHandler::copyMmsPartFiles(m_job->sourceParts, m_job->eventId,
+                                                 m_job->parts, m_job->freeText);
+        if (!m_job->ok) {
+            // Clean up copied MMS parts
+            foreach (const MessagePart &part, m_job->parts)
+                QFile::remove(part.path());
+            m_job->parts.clear();
+            m_job->freeText.clear();
+        }
+
+        QMetaObject::invokeMethod(m_queue, "onCopyDone", Qt::QueuedConnection,
+                                  Q_ARG(int, m_job->eventId));
+    }
+
+private:
+    MmsSendQueue *m_queue;
+    Job *m_job;
+};
+
+MmsSendQueue::MmsSendQueue(QObject *parent)
+    : QObject(parent)
+    , m_dispatching(false)
+    , m_dispatchAgain(false)
+{
+    m_copyPool.setMaxThreadCount(1);
+}
+
+MmsSendQueue::~MmsSendQueue()
+{
+    m_copyPool.waitForDone();
+    qDeleteAll(m_jobs);
+}
+
+bool MmsSendQueue::enqueue(int eventId, const QString &modemPath, const MmsPartList &parts)
+{
+    if (m_jobs.contains(eventId)) {
+        qWarning() << "MmsSendQueue: event" << eventId << "is already queued";
+        return false;
+    }
+
+    if (m_jobs.count() >= MMS_SEND_QUEUE_LIMIT) {
+        qWarning() << "MmsSendQueue: queue is full, not accepting" << eventId;
+        return false;
+    }
+
+    Job *job = new Job(eventId, modemPath, parts);
+    m_jobs.insert(eventId, job);
+    FlightRecorder::instance()->record(FlightRecorder::MmsSendQueued, eventId, QString(), m_jobs.count());
+    qCDebug(lcCommhistoryd) << "MmsSendQueue: queued" << eventId << "for" << modemPath
+                            << "with" << parts.count() << "part(s)," << m_jobs.count() << "in queue";
+
+    if (job->state == Job::Copying) {
+        m_copyPool.start(new CopyTask(this, job));
+    } else {
+        m_ready.append(eventId);
+        dispatch();
+    }
+    return true;
+}
+
+bool MmsSendQueue::contains(int eventId) const
+{
+    return m_jobs.contains(eventId);
+}
+
+int MmsSendQueue::count() const
+{
+    return m_jobs.count();
+}
+
+void MmsSendQueue::finished(int eventId)
+{
+    Job *job = m_jobs.value(eventId);
+    if (!job)
+        return;
+
+    if (job->state == Job::Copying) {
+        // The copy task still owns it, drop it when the task is done
+        job->cancelled = true;
+        return;
+    }
+
+    if (job->state == Job::Active) {
+        QHash<QString, int>::iterator it = m_activeCount.find(job->modemPath);
+        if (it != m_activeCount.end() && --it.value() <= 0)
+            m_activeCount.erase(it);
+    } else {
+        m_ready.removeOne(eventId);
+    }
+
+    m_jobs.remove(eventId);
+    delete job;
+
+    dispatch();
+}
+
+void MmsSendQueue::onCopyDone(int eventId)
+{
+    Job *job = m_jobs.value(eventId);
+    if (!job)
+        return;
+
+    if (job->cancelled) {
+        m_jobs.remove(eventId);
+        delete job;
+        return;
+    }
+
+    job->state = Job::Ready;
+    job->sourceParts.clear();
+
+    const bool ok = job->ok;
+    const QList<MessagePart> parts(job->parts);
+    const QString freeText(job->freeText);
+    job->parts.clear();
+    job->freeText.clear();
+
+    // The receiver may drop the job here
+    emit partsCopied(eventId, ok, parts, freeText);
+
+    if (m_jobs.contains(eventId)) {
+        m_ready.append(eventId);
+        dispatch();
+    }
+}
+
+void MmsSendQueue::dispatch()
+{
+    // Receivers of dispatchRequested() can call back into the queue
+    if (m_dispatching) {
+        m_dispatchAgain = true;
+        return;
+    }
+
+    m_dispatching = true;
+    do {
+        m_dispatchAgain = false;
+        for (int i = 0; i < m_ready.count(); i++) {
+            const int eventId = m_ready.at(i);
+            Job *job = m_jobs.value(eventId);
+            int &active(m_activeCount[job->modemPath]);
+            if (active < MMS_SEND_MODEM_CONCURRENCY) {
+                active++;
+                m_ready.removeAt(i);
+                job->state = Job::Active;
+                qCDebug(lcCommhistoryd) << "MmsSendQueue: dispatching" << eventId << "on" << job->modemPath;
+                emit dispatchRequested(eventId);
+                // Start over, the queue may have changed
+                m_dispatchAgain = true;
+                break;
+            }
+        }
+    } while (m_dispatchAgain);
+    m_dispatching = false;
+}
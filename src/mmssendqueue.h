@@ -0,0 +1,96 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef MMSSENDQUEUE_H
+#define MMSSENDQUEUE_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QThreadPool>
+#include <CommHistory/messagepart.h>
+#include "mmspart.h"
+
+/*!
+ * \class MmsSendQueue
+ * \brief Pipeline for outgoing MMS messages.
+ *
+ * Message parts are copied to the message storage on a worker thread,
+ * after which the message waits for a free slot on its modem. Only a
+ * limited number of messages per modem are being handed over to the
+ * MMS engine at any time, and only a limited number of messages can be
+ * queued in total.
+ *
+ * The queue doesn't touch the database; the owner stores the copied
+ * parts when partsCopied() is emitted, does the actual dispatch on
+ * dispatchRequested() and reports back with finished().
+ */
+class MmsSendQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MmsSendQueue(QObject *parent = 0);
+    ~MmsSendQueue();
+
+    /*!
+     * \brief Queues the event for sending, copying \a parts first if there are any.
+     * \return false if the queue is full and the message was not accepted.
+     */
+    bool enqueue(int eventId, const QString &modemPath, const MmsPartList &parts = MmsPartList());
+
+    bool contains(int eventId) const;
+    int count() const;
+
+    /*!
+     * \brief Releases the modem slot taken by the event and forgets about it.
+     */
+    void finished(int eventId);
+
+Q_SIGNALS:
+    /*!
+     * \brief Part files of the event have been copied (or failed to copy, if \a ok is false).
+     *
+     * The receiver may call finished() to drop the event from the queue.
+     */
+    void partsCopied(int eventId, bool ok, const QList<CommHistory::MessagePart> &parts,
+                     const QString &freeText);
+    void dispatchRequested(int eventId);
+
+private Q_SLOTS:
+    void onCopyDone(int eventId);
+
+private:
+    class Job;
+    class CopyTask;
+
+    void dispatch();
+
+private:
+    QThreadPool m_copyPool;
+    QHash<int, Job*> m_jobs;
+    QHash<QString, int> m_activeCount;
+    QList<int> m_ready;
+    bool m_dispatching;
+    bool m_dispatchAgain;
+};
+
+#endif // MMSSENDQUEUE_H
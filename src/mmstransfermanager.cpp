@@ -0,0 +1,224 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "mmstransfermanager.h"
+#include "modemregistry.h"
+#include "roamingwatcher.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <algorithm>
+
+#include <QFile>
+#include <QStringList>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QTimer>
+
+MmsTransferManager::MmsTransferManager(RoamingWatcher *roamingWatcher, QObject *parent)
+    : QObject(parent)
+    , m_modemRegistry(ModemRegistry::instance())
+    , m_roamingWatcher(roamingWatcher)
+    , m_filePath(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/mms-resumable-transfers")
+    , m_resumeScheduled(false)
+{
+    connect(m_roamingWatcher, SIGNAL(dataProhibitedChanged(QString,bool)),
+            SLOT(onDataProhibitedChanged(QString,bool)));
+    connect(m_modemRegistry, SIGNAL(subscriberIdentityChanged(QString,QString)),
+            SLOT(onSubscriberIdentityChanged(QString,QString)));
+
+    load();
+    if (!m_suspended.isEmpty())
+        scheduleResume();
+}
+
+void MmsTransferManager::add(int eventId, const QString &imsi, Direction direction)
+{
+    Transfer transfer;
+    transfer.imsi = imsi;
+    transfer.direction = direction;
+    m_active.insert(eventId, transfer);
+
+    if (m_suspended.remove(eventId))
+        save();
+}
+
+void MmsTransferManager::remove(int eventId)
+{
+    m_active.remove(eventId);
+    m_cancelled.remove(eventId);
+
+    if (m_suspended.remove(eventId))
+        save();
+
+    if (m_resuming.remove(eventId))
+        scheduleResume();
+}
+
+bool MmsTransferManager::takeCancelled(int eventId)
+{
+    return m_cancelled.remove(eventId);
+}
+
+bool MmsTransferManager::isSuspended(int eventId) const
+{
+    return m_suspended.contains(eventId);
+}
+
+int MmsTransferManager::activeCount() const
+{
+    return m_active.count();
+}
+
+int MmsTransferManager::suspendedCount() const
+{
+    return m_suspended.count();
+}
+
+void MmsTransferManager::onDataProhibitedChanged(const QString &modemPath, bool prohibited)
+{
+    if (prohibited) {
+        suspend(modemPath);
+    } else if (!m_suspended.isEmpty()) {
+        scheduleResume();
+    }
+}
+
+void MmsTransferManager::onSubscriberIdentityChanged(const QString &modemPath, const QString &imsi)
+{
+    if (!imsi.isEmpty() && !m_suspended.isEmpty())
+        scheduleResume();
+}
+
+void MmsTransferManager::suspend(const QString &modemPath)
+{
+    QList<int> eventIds;
+    QHash<int, Transfer>::iterator it = m_active.begin();
+    while (it != m_active.end()) {
+        if (m_modemRegistry->modemPath(it->imsi) == modemPath) {
+            eventIds.append(it.key());
+            m_suspended.insert(it.key(), it.value());
+            m_resuming.remove(it.key());
+            m_cancelled.insert(it.key());
+            it = m_active.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (!eventIds.isEmpty()) {
+        qWarning() << "Cancelling" << eventIds.count() << "active MMS transfer(s) due to roaming restrictions";
+        save();
+        emit cancelRequested(eventIds);
+    }
+}
+
+void MmsTransferManager::scheduleResume()
+{
+    if (!m_resumeScheduled) {
+        m_resumeScheduled = true;
+        QTimer::singleShot(0, this, SLOT(resumeNext()));
+    }
+}
+
+void MmsTransferManager::resumeNext()
+{
+    m_resumeScheduled = false;
+
+    // Oldest first, and only a few at a time so that the link isn't
+    // saturated right after data becomes available
+    QList<int> eventIds(m_suspended.keys());
+    std::sort(eventIds.begin(), eventIds.end());
+
+    bool changed = false;
+    foreach (int eventId, eventIds) {
+        if (m_resuming.count() >= MMS_RESUME_CONCURRENCY)
+            break;
+
+        QHash<int, Transfer>::iterator it = m_suspended.find(eventId);
+        if (it == m_suspended.end())
+            continue;
+
+        const QString modemPath(m_modemRegistry->modemPath(it->imsi));
+        if (modemPath.isEmpty() || m_roamingWatcher->isDataProhibited(modemPath))
+            continue;
+
+        const Transfer transfer(it.value());
+        m_suspended.erase(it);
+        m_active.insert(eventId, transfer);
+        m_resuming.insert(eventId);
+        changed = true;
+
+        qCDebug(lcCommhistoryd) << "MmsTransferManager: resuming" << eventId;
+        emit resumeRequested(eventId, transfer.direction);
+    }
+
+    if (changed)
+        save();
+}
+
+void MmsTransferManager::load()
+{
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        const QStringList fields(in.readLine().split(' '));
+        bool ok = false;
+        const int eventId = fields.value(0).toInt(&ok);
+        const int direction = fields.value(1).toInt();
+        if (!ok || fields.count() != 3 || (direction != Receive && direction != Send))
+            continue;
+
+        Transfer transfer;
+        transfer.direction = Direction(direction);
+        transfer.imsi = fields.value(2);
+        m_suspended.insert(eventId, transfer);
+    }
+
+    qCDebug(lcCommhistoryd) << "MmsTransferManager:" << m_suspended.count() << "resumable transfer(s)";
+}
+
+void MmsTransferManager::save()
+{
+    if (m_suspended.isEmpty()) {
+        QFile::remove(m_filePath);
+        return;
+    }
+
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Cannot open resumable MMS transfers file:" << file.errorString();
+        return;
+    }
+
+    QTextStream out(&file);
+    QHash<int, Transfer>::const_iterator it = m_suspended.constBegin();
+    for (; it != m_suspended.constEnd(); ++it)
+        out << it.key() << ' ' << int(it->direction) << ' ' << it->imsi << '\n';
+    out.flush();
+
+    if (!file.commit())
+        qWarning() << "Writing resumable MMS transfers failed:" << file.errorString();
+}
@@ -0,0 +1,104 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef MMSTRANSFERMANAGER_H
+#define MMSTRANSFERMANAGER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QSet>
+
+class ModemRegistry;
+class RoamingWatcher;
+
+/*!
+ * \class MmsTransferManager
+ * \brief Keeps track of MMS transfers the MMS engine is working on.
+ *
+ * When mobile data becomes prohibited on a modem, all its active transfers
+ * are cancelled together and remembered as resumable. The resumable set is
+ * stored on disk, and the transfers are requested to be resumed, a few at
+ * a time, once data is allowed again on the modem of their SIM.
+ */
+class MmsTransferManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Direction {
+        Receive,
+        Send
+    };
+
+    MmsTransferManager(RoamingWatcher *roamingWatcher, QObject *parent = 0);
+
+    void add(int eventId, const QString &imsi, Direction direction);
+
+    /*!
+     * \brief The transfer has finished one way or another; forget about it.
+     */
+    void remove(int eventId);
+
+    /*!
+     * \brief Returns true, once, if the transfer was cancelled due to roaming
+     * and its final state hasn't been reported yet.
+     * That state belongs to the cancelled call even if the transfer has been
+     * resumed since.
+     */
+    bool takeCancelled(int eventId);
+
+    bool isSuspended(int eventId) const;
+    int activeCount() const;
+    int suspendedCount() const;
+
+Q_SIGNALS:
+    void cancelRequested(const QList<int> &eventIds);
+    void resumeRequested(int eventId, int direction);
+
+private Q_SLOTS:
+    void onDataProhibitedChanged(const QString &modemPath, bool prohibited);
+    void onSubscriberIdentityChanged(const QString &modemPath, const QString &imsi);
+    void resumeNext();
+
+private:
+    struct Transfer {
+        QString imsi;
+        Direction direction;
+    };
+
+    void suspend(const QString &modemPath);
+    void scheduleResume();
+    void load();
+    void save();
+
+private:
+    ModemRegistry *m_modemRegistry;
+    RoamingWatcher *m_roamingWatcher;
+    QString m_filePath;
+    QHash<int, Transfer> m_active;
+    QHash<int, Transfer> m_suspended;
+    QSet<int> m_resuming;
+    QSet<int> m_cancelled;
+    bool m_resumeScheduled;
+};
+
+#endif // MMSTRANSFERMANAGER_H
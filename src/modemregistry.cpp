@@ -0,0 +1,193 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "modemregistry.h"
+#include "startupprofiler.h"
+#include "debug.h"
+
+#include <QCoreApplication>
+
+#include <qofonomanager.h>
+#include <qofonosimmanager.h>
+#include <qofononetworkregistration.h>
+#include <qofonoconnectionmanager.h>
+#include <qofonomessagewaiting.h>
+#include <qofonosmartmessaging.h>
+
+ModemRegistry::Modem::Modem(const QString &modemPath, QObject *parent)
+    : path(modemPath)
+    , sim(new QOfonoSimManager(parent))
+    , network(new QOfonoNetworkRegistration(parent))
+    , connection(new QOfonoConnectionManager(parent))
+    , messageWaiting(new QOfonoMessageWaiting(parent))
+    , smartMessaging(new QOfonoSmartMessaging(parent))
+{
+    sim->setModemPath(path);
+    network->setModemPath(path);
+    connection->setModemPath(path);
+    messageWaiting->setModemPath(path);
+    smartMessaging->setModemPath(path);
+}
+
+ModemRegistry::Modem::~Modem()
+{
+    delete sim;
+    delete network;
+    delete connection;
+    delete messageWaiting;
+    delete smartMessaging;
+}
+
+ModemRegistry *ModemRegistry::instance()
+{
+    static ModemRegistry *obj = 0;
+    if (!obj)
+        obj = new ModemRegistry(qApp);
+    return obj;
+}
+
+ModemRegistry::ModemRegistry(QObject *parent)
+    : QObject(parent)
+    , m_ofonoManager(QOfonoManager::instance())
+{
+    QOfonoManager *ofono = m_ofonoManager.data();
+    connect(ofono, SIGNAL(modemAdded(QString)), SLOT(onModemAdded(QString)));
+    connect(ofono, SIGNAL(modemRemoved(QString)), SLOT(onModemRemoved(QString)));
+    connect(ofono, SIGNAL(modemsChanged(QStringList)), SLOT(onModemsChanged(QStringList)));
+    connect(ofono, SIGNAL(availableChanged(bool)), SLOT(onOfonoAvailableChanged(bool)));
+
+    if (ofono->available())
+        onModemsChanged(ofono->modems());
+}
+
+ModemRegistry::~ModemRegistry()
+{
+    qDeleteAll(m_modems);
+}
+
+QStringList ModemRegistry::modemPaths() const
+{
+    return m_modems.keys();
+}
+
+ModemRegistry::Modem *ModemRegistry::modem(const QString &path) const
+{
+    return m_modems.value(path);
+}
+
+QString ModemRegistry::modemPath(const QString &imsi) const
+{
+    return imsi.isEmpty() ? QString() : m_modemByImsi.value(imsi);
+}
+
+QString ModemRegistry::subscriberIdentity(const QString &modemPath) const
+{
+    return m_imsiByModem.value(modemPath);
+}
+
+void ModemRegistry::onOfonoAvailableChanged(bool available)
+{
+    qCDebug(lcCommhistoryd) << "ModemRegistry: ofono available changed to" << available;
+    onModemsChanged(available ? m_ofonoManager->modems() : QStringList());
+}
+
+void ModemRegistry::onModemAdded(const QString &path)
+{
+    qCDebug(lcCommhistoryd) << "ModemRegistry: modem added" << path;
+    addModem(path);
+}
+
+void ModemRegistry::onModemRemoved(const QString &path)
+{
+    qCDebug(lcCommhistoryd) << "ModemRegistry: modem removed" << path;
+    removeModem(path);
+}
+
+void ModemRegistry::onModemsChanged(const QStringList &modems)
+{
+    foreach (const QString &path, m_modems.keys()) {
+        if (!modems.contains(path))
+            removeModem(path);
+    }
+    foreach (const QString &path, modems)
+        addModem(path);
+}
+
+void ModemRegistry::addModem(const QString &path)
+{
+    if (path.isEmpty() || m_modems.contains(path))
+        return;
+
+    Modem *modem = new Modem(path, this);
+    m_modems.insert(path, modem);
+
+    connect(modem->sim, SIGNAL(validChanged(bool)), SLOT(onSimChanged()));
+    connect(modem->sim, SIGNAL(subscriberIdentityChanged(QString)), SLOT(onSimChanged()));
+    updateSubscriberIdentity(modem);
+    STARTUP_PROFILE_READY("modemRegistered");
+
+    emit modemAdded(path);
+}
+
+void ModemRegistry::removeModem(const QString &path)
+{
+    Modem *modem = m_modems.value(path);
+    if (!modem)
+        return;
+
+    // Let the consumers drop their references before the proxies go away
+    emit modemRemoved(path);
+
+    m_modems.remove(path);
+    const QString imsi(m_imsiByModem.take(path));
+    if (!imsi.isEmpty() && m_modemByImsi.value(imsi) == path)
+        m_modemByImsi.remove(imsi);
+    delete modem;
+}
+
+void ModemRegistry::onSimChanged()
+{
+    QOfonoSimManager *sim = qobject_cast<QOfonoSimManager*>(sender());
+    Modem *modem = sim ? m_modems.value(sim->modemPath()) : 0;
+    if (modem && modem->sim == sim)
+        updateSubscriberIdentity(modem);
+}
+
+void ModemRegistry::updateSubscriberIdentity(Modem *modem)
+{
+    const QString imsi(modem->sim->isValid() ? modem->sim->subscriberIdentity() : QString());
+    const QString oldImsi(m_imsiByModem.value(modem->path));
+    if (imsi == oldImsi)
+        return;
+
+    if (!oldImsi.isEmpty() && m_modemByImsi.value(oldImsi) == modem->path)
+        m_modemByImsi.remove(oldImsi);
+
+    if (imsi.isEmpty()) {
+        m_imsiByModem.remove(modem->path);
+    } else {
+        m_imsiByModem.insert(modem->path, imsi);
+        m_modemByImsi.insert(imsi, modem->path);
+    }
+
+    qCDebug(lcCommhistoryd) << "ModemRegistry: subscriber identity of" << modem->path << "is" << imsi;
+    emit subscriberIdentityChanged(modem->path, imsi);
+}
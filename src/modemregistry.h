@@ -0,0 +1,106 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef MODEMREGISTRY_H
+#define MODEMREGISTRY_H
+
+#include <QObject>
+#include <QHash>
+#include <QSharedPointer>
+#include <QStringList>
+
+class QOfonoManager;
+class QOfonoSimManager;
+class QOfonoNetworkRegistration;
+class QOfonoConnectionManager;
+class QOfonoMessageWaiting;
+class QOfonoSmartMessaging;
+
+/*!
+ * \class ModemRegistry
+ * \brief Shared per-modem oFono proxies and IMSI -> modem path index.
+ *
+ * One set of proxies is created for every modem and shared by all
+ * components of the daemon. Consumers must drop any references to the
+ * proxies of a modem when modemRemoved() is emitted for it.
+ */
+class ModemRegistry : public QObject
+{
+    Q_OBJECT
+
+public:
+    class Modem
+    {
+    public:
+        Modem(const QString &path, QObject *parent);
+        ~Modem();
+
+        QString path;
+        QOfonoSimManager *sim;
+        QOfonoNetworkRegistration *network;
+        QOfonoConnectionManager *connection;
+        QOfonoMessageWaiting *messageWaiting;
+        QOfonoSmartMessaging *smartMessaging;
+    };
+
+    static ModemRegistry *instance();
+    ~ModemRegistry();
+
+    QStringList modemPaths() const;
+    Modem *modem(const QString &path) const;
+
+    /*!
+     * \brief Path of the modem with the given IMSI, empty if the SIM is not present.
+     */
+    QString modemPath(const QString &imsi) const;
+
+    /*!
+     * \brief IMSI of the SIM in the given modem, empty if not known.
+     */
+    QString subscriberIdentity(const QString &modemPath) const;
+
+Q_SIGNALS:
+    void modemAdded(const QString &path);
+    void modemRemoved(const QString &path);
+    void subscriberIdentityChanged(const QString &path, const QString &imsi);
+
+private Q_SLOTS:
+    void onOfonoAvailableChanged(bool available);
+    void onModemAdded(const QString &path);
+    void onModemRemoved(const QString &path);
+    void onModemsChanged(const QStringList &modems);
+    void onSimChanged();
+
+private:
+    ModemRegistry(QObject *parent = 0);
+
+    void addModem(const QString &path);
+    void removeModem(const QString &path);
+    void updateSubscriberIdentity(Modem *modem);
+
+private:
+    QSharedPointer<QOfonoManager> m_ofonoManager;
+    QHash<QString, Modem*> m_modems;
+    QHash<QString, QString> m_modemByImsi;
+    QHash<QString, QString> m_imsiByModem;
+};
+
+#endif // MODEMREGISTRY_H
@@ -29,7 +29,6 @@
 
 // CommHistory includes
 #include <CommHistory/commonutils.h>
-#include <CommHistory/GroupModel>
 #include <CommHistory/Group>
 
 // Telepathy includes
@@ -45,8 +44,13 @@
 #include <mce/dbus-names.h>
 
 // Our includes
-#include "qofonomanager.h"
+#include "modemregistry.h"
 #include "notificationmanager.h"
+#include "groupcache.h"
+#include "ingestionmetrics.h"
+#include "daemonstats.h"
+#include "flightrecorder.h"
+#include "startupprofiler.h"
 #include "locstrings.h"
 #include "constants.h"
 #include "debug.h"
@@ -60,21 +64,41 @@ static const QString NgfdEventSms("sms");
 static const QString NgfdEventChat("chat");
 static const QString voicemailWaitingCategory = "x-nemo.messaging.voicemail-waiting";
 
+static CommHistoryService::Conversation notificationConversation(const PersonalNotification *notification)
+{
+    const int chatType = notification->chatType();
+    return CommHistoryService::Conversation(chatType == CommHistory::Group::ChatTypeP2P
+                                                ? notification->recipient()
+                                                : Recipient(notification->account(), notification->targetId()),
+                                            chatType);
+}
+
+static bool isConversationNotification(const PersonalNotification *notification,
+                                       const Recipient &recipient,
+                                       int chatType)
+{
+    const CommHistoryService::Conversation conversation(notificationConversation(notification));
+    return notification->collection() == PersonalNotification::Messaging
+            && conversation.second == chatType
+            && recipient.matches(conversation.first);
+}
+
 // constructor
 //
 NotificationManager::NotificationManager(QObject* parent)
         : QObject(parent)
         , m_Initialised(false)
         , m_contactResolver(0)
-        , m_GroupModel(0)
         , m_ngfClient(0)
         , m_ngfEvent(0)
+        , m_backlogReplay(false)
+        , m_backlogMessages(0)
+        , m_backlogSummary(0)
 {
 }
 
 NotificationManager::~NotificationManager()
 {
-    qDeleteAll(interfaces.values());
     qDeleteAll(m_notifications);
     qDeleteAll(m_unresolvedNotifications);
 }
@@ -82,11 +106,11 @@ NotificationManager::~NotificationManager()
 void NotificationManager::addModem(QString path)
 {
     qCDebug(lcCommhistoryd) << "NotificationManager::addModem" << path;
-    QOfonoMessageWaiting *mw = new QOfonoMessageWaiting(this);
-    interfaces.insert(path, mw);
-
-    mw->setModemPath(path);
+    ModemRegistry::Modem *modem = ModemRegistry::instance()->modem(path);
+    if (!modem)
+        return;
 
+    QOfonoMessageWaiting *mw = modem->messageWaiting;
     connect(mw, SIGNAL(voicemailWaitingChanged(bool)), SLOT(slotVoicemailWaitingChanged()));
     connect(mw, SIGNAL(voicemailMessageCountChanged(int)), SLOT(slotVoicemailWaitingChanged()));
     connect(mw, SIGNAL(validChanged(bool)), this, SLOT(slotValidChanged(bool)));
@@ -107,6 +131,12 @@ void NotificationManager::init()
     connect(m_contactResolver, SIGNAL(finished()),
             SLOT(slotContactResolveFinished()));
 
+    DaemonStats *stats = DaemonStats::instance();
+    stats->addGauge(this, QStringLiteral("notifications"),
+                    [this] { return qint64(m_notifications.size()); });
+    stats->addGauge(this, QStringLiteral("unresolvedContacts"),
+                    [this] { return qint64(m_unresolvedNotifications.size()); });
+
     m_contactListener = ContactListener::instance();
     connect(m_contactListener.data(), SIGNAL(contactChanged(RecipientList)),
             SLOT(slotContactChanged(RecipientList)));
@@ -117,14 +147,9 @@ void NotificationManager::init()
     connect(m_ngfClient, SIGNAL(eventFailed(quint32)), SLOT(slotNgfEventFinished(quint32)));
     connect(m_ngfClient, SIGNAL(eventCompleted(quint32)), SLOT(slotNgfEventFinished(quint32)));
 
-    ofonoManager = QOfonoManager::instance();
-    QOfonoManager* ofono = ofonoManager.data();
-    connect(ofono, SIGNAL(modemsChanged(QStringList)), this, SLOT(slotModemsChanged(QStringList)));
-    connect(ofono, SIGNAL(modemAdded(QString)), this, SLOT(slotModemAdded(QString)));
-    connect(ofono, SIGNAL(modemRemoved(QString)), this, SLOT(slotModemRemoved(QString)));
-    QStringList modems = ofono->modems();
-    qCDebug(lcCommhistoryd) << "Created modem manager";
-    foreach (QString path, modems) {
+    ModemRegistry *modems = ModemRegistry::instance();
+    connect(modems, SIGNAL(modemAdded(QString)), this, SLOT(slotModemAdded(QString)));
+    foreach (QString path, modems->modemPaths()) {
         addModem(path);
     }
 
@@ -137,7 +162,10 @@ void NotificationManager::init()
     connect(service, SIGNAL(observedConversationsChanged(QList<CommHistoryService::Conversation>)),
                      SLOT(slotObservedConversationsChanged(QList<CommHistoryService::Conversation>)));
 
-    groupModel();
+    // Conversations are loaded on demand
+    GroupCache *groups = GroupCache::instance();
+    connect(groups, SIGNAL(groupsDeleted(QList<int>)), SLOT(slotGroupsDeleted(QList<int>)));
+    connect(groups, SIGNAL(groupUpdated(CommHistory::Group)), SLOT(slotGroupUpdated(CommHistory::Group)));
 
     m_Initialised = true;
 }
@@ -171,6 +199,8 @@ void NotificationManager::syncNotifications()
 
     foreach (PersonalNotification *pn, pnList)
         resolveNotification(pn);
+
+    STARTUP_PROFILE_READY("notificationsSynced");
 }
 
 NotificationManager* NotificationManager::instance()
@@ -243,6 +273,9 @@ void NotificationManager::showNotification(const CommHistory::Event& event,
                                            const QString &details)
 {
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO << event.id() << channelTargetId << chatType;
+    IngestionSpan span(IngestionMetrics::Notify);
+    FlightRecorder::instance()->record(FlightRecorder::NotificationShown, event.id(),
+                                       event.messageToken(), event.type());
 
     if (event.type() == CommHistory::Event::SMSEvent
         || event.type() == CommHistory::Event::MMSEvent
@@ -278,18 +311,14 @@ void NotificationManager::showNotification(const CommHistory::Event& event,
 
     // Get MUC topic from group
     QString chatName;
-    if (m_GroupModel && (chatType == CommHistory::Group::ChatTypeUnnamed ||
-        chatType == CommHistory::Group::ChatTypeRoom)) {
-        for (int i = 0; i < m_GroupModel->rowCount(); i++) {
-            QModelIndex row = m_GroupModel->index(i, 0);
-            CommHistory::Group group = m_GroupModel->group(row);
-            if (group.isValid() && group.id() == event.groupId()) {
-                chatName = group.chatName();
-                if (chatName.isEmpty())
-                    chatName = txt_qtn_msg_group_chat;
-                qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Using chatName:" << chatName;
-                break;
-            }
+    if (chatType == CommHistory::Group::ChatTypeUnnamed ||
+        chatType == CommHistory::Group::ChatTypeRoom) {
+        CommHistory::Group group = GroupCache::instance()->group(event.groupId());
+        if (group.isValid()) {
+            chatName = group.chatName();
+            if (chatName.isEmpty())
+                chatName = txt_qtn_msg_group_chat;
+            qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Using chatName:" << chatName;
         }
     }
 
@@ -324,9 +353,52 @@ void NotificationManager::showNotification(const CommHistory::Event& event,
 
     notification->setEventToken(event.messageToken());
 
+    if (notification->collection() == PersonalNotification::Messaging && event.groupId() >= 0)
+        m_notifiedGroups.insert(event.groupId(), notificationConversation(notification));
+
+    if (m_backlogReplay) {
+        notification->setQuiet();
+        m_backlogMessages++;
+    }
+
     resolveNotification(notification);
 }
 
+void NotificationManager::showBacklogNotification(const CommHistory::Event& event,
+                                                  const QString &channelTargetId,
+                                                  CommHistory::Group::ChatType chatType)
+{
+    m_backlogReplay = true;
+    showNotification(event, channelTargetId, chatType);
+    m_backlogReplay = false;
+}
+
+void NotificationManager::publishBacklogSummary()
+{
+    if (!m_backlogMessages)
+        return;
+
+    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << m_backlogMessages << "messages";
+
+    if (!m_backlogSummary) {
+        m_backlogSummary = new Notification(this);
+        m_backlogSummary->setAppName(txt_qtn_msg_notifications_group);
+        m_backlogSummary->setCategory(QStringLiteral("x-nemo.messaging.sms"));
+        // The messages have notifications of their own, this is only a popup
+        m_backlogSummary->setHintValue("transient", true);
+        m_backlogSummary->setRemoteActions(QVariantList()
+                << Notification::remoteAction("default", QString(), MESSAGING_SERVICE_NAME, OBJECT_PATH,
+                                              MESSAGING_INTERFACE, SHOW_INBOX_METHOD));
+    }
+
+    m_backlogSummary->setPreviewSummary(txt_qtn_msg_notification_new_message(m_backlogMessages));
+    m_backlogSummary->setSummary(m_backlogSummary->previewSummary());
+    m_backlogSummary->setItemCount(m_backlogMessages);
+    m_backlogSummary->publish();
+
+    m_backlogMessages = 0;
+}
+
 void NotificationManager::resolveNotification(PersonalNotification *pn)
 {
     if (pn->remoteUid() == QLatin1String("<hidden>") ||
@@ -434,11 +506,7 @@ void NotificationManager::removeConversationNotifications(const CommHistory::Rec
                                                           CommHistory::Group::ChatType chatType)
 {
     auto eraseFrom = std::find_if(m_notifications.begin(), m_notifications.end(), [&](PersonalNotification *notification) {
-            return notification->collection() == PersonalNotification::Messaging
-                    && notification->chatType() == chatType
-                    && (chatType == CommHistory::Group::ChatTypeP2P
-                        ? recipient.matches(notification->recipient())
-                        : recipient.matches(Recipient(notification->account(), notification->targetId())));
+            return isConversationNotification(notification, recipient, chatType);
     });
 
     deleteNotifications(&m_notifications, eraseFrom);
@@ -771,73 +839,112 @@ void NotificationManager::slotClassZeroError(const QDBusError &error)
     qWarning() << "Class 0 SMS notification failed:" << error.message();
 }
 
-CommHistory::GroupModel* NotificationManager::groupModel()
-{
-    if (!m_GroupModel) {
-        m_GroupModel = new CommHistory::GroupModel(this);
-        m_GroupModel->setResolveContacts(GroupManager::DoNotResolve);
-        connect(m_GroupModel,
-                SIGNAL(rowsAboutToBeRemoved(const QModelIndex&, int, int)),
-                this,
-                SLOT(slotGroupRemoved(const QModelIndex&, int, int)));
-        connect(m_GroupModel,
-                SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&)),
-                this,
-                SLOT(slotGroupDataChanged(const QModelIndex&, const QModelIndex&)));
-        if (!m_GroupModel->getGroups()) {
-            qCritical() << "Failed to request group ";
-            delete m_GroupModel;
-            m_GroupModel = 0;
+void NotificationManager::slotGroupsDeleted(const QList<int> &groupIds)
+{
+    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << groupIds;
+
+    resolveNotifiedGroups();
+
+    QList<CommHistoryService::Conversation> removed;
+    foreach (int groupId, groupIds) {
+        QHash<int, CommHistoryService::Conversation>::iterator it = m_notifiedGroups.find(groupId);
+        if (it != m_notifiedGroups.end()) {
+            removed.append(*it);
+            m_notifiedGroups.erase(it);
         }
     }
 
-    return m_GroupModel;
+    foreach (const CommHistoryService::Conversation &conversation, removed)
+        removeConversationNotifications(conversation.first, static_cast<Group::ChatType>(conversation.second));
+
+    // Forget the groups whose notifications were closed meanwhile
+    QHash<int, CommHistoryService::Conversation>::iterator it = m_notifiedGroups.begin();
+    while (it != m_notifiedGroups.end()) {
+        const CommHistoryService::Conversation &conversation = *it;
+        bool notified = false;
+        foreach (PersonalNotification *pn, m_notifications) {
+            if (isConversationNotification(pn, conversation.first, conversation.second)) {
+                notified = true;
+                break;
+            }
+        }
+        if (notified)
+            ++it;
+        else
+            it = m_notifiedGroups.erase(it);
+    }
 }
 
-void NotificationManager::slotGroupRemoved(const QModelIndex &index, int start, int end)
+void NotificationManager::resolveNotifiedGroups()
 {
-    qCDebug(lcCommhistoryd) << Q_FUNC_INFO;
-    for (int i = start; i <= end; i++) {
-        QModelIndex row = m_GroupModel->index(i, 0, index);
-        Group group = m_GroupModel->group(row);
-        if (group.isValid() && !group.recipients().isEmpty()) {
-            removeConversationNotifications(group.recipients().value(0), group.chatType());
+    // Notifications restored at startup don't know their group. Look each
+    // conversation up once, by its only member, so a group chat with the
+    // same member isn't mistaken for it; a conversation without a group
+    // was deleted before we could see it.
+    QList<CommHistoryService::Conversation> removed;
+    foreach (PersonalNotification *pn, m_notifications) {
+        if (pn->collection() != PersonalNotification::Messaging)
+            continue;
+
+        const CommHistoryService::Conversation conversation(notificationConversation(pn));
+        bool known = false;
+        foreach (const CommHistoryService::Conversation &notified, m_notifiedGroups) {
+            if (notified.second == conversation.second && notified.first.matches(conversation.first)) {
+                known = true;
+                break;
+            }
+        }
+        if (known)
+            continue;
+
+        int groupId = -1;
+        const Recipient &recipient = conversation.first;
+        foreach (const Group &group, GroupCache::instance()->findGroups(recipient.localUid(), recipient.remoteUid())) {
+            if (group.chatType() == conversation.second
+                    && group.recipients().count() == 1
+                    && group.recipients().containsMatch(recipient)) {
+                groupId = group.id();
+                break;
+            }
         }
+
+        if (groupId >= 0)
+            m_notifiedGroups.insert(groupId, conversation);
+        else
+            removed.append(conversation);
     }
+
+    foreach (const CommHistoryService::Conversation &conversation, removed)
+        removeConversationNotifications(conversation.first, static_cast<Group::ChatType>(conversation.second));
 }
+
 void NotificationManager::showVoicemailNotification(int count)
 {
     Q_UNUSED(count)
     qWarning() << Q_FUNC_INFO << "Stub";
 }
 
-void NotificationManager::slotGroupDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+void NotificationManager::slotGroupUpdated(const CommHistory::Group &group)
 {
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO;
 
     // Update MUC notifications if MUC topic has changed
-    for (int i = topLeft.row(); i <= bottomRight.row(); i++) {
-        QModelIndex row = m_GroupModel->index(i, 0);
-        CommHistory::Group group = m_GroupModel->group(row);
-        if (group.isValid()) {
-            const Recipient &groupRecipient(group.recipients().value(0));
-
-            foreach (PersonalNotification *pn, m_notifications) {
-                // If notification is for MUC and matches to changed group...
-                if (pn->account() == groupRecipient.localUid() && !pn->chatName().isEmpty()) {
-                    const Recipient notificationRecipient(pn->account(), pn->targetId());
-                    if (notificationRecipient.matches(groupRecipient)) {
-                        QString newChatName;
-                        if (group.chatName().isEmpty() && pn->chatName() != txt_qtn_msg_group_chat)
-                            newChatName = txt_qtn_msg_group_chat;
-                        else if (group.chatName() != pn->chatName())
-                            newChatName = group.chatName();
-
-                        if (!newChatName.isEmpty()) {
-                            qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Changing chat name to" << newChatName;
-                            pn->setChatName(newChatName);
-                        }
-                    }
+    const Recipient &groupRecipient(group.recipients().value(0));
+
+    foreach (PersonalNotification *pn, m_notifications) {
+        // If notification is for MUC and matches to changed group...
+        if (pn->account() == groupRecipient.localUid() && !pn->chatName().isEmpty()) {
+            const Recipient notificationRecipient(pn->account(), pn->targetId());
+            if (notificationRecipient.matches(groupRecipient)) {
+                QString newChatName;
+                if (group.chatName().isEmpty() && pn->chatName() != txt_qtn_msg_group_chat)
+                    newChatName = txt_qtn_msg_group_chat;
+                else if (group.chatName() != pn->chatName())
+                    newChatName = group.chatName();
+
+                if (!newChatName.isEmpty()) {
+                    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Changing chat name to" << newChatName;
+                    pn->setChatName(newChatName);
                 }
             }
         }
@@ -927,28 +1034,12 @@ void NotificationManager::slotVoicemailWaitingChanged()
     }
 }
 
-void NotificationManager::slotModemsChanged(QStringList modems)
-{
-    qCDebug(lcCommhistoryd) << "NotificationManager::slotModemsChanged";
-    qDeleteAll(interfaces.values());
-    interfaces.clear();
-    foreach (QString path, modems)
-        addModem(path);
-}
-
 void NotificationManager::slotModemAdded(QString path)
 {
     qCDebug(lcCommhistoryd) << "NotificationManager::slotModemAdded: " << path;
-    delete interfaces.take(path);
     addModem(path);
 }
 
-void NotificationManager::slotModemRemoved(QString path)
-{
-    qCDebug(lcCommhistoryd) << "NotificationManager::slotModemRemoved: " << path;
-    delete interfaces.take(path);
-}
-
 void NotificationManager::slotValidChanged(bool valid)
 {
     qCDebug(lcCommhistoryd) << "NotificationManager::slotValidChanged to: " << valid;
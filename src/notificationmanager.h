@@ -34,12 +34,10 @@
 #include <QMultiHash>
 #include <QModelIndex>
 
-#include <qofonomanager.h>
 #include <qofonomessagewaiting.h>
 
 #include <CommHistory/Event>
 #include <CommHistory/Group>
-#include <CommHistory/GroupModel>
 #include <CommHistory/ContactListener>
 #include <CommHistory/ContactResolver>
 #include <CommHistory/Recipient>
@@ -83,15 +81,27 @@ public:
                           const QString &details = QString());
 
     /*!
-     * \brief removes notifications whose event type is in the supplied list of types
+     * \brief shows notification for a message replayed from a backlog
+     * \param event to be shown
+     *
+     * The notification is listed like any other, but without popup.
+     * The messages are announced by a single summary when the backlog is
+     * done, see publishBacklogSummary().
      */
-    void removeNotificationTypes(const QList<int> &types);
+    void showBacklogNotification(const CommHistory::Event& event,
+                                 const QString &channelTargetId = QString(),
+                                 CommHistory::Group::ChatType chatType = CommHistory::Group::ChatTypeP2P);
+
+    /*!
+     * \brief Publishes a summary of the messages shown since the last
+     * summary with showBacklogNotification(), if any
+     */
+    void publishBacklogSummary();
 
     /*!
-     * \brief return group model with all conversations
-     * \returns group model pointer
+     * \brief removes notifications whose event type is in the supplied list of types
      */
-    CommHistory::GroupModel* groupModel();
+    void removeNotificationTypes(const QList<int> &types);
 
     /*!
      * \brief Show voicemail notification or removes it if count is 0
@@ -123,8 +133,8 @@ private Q_SLOTS:
     void slotObservedConversationsChanged(const QList<CommHistoryService::Conversation> &conversations);
     void slotInboxObservedChanged();
     void slotCallHistoryObservedChanged(bool observed);
-    void slotGroupRemoved(const QModelIndex &index, int start, int end);
-    void slotGroupDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void slotGroupsDeleted(const QList<int> &groupIds);
+    void slotGroupUpdated(const CommHistory::Group &group);
     void slotNgfEventFinished(quint32 id);
     void slotContactResolveFinished();
     void slotContactChanged(const RecipientList &recipients);
@@ -132,8 +142,6 @@ private Q_SLOTS:
     void slotClassZeroError(const QDBusError &error);
     void slotVoicemailWaitingChanged();
     void slotModemAdded(QString path);
-    void slotModemRemoved(QString path);
-    void slotModemsChanged(QStringList modems);
     void slotValidChanged(bool valid);
 
 private:
@@ -148,6 +156,7 @@ private:
 
     void removeConversationNotifications(const CommHistory::Recipient &recipient,
                                          CommHistory::Group::ChatType chatType);
+    void resolveNotifiedGroups();
 
     void syncNotifications();
     int pendingEventCount();
@@ -165,16 +174,19 @@ private:
 
     QList<PersonalNotification*> m_notifications;
     QList<PersonalNotification*> m_unresolvedNotifications;
+    // conversations of the groups with notifications, by group id
+    QHash<int, CommHistoryService::Conversation> m_notifiedGroups;
 
     CommHistory::ContactResolver *m_contactResolver;
     QSharedPointer<CommHistory::ContactListener> m_contactListener;
-    CommHistory::GroupModel *m_GroupModel;
 
     Ngf::Client *m_ngfClient;
     quint32 m_ngfEvent;
 
-    QSharedPointer<QOfonoManager> ofonoManager;
-    QHash<QString,QOfonoMessageWaiting*> interfaces;
+    // set while showing a notification from a backlog
+    bool m_backlogReplay;
+    int m_backlogMessages;
+    Notification *m_backlogSummary;
 
 #ifdef UNIT_TEST
     friend class Ut_NotificationManager;
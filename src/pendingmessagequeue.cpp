@@ -0,0 +1,92 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "pendingmessagequeue.h"
+#include "messageheader.h"
+
+using namespace RTComLogger;
+
+PendingMessageQueue::PendingMessageQueue()
+{
+}
+
+bool PendingMessageQueue::append(const Tp::ReceivedMessage &message, Lane lane)
+{
+    const uint id = pendingId(message);
+    if (m_index.contains(id))
+        return false;
+
+    Entry entry;
+    entry.lane = lane;
+    entry.message = m_lanes[lane].insert(m_lanes[lane].end(), message);
+    m_index.insert(id, entry);
+    return true;
+}
+
+bool PendingMessageQueue::append(const Tp::ReceivedMessage &message)
+{
+    return append(message, lane(message, MessageHeader(message)));
+}
+
+bool PendingMessageQueue::contains(uint pendingId) const
+{
+    return m_index.contains(pendingId);
+}
+
+bool PendingMessageQueue::remove(uint pendingId)
+{
+    QHash<uint, Entry>::iterator it = m_index.find(pendingId);
+    if (it == m_index.end())
+        return false;
+
+    m_lanes[it->lane].erase(it->message);
+    m_index.erase(it);
+    return true;
+}
+
+bool PendingMessageQueue::remove(const Tp::ReceivedMessage &message)
+{
+    return remove(pendingId(message));
+}
+
+void PendingMessageQueue::clear()
+{
+    m_index.clear();
+    for (int i = 0; i < LaneCount; i++)
+        m_lanes[i].clear();
+}
+
+uint PendingMessageQueue::pendingId(const Tp::ReceivedMessage &message)
+{
+    return MessageHeader::pendingId(message.header());
+}
+
+PendingMessageQueue::Lane PendingMessageQueue::lane(const Tp::ReceivedMessage &message,
+                                                    const MessageHeader &header)
+{
+    if (header.voicemail)
+        return Urgent;
+    if (message.messageType() == Tp::ChannelTextMessageTypeDeliveryReport)
+        return Delivery;
+    if (message.isScrollback())
+        return Scrollback;
+    return Inbound;
+}
@@ -0,0 +1,103 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef PENDINGMESSAGEQUEUE_H
+#define PENDINGMESSAGEQUEUE_H
+
+#include <QHash>
+
+#include <TelepathyQt/Message>
+
+#include <list>
+
+namespace RTComLogger
+{
+
+class MessageHeader;
+
+/*!
+ * \class PendingMessageQueue
+ * \brief Received messages waiting to be logged, in priority lanes and
+ * indexed by their pending message id.
+ *
+ * Each lane keeps its messages in arrival order, and lanes are meant to
+ * be handled in the order of the Lane enum so that a long scrollback
+ * does not delay e.g. a class 0 alert. Lookups and removals are constant
+ * time, so draining a large backlog one message at a time stays linear.
+ * The queue is not copyable, the index refers to the nodes of the lists.
+ */
+class PendingMessageQueue
+{
+public:
+    enum Lane {
+        Urgent,     // class 0 SMS and voicemail notices
+        Inbound,    // new messages
+        Delivery,   // delivery reports
+        Scrollback, // history replayed by the connection
+        LaneCount
+    };
+
+    typedef std::list<Tp::ReceivedMessage>::const_iterator const_iterator;
+
+    PendingMessageQueue();
+
+    /*!
+     * \brief Appends the message to the given lane, unless one with the
+     * same pending id is already queued.
+     * \return true if the message was added
+     */
+    bool append(const Tp::ReceivedMessage &message, Lane lane);
+    bool append(const Tp::ReceivedMessage &message);
+
+    bool contains(uint pendingId) const;
+    bool remove(uint pendingId);
+    bool remove(const Tp::ReceivedMessage &message);
+    void clear();
+
+    int size() const { return m_index.size(); }
+    int size(Lane lane) const { return int(m_lanes[lane].size()); }
+    bool isEmpty() const { return m_index.isEmpty(); }
+
+    const_iterator begin(Lane lane) const { return m_lanes[lane].begin(); }
+    const_iterator end(Lane lane) const { return m_lanes[lane].end(); }
+
+    static uint pendingId(const Tp::ReceivedMessage &message);
+
+    /*!
+     * \brief Lane of a message, from its type and header.
+     */
+    static Lane lane(const Tp::ReceivedMessage &message, const MessageHeader &header);
+
+private:
+    Q_DISABLE_COPY(PendingMessageQueue)
+
+    struct Entry {
+        Lane lane;
+        std::list<Tp::ReceivedMessage>::iterator message;
+    };
+
+    std::list<Tp::ReceivedMessage> m_lanes[LaneCount];
+    QHash<uint, Entry> m_index;
+};
+
+} // namespace RTComLogger
+
+#endif // PENDINGMESSAGEQUEUE_H
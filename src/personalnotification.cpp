@@ -23,6 +23,7 @@
 
 #include "personalnotification.h"
 #include "notificationmanager.h"
+#include "ingestionmetrics.h"
 #include "locstrings.h"
 #include "constants.h"
 #include "debug.h"
@@ -81,6 +82,7 @@ PersonalNotification::PersonalNotification(QObject* parent) : QObject(parent),
     m_eventType(CommHistory::Event::UnknownType),
     m_chatType(CommHistory::Group::ChatTypeP2P),
     m_hasPendingEvents(false),
+    m_quiet(false),
     m_notification(0)
 {
 }
@@ -97,6 +99,7 @@ PersonalNotification::PersonalNotification(const QString& remoteUid,
     m_eventType(eventType), m_targetId(channelTargetId), m_chatType(chatType),
     m_notificationText(lastNotification),
     m_hasPendingEvents(true),
+    m_quiet(false),
     m_notification(0),
     m_recipient(account, remoteUid)
 {
@@ -147,6 +150,7 @@ QByteArray PersonalNotification::serialized() const
 
 void PersonalNotification::publishNotification()
 {
+    IngestionSpan span(IngestionMetrics::Publish);
     QString name;
 
     // voicemail notifications shouldn't have contact name
@@ -169,7 +173,7 @@ void PersonalNotification::publishNotification()
 
     NotificationManager::instance()->setNotificationProperties(m_notification, this, false);
 
-    if (collection() == Voice) {
+    if (collection() == Voice || m_quiet) {
         // avoid popup
         m_notification->setUrgency(Notification::Low);
     }
@@ -395,6 +399,16 @@ void PersonalNotification::setHidden(bool)
     // Deprecated but still needed for serialization compatibilty.
 }
 
+bool PersonalNotification::quiet() const
+{
+    return m_quiet;
+}
+
+void PersonalNotification::setQuiet(bool quiet)
+{
+    m_quiet = quiet;
+}
+
 const Recipient &PersonalNotification::recipient() const
 {
     return m_recipient;
@@ -109,6 +109,7 @@ public:
     QString smsReplaceNumber() const;
     QDateTime timestamp() const;
     bool hidden() const;
+    bool quiet() const;
 
     bool hasPhoneNumber() const;
 
@@ -123,6 +124,8 @@ public:
     void setEventToken(const QString& eventToken);
     void setSmsReplaceNumber(const QString& number);
     void setHidden(bool hide = true);
+    // Published without popup; not serialized
+    void setQuiet(bool quiet = true);
 
     const CommHistory::Recipient &recipient() const;
 
@@ -148,6 +151,7 @@ private:
     QString m_smsReplaceNumber;
     bool m_hidden;
     bool m_restored;
+    bool m_quiet;
 
     Notification *m_notification;
     CommHistory::Recipient m_recipient;
@@ -0,0 +1,53 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#include "readonlydatabase.h"
+
+#include <CommHistory/commhistorydatabasepath.h>
+
+#include <QDebug>
+#include <QSqlDatabase>
+#include <QSqlError>
+
+bool ReadOnlyDatabase::open(const QString &name, QSqlDatabase &db)
+{
+    if (QSqlDatabase::contains(name)) {
+        db = QSqlDatabase::database(name);
+    } else {
+        db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), name);
+        db.setDatabaseName(CommHistory::CommHistoryDatabasePath::databaseFile());
+        db.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=1000"));
+        db.open();
+    }
+
+    if (!db.isOpen()) {
+        qWarning() << "Cannot open database connection" << name << ":" << db.lastError();
+        return false;
+    }
+    return true;
+}
+
+void ReadOnlyDatabase::close(const QString &name)
+{
+    if (QSqlDatabase::contains(name))
+        QSqlDatabase::removeDatabase(name);
+}
@@ -0,0 +1,54 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#ifndef READONLYDATABASE_H
+#define READONLYDATABASE_H
+
+#include <QString>
+
+class QSqlDatabase;
+
+/*!
+ * \class ReadOnlyDatabase
+ * \brief Private read-only connections to the commhistory database.
+ *
+ * DatabaseIO has a single connection which belongs to the main thread and
+ * offers only its own lookups. Queries of their own, or ones made from a
+ * worker thread, go through a named connection opened here. A connection
+ * may only be used by the thread which opened it.
+ */
+class ReadOnlyDatabase
+{
+public:
+    /*!
+     * \brief Opens the connection \a name, or returns it if already open.
+     */
+    static bool open(const QString &name, QSqlDatabase &db);
+
+    /*!
+     * \brief Removes the connection \a name. No QSqlDatabase referring to
+     * it may be left.
+     */
+    static void close(const QString &name);
+};
+
+#endif // READONLYDATABASE_H
@@ -0,0 +1,248 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "roamingwatcher.h"
+#include "modemregistry.h"
+#include "debug.h"
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusServiceWatcher>
+#include <QDBusVariant>
+
+#include <qofononetworkregistration.h>
+#include <qofonoconnectionmanager.h>
+
+static const QString kConnectiondService("com.jolla.Connectiond");
+static const QString kConnectiondPath("/Connectiond");
+static const QString kPropertiesInterface("org.freedesktop.DBus.Properties");
+static const QString kAskRoamingProperty("askRoaming");
+static const QString kNetworkStatusRoaming("roaming");
+
+RoamingWatcher::RoamingWatcher(QObject *parent)
+    : QObject(parent)
+    , m_modemRegistry(ModemRegistry::instance())
+    , m_connectiondWatcher(new QDBusServiceWatcher(kConnectiondService, QDBusConnection::sessionBus(),
+                                                   QDBusServiceWatcher::WatchForRegistration, this))
+    , m_askRoaming(true)
+{
+    connect(m_modemRegistry, SIGNAL(modemAdded(QString)), SLOT(onModemAdded(QString)));
+    connect(m_modemRegistry, SIGNAL(modemRemoved(QString)), SLOT(onModemRemoved(QString)));
+    foreach (const QString &path, m_modemRegistry->modemPaths())
+        onModemAdded(path);
+
+    connect(m_connectiondWatcher, SIGNAL(serviceRegistered(QString)), SLOT(onConnectiondRegistered()));
+
+    if (!QDBusConnection::sessionBus().connect(kConnectiondService, kConnectiondPath, kPropertiesInterface,
+            QStringLiteral("PropertiesChanged"), this,
+            SLOT(onConnectiondPropertiesChanged(QString,QVariantMap,QStringList)))) {
+        qWarning() << "RoamingWatcher: failed to watch" << kAskRoamingProperty;
+    }
+
+    fetchAskRoaming();
+}
+
+bool RoamingWatcher::isDataProhibited(const QString &modemPath) const
+{
+    QHash<QString, ModemState>::const_iterator it = m_modems.constFind(modemPath);
+    return it == m_modems.constEnd() || it->prohibited;
+}
+
+void RoamingWatcher::onModemAdded(const QString &path)
+{
+    ModemRegistry::Modem *modem = m_modemRegistry->modem(path);
+    if (!modem || m_modems.contains(path))
+        return;
+
+    connect(modem->network, SIGNAL(statusChanged(QString)), SLOT(onStatusChanged(QString)));
+    connect(modem->connection, SIGNAL(roamingAllowedChanged(bool)), SLOT(onRoamingAllowedChanged(bool)));
+    connect(modem->network, SIGNAL(validChanged(bool)), SLOT(onModemValidChanged()));
+    connect(modem->connection, SIGNAL(validChanged(bool)), SLOT(onModemValidChanged()));
+
+    // The proxies may not have loaded their properties yet; until they
+    // have, data stays prohibited
+    ModemState state;
+    readModem(path, state);
+    state.prohibited = computeProhibited(state);
+    m_modems.insert(path, state);
+    if (state.known && state.roaming)
+        fetchAskRoaming();
+}
+
+void RoamingWatcher::readModem(const QString &path, ModemState &state) const
+{
+    ModemRegistry::Modem *modem = m_modemRegistry->modem(path);
+    state.known = modem && modem->network->isValid() && modem->connection->isValid();
+    if (state.known) {
+        state.roaming = (modem->network->status() == kNetworkStatusRoaming);
+        state.roamingAllowed = modem->connection->roamingAllowed();
+    }
+}
+
+void RoamingWatcher::onModemValidChanged()
+{
+    QString path;
+    if (QOfonoNetworkRegistration *network = qobject_cast<QOfonoNetworkRegistration*>(sender()))
+        path = network->modemPath();
+    else if (QOfonoConnectionManager *connection = qobject_cast<QOfonoConnectionManager*>(sender()))
+        path = connection->modemPath();
+
+    QHash<QString, ModemState>::iterator it = m_modems.find(path);
+    if (it == m_modems.end())
+        return;
+
+    const bool wasRoaming = it->known && it->roaming;
+    readModem(path, *it);
+    qCDebug(lcCommhistoryd) << "RoamingWatcher: modem" << path << (it->known ? "known" : "not known")
+                            << "roaming" << it->roaming << "allowed" << it->roamingAllowed;
+    const bool started = it->known && it->roaming && !wasRoaming;
+    updateModem(path);
+
+    if (started)
+        fetchAskRoaming();
+}
+
+void RoamingWatcher::onModemRemoved(const QString &path)
+{
+    m_modems.remove(path);
+}
+
+void RoamingWatcher::onStatusChanged(const QString &status)
+{
+    QOfonoNetworkRegistration *network = qobject_cast<QOfonoNetworkRegistration*>(sender());
+    if (!network)
+        return;
+
+    const QString path(network->modemPath());
+    QHash<QString, ModemState>::iterator it = m_modems.find(path);
+    if (it != m_modems.end()) {
+        qCDebug(lcCommhistoryd) << "RoamingWatcher: status changed for" << path << "to" << status;
+        const bool roaming = (status == kNetworkStatusRoaming);
+        const bool started = roaming && !it->roaming;
+        it->roaming = roaming;
+        updateModem(path);
+
+        // Not every connectiond announces changes of the setting, make
+        // sure it's current whenever it starts to matter, see also
+        // onRoamingAllowedChanged()
+        if (started)
+            fetchAskRoaming();
+    }
+}
+
+void RoamingWatcher::onRoamingAllowedChanged(bool allowed)
+{
+    QOfonoConnectionManager *connection = qobject_cast<QOfonoConnectionManager*>(sender());
+    if (!connection)
+        return;
+
+    const QString path(connection->modemPath());
+    QHash<QString, ModemState>::iterator it = m_modems.find(path);
+    if (it != m_modems.end()) {
+        qCDebug(lcCommhistoryd) << "RoamingWatcher: roaming allowed changed for" << path << "to" << allowed;
+        it->roamingAllowed = allowed;
+        updateModem(path);
+
+        if (allowed && it->roaming)
+            fetchAskRoaming();
+    }
+}
+
+void RoamingWatcher::onConnectiondRegistered()
+{
+    fetchAskRoaming();
+}
+
+void RoamingWatcher::onConnectiondPropertiesChanged(const QString &interface, const QVariantMap &changed,
+                                                    const QStringList &invalidated)
+{
+    Q_UNUSED(interface)
+
+    QVariantMap::const_iterator it = changed.constFind(kAskRoamingProperty);
+    if (it != changed.constEnd())
+        onAskRoamingChanged(it->toBool());
+    else if (invalidated.contains(kAskRoamingProperty))
+        fetchAskRoaming();
+}
+
+void RoamingWatcher::fetchAskRoaming()
+{
+    QDBusMessage call(QDBusMessage::createMethodCall(kConnectiondService, kConnectiondPath,
+        kPropertiesInterface, QStringLiteral("Get")));
+    call.setArguments(QVariantList() << QString() << kAskRoamingProperty);
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
+                QDBusConnection::sessionBus().asyncCall(call), this);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+            SLOT(onAskRoamingFetched(QDBusPendingCallWatcher*)));
+}
+
+void RoamingWatcher::onAskRoamingFetched(QDBusPendingCallWatcher *call)
+{
+    QDBusPendingReply<QDBusVariant> reply = *call;
+    if (reply.isError()) {
+        // Keep the last known value, or the restrictive default until
+        // connectiond shows up
+        qCDebug(lcCommhistoryd) << "RoamingWatcher: failed to get" << kAskRoamingProperty << reply.error();
+    } else {
+        onAskRoamingChanged(reply.value().variant().toBool());
+    }
+    call->deleteLater();
+}
+
+void RoamingWatcher::onAskRoamingChanged(bool askRoaming)
+{
+    if (m_askRoaming == askRoaming)
+        return;
+
+    qCDebug(lcCommhistoryd) << "RoamingWatcher:" << kAskRoamingProperty << "changed to" << askRoaming;
+    m_askRoaming = askRoaming;
+    foreach (const QString &path, m_modems.keys())
+        updateModem(path);
+}
+
+void RoamingWatcher::updateModem(const QString &path)
+{
+    QHash<QString, ModemState>::iterator it = m_modems.find(path);
+    if (it == m_modems.end())
+        return;
+
+    const bool prohibited = computeProhibited(*it);
+    if (it->prohibited != prohibited) {
+        it->prohibited = prohibited;
+        emit dataProhibitedChanged(path, prohibited);
+    }
+}
+
+bool RoamingWatcher::computeProhibited(const ModemState &state) const
+{
+    if (!state.known)
+        return true;
+    if (!state.roaming)
+        return false;
+    if (!state.roamingAllowed)
+        return true;
+
+    // For now, treat "always ask" like "never"
+    return m_askRoaming;
+}
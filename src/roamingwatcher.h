@@ -0,0 +1,91 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef ROAMINGWATCHER_H
+#define ROAMINGWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+#include <QVariantMap>
+
+class QDBusPendingCallWatcher;
+class QDBusServiceWatcher;
+class ModemRegistry;
+
+/*!
+ * \class RoamingWatcher
+ * \brief Caches the roaming state which decides whether mobile data may be used.
+ *
+ * Network registration status and roamingAllowed are tracked per modem, the
+ * connectiond "askRoaming" setting is fetched asynchronously, and again when a
+ * modem starts roaming, and kept up to date from PropertiesChanged. Until it's
+ * known, asking is assumed, which prohibits data while roaming. Data is also
+ * prohibited on a modem until its network status and roamingAllowed are known.
+ * isDataProhibited() never blocks.
+ */
+class RoamingWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit RoamingWatcher(QObject *parent = 0);
+
+    bool isDataProhibited(const QString &modemPath) const;
+
+Q_SIGNALS:
+    void dataProhibitedChanged(const QString &modemPath, bool prohibited);
+
+private Q_SLOTS:
+    void onModemAdded(const QString &path);
+    void onModemRemoved(const QString &path);
+    void onModemValidChanged();
+    void onStatusChanged(const QString &status);
+    void onRoamingAllowedChanged(bool allowed);
+    void onConnectiondRegistered();
+    void onConnectiondPropertiesChanged(const QString &interface, const QVariantMap &changed,
+                                        const QStringList &invalidated);
+    void onAskRoamingChanged(bool askRoaming);
+    void onAskRoamingFetched(QDBusPendingCallWatcher *call);
+
+private:
+    struct ModemState {
+        ModemState() : known(false), roaming(false), roamingAllowed(true), prohibited(true) { }
+        // network status and roamingAllowed have been loaded
+        bool known;
+        bool roaming;
+        bool roamingAllowed;
+        bool prohibited;
+    };
+
+    void fetchAskRoaming();
+    void readModem(const QString &path, ModemState &state) const;
+    void updateModem(const QString &path);
+    bool computeProhibited(const ModemState &state) const;
+
+private:
+    ModemRegistry *m_modemRegistry;
+    QDBusServiceWatcher *m_connectiondWatcher;
+    QHash<QString, ModemState> m_modems;
+    bool m_askRoaming;
+};
+
+#endif // ROAMINGWATCHER_H
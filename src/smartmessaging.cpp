@@ -20,58 +20,109 @@
 ******************************************************************************/
 
 #include "smartmessaging.h"
+#include "modemregistry.h"
 #include "notificationmanager.h"
+#include "daemonstats.h"
 #include "constants.h"
 
 #include <CommHistory/event.h>
 #include <CommHistory/messagepart.h>
+#include <CommHistory/commhistorydatabasepath.h>
 
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
 #include <QLoggingCategory>
+#include <QRunnable>
+#include <QTemporaryFile>
 
 #define AGENT_PATH          "/commhistoryd/SmartMessagingAgent"
 #define AGENT_SERVICE       "org.ofono.SmartMessagingAgent"
 
 #define VCARD_CONTENT_TYPE  "text/x-vcard"
 #define VCARD_EXTENSION     "vcf"
+#define VCARD_CONTENT_ID    "card." VCARD_EXTENSION
 
 Q_LOGGING_CATEGORY(lcSmartMessaging, "commhistoryd.smartmessaging", QtWarningMsg)
 
 using namespace CommHistory;
 using namespace RTComLogger;
 
+class SmartMessaging::StagedCard
+{
+public:
+    QByteArray vcard;
+    QString from;
+    QString modemPath;
+    QDateTime received;
+
+    // Written by the stage task
+    QString stagedPath;
+    bool ok;
+};
+
+class SmartMessaging::StageTask : public QRunnable
+{
+public:
+    StageTask(SmartMessaging *handler, int token, StagedCard *card)
+        : m_handler(handler), m_token(token), m_card(card) { }
+
+    void run()
+    {
+        m_card->ok = SmartMessaging::stage(m_card);
+        m_card->vcard.clear();
+        QMetaObject::invokeMethod(m_handler, "onVCardStaged", Qt::QueuedConnection,
+                                  Q_ARG(int, m_token));
+    }
+
+private:
+    SmartMessaging *m_handler;
+    int m_token;
+    StagedCard *m_card;
+};
+
+class SmartMessaging::SweepTask : public QRunnable
+{
+public:
+    void run()
+    {
+        // Nothing is staged yet when this runs, anything left behind is
+        // from an earlier instance that didn't get to store its event
+        QDirIterator it(SmartMessaging::stagingDir(), QDir::Files | QDir::Hidden);
+        while (it.hasNext()) {
+            const QString path = it.next();
+            qCDebug(lcSmartMessaging) << "SmartMessaging: Removing stale staging file" << path;
+            QFile::remove(path);
+        }
+    }
+};
+
 SmartMessaging::SmartMessaging(QObject* parent) :
     MessageHandlerBase(parent, AGENT_PATH, AGENT_SERVICE),
-    ofonoManager(QOfonoManager::instance())
+    modemRegistry(ModemRegistry::instance()),
+    lastToken(0)
 {
-    QOfonoManager* ofono = ofonoManager.data();
-    connect(ofono, SIGNAL(modemAdded(QString)), this, SLOT(onModemAdded(QString)));
-    connect(ofono, SIGNAL(modemRemoved(QString)), this, SLOT(onModemRemoved(QString)));
+    stagingPool.setMaxThreadCount(1);
+    // Single thread, so this is done before any new card gets staged
+    stagingPool.start(new SweepTask);
+
+    connect(modemRegistry, SIGNAL(modemAdded(QString)), this, SLOT(onModemAdded(QString)));
+    connect(modemRegistry, SIGNAL(modemRemoved(QString)), this, SLOT(onModemRemoved(QString)));
     qCDebug(lcSmartMessaging) << "SmartMessaging created";
 
-    if (ofono->available()) {
-        addAllModems();
-    }
-    connect(ofono, SIGNAL(availableChanged(bool)),
-            this, SLOT(onOfonoAvailableChanged(bool)));
+    addAllModems();
 }
 
 SmartMessaging::~SmartMessaging()
 {
-    onOfonoAvailableChanged(false);
-}
-
-void SmartMessaging::onOfonoAvailableChanged(bool available)
-{
-    qCDebug(lcSmartMessaging) << "SmartMessaging: ofono available changed to" << available;
-    if (available) {
-        addAllModems();
-    } else {
-        qDeleteAll(interfaces.values());
-        qDeleteAll(agents.values());
-        interfaces.clear();
-        agents.clear();
-        agentToModemPaths.clear();
+    stagingPool.waitForDone();
+    foreach (StagedCard *card, stagedCards) {
+        if (card->ok)
+            QFile::remove(card->stagedPath);
     }
+    qDeleteAll(stagedCards);
+    qDeleteAll(agents.values());
 }
 
 void SmartMessaging::setup(const QString &path)
@@ -85,8 +136,11 @@ void SmartMessaging::setup(const QString &path)
     QOfonoSmartMessaging *sm = 0;
     QString agentPath = agentPathFromModem(path);
 
-    sm = interfaces[path];
-    agent = agents[agentPath];
+    ModemRegistry::Modem *modem = modemRegistry->modem(path);
+    sm = modem ? modem->smartMessaging : 0;
+    agent = agents.value(agentPath);
+    if (!sm || !agent)
+        return;
 
     qCDebug(lcSmartMessaging) << "SmartMessaging setup: registering agent" << agentPath << "for" << path;
     sm->registerAgent(agentPath);
@@ -101,7 +155,7 @@ void SmartMessaging::setup(const QString &path)
 
 void SmartMessaging::addAllModems()
 {
-    QStringList modems = ofonoManager->modems();
+    QStringList modems = modemRegistry->modemPaths();
     foreach (QString path, modems) {
         qCDebug(lcSmartMessaging) << "SmartMessaging: modem" << path;
         addModem(path);
@@ -110,13 +164,12 @@ void SmartMessaging::addAllModems()
 
 void SmartMessaging::addModem(QString path)
 {
-    if (interfaces.contains(path))
+    QString agentPath = agentPathFromModem(path);
+    ModemRegistry::Modem *modem = modemRegistry->modem(path);
+    if (!modem || agents.contains(agentPath))
         return;
 
-    QOfonoSmartMessaging* sm = new QOfonoSmartMessaging(this);
-    QString agentPath = agentPathFromModem(path);
-    sm->setModemPath(path);
-    interfaces.insert(path, sm);
+    QOfonoSmartMessaging* sm = modem->smartMessaging;
     QOfonoSmartMessagingAgent *agent = new QOfonoSmartMessagingAgent(this);
     agents.insert(agentPath, agent);
 
@@ -131,7 +184,6 @@ void SmartMessaging::addModem(QString path)
 void SmartMessaging::onModemAdded(QString path)
 {
     qCDebug(lcSmartMessaging) << "SmartMessaging: onModemAdded" << path;
-    delete interfaces.take(path);
     addModem(path);
 }
 
@@ -140,7 +192,6 @@ void SmartMessaging::onModemRemoved(QString path)
     qCDebug(lcSmartMessaging) << "SmartMessaging: onModemRemoved" << path;
     QString agentPath = agentPathFromModem(path);
     agentToModemPaths.remove(agentPath);
-    delete interfaces.take(path);
     delete agents.take(agentPath);
 }
 
@@ -181,43 +232,100 @@ void SmartMessaging::onReceiveBusinessCard(const QByteArray &vcard, const QVaria
         return;
     }
 
-    QString path = agentToModemPaths.value(agent->agentPath());
-    QString ringAccountPath = accountPath(path);
+    // The file is written off the main thread, the event is stored once
+    // it's there
+    StagedCard *card = new StagedCard;
+    card->vcard = vcard;
+    card->from = from;
+    card->modemPath = agentToModemPaths.value(agent->agentPath());
+    card->received = QDateTime::currentDateTime();
+    card->ok = false;
+
+    const int token = ++lastToken;
+    stagedCards.insert(token, card);
+    stagingPool.start(new StageTask(this, token, card));
+}
+
+void SmartMessaging::onVCardStaged(int token)
+{
+    StagedCard *card = stagedCards.take(token);
+    if (!card)
+        return;
+
+    if (!card->ok) {
+        qWarning() << "Failed to store vCard from" << card->from << "; message dropped";
+        delete card;
+        return;
+    }
+
+    QString ringAccountPath = accountPath(card->modemPath);
 
     Event event;
     event.setType(Event::SMSEvent);
-    event.setStartTime(QDateTime::currentDateTime());
+    event.setStartTime(card->received);
     event.setEndTime(event.startTime());
     event.setDirection(Event::Inbound);
     event.setLocalUid(ringAccountPath);
-    event.setRecipients(Recipient(ringAccountPath, from));
+    event.setRecipients(Recipient(ringAccountPath, card->from));
     event.setStatus(Event::DownloadingStatus);
+
     if (!setGroupForEvent(event)) {
-        qCritical() << "Failed to handle group for vCard notification event; message dropped:" << event.toString();
+        qCritical() << "Failed to handle group for vCard event; message dropped:" << event.toString();
+        QFile::remove(card->stagedPath);
+        delete card;
         return;
     }
 
     EventModel model;
-    if (!model.addEvent(event)) {
-        qCritical() << "Failed to save vCard notification event; message dropped" << event.toString();
+    bool added;
+    {
+        DatabaseQueryTimer queryTimer;
+        added = model.addEvent(event);
+    }
+    if (!added) {
+        qCritical() << "Failed to save vCard event; message dropped" << event.toString();
+        QFile::remove(card->stagedPath);
+        delete card;
         return;
     }
 
-    MessagePart part;
-    if (!save(event.id(), vcard, part)) {
-        qWarning() << "Failed to store vCard";
+    // Message parts are kept in a directory named after the event id, so
+    // the file is moved there once the event exists. Renaming stays within
+    // one file system. The event never refers to the staging directory,
+    // which is emptied at startup.
+    const QString path(messagePartPath(event.id(), VCARD_CONTENT_ID));
+    if (path.isEmpty() || !QFile::rename(card->stagedPath, path)) {
+        qWarning() << "Failed to store vCard from" << card->stagedPath;
+        QFile::remove(card->stagedPath);
+        DatabaseQueryTimer queryTimer;
         model.deleteEvent(event.id());
+        delete card;
         return;
     }
+    qCDebug(lcSmartMessaging) << "SmartMessaging: Stored vCard to" << path;
+
+    MessagePart part;
+    part.setContentType(VCARD_CONTENT_TYPE);
+    part.setContentId(VCARD_CONTENT_ID);
+    part.setPath(path);
 
     event.setStatus(Event::ReceivedStatus);
     event.setMessageParts(QList<MessagePart>() << part);
-    if (!model.modifyEvent(event)) {
+    bool modified;
+    {
+        DatabaseQueryTimer queryTimer;
+        modified = model.modifyEvent(event);
+    }
+    if (!modified) {
         qCritical() << "Failed to update vCard event:" << event.toString();
+        DatabaseQueryTimer queryTimer;
         model.deleteEvent(event.id());
+        delete card;
+        return;
     }
 
-    NotificationManager::instance()->showNotification(event, from, Group::ChatTypeP2P);
+    NotificationManager::instance()->showNotification(event, card->from, Group::ChatTypeP2P);
+    delete card;
 }
 
 void SmartMessaging::onRelease()
@@ -225,27 +333,38 @@ void SmartMessaging::onRelease()
     qCDebug(lcSmartMessaging) << "SmartMessaging: Release";
 }
 
-bool SmartMessaging::save(int id, QByteArray vcard, MessagePart& part)
-{
-    bool ok = false;
-    if (vcard.size()) {
-        QString contentId("card." VCARD_EXTENSION);
-        QString path = messagePartPath(id, contentId);
-        if (!path.isEmpty()) {
-            QFile file(path);
-            if (file.open(QIODevice::WriteOnly)) {
-                if (file.write(vcard) == vcard.size()) {
-                    qCDebug(lcSmartMessaging) << "SmartMessaging: Stored vCard to" << path;
-                    part.setContentType(VCARD_CONTENT_TYPE);
-                    part.setContentId(contentId);
-                    part.setPath(path);
-                    ok = true;
-                }
-                file.close();
-            }
-        }
-    } else {
+QString SmartMessaging::stagingDir()
+{
+    return CommHistory::CommHistoryDatabasePath::dataDir() + QStringLiteral("/.staging");
+}
+
+bool SmartMessaging::stage(StagedCard *card)
+{
+    // Runs on the staging thread
+    if (card->vcard.isEmpty()) {
         qWarning() << "Empty vcard";
+        return false;
+    }
+
+    if (!QDir().mkpath(stagingDir())) {
+        qWarning() << "Cannot create vCard staging directory" << stagingDir();
+        return false;
     }
-    return ok;
+
+    QTemporaryFile file(stagingDir() + QStringLiteral("/card-XXXXXX." VCARD_EXTENSION));
+    file.setAutoRemove(false);
+    if (!file.open()) {
+        qWarning() << "Cannot create vCard staging file:" << file.errorString();
+        return false;
+    }
+
+    if (file.write(card->vcard) != card->vcard.size() || !file.flush()) {
+        qWarning() << "Failed to write vCard staging file:" << file.errorString();
+        file.remove();
+        return false;
+    }
+
+    card->stagedPath = file.fileName();
+    qCDebug(lcSmartMessaging) << "SmartMessaging: Staged vCard to" << card->stagedPath;
+    return true;
 }
@@ -23,14 +23,17 @@
 #define SMARTMESSAGING_H
 
 #include "messagehandlerbase.h"
-#include <qofonomanager.h>
 #include <qofonosmartmessaging.h>
 #include <qofonosmartmessagingagent.h>
 
+#include <QThreadPool>
+
 namespace CommHistory {
     class MessagePart;
 }
 
+class ModemRegistry;
+
 class SmartMessaging: public MessageHandlerBase
 {
     Q_OBJECT
@@ -40,13 +43,13 @@ public:
     ~SmartMessaging();
 
 private Q_SLOTS:
-    void onOfonoAvailableChanged(bool available);
     void onModemAdded(QString path);
     void onModemRemoved(QString path);
     void onValidChanged(bool valid);
     void onReceiveBusinessCard(const QByteArray &vcard, const QVariantMap &info);
     void onReceiveAppointment(const QByteArray &vcard, const QVariantMap &info);
     void onRelease();
+    void onVCardStaged(int token);
 
 private:
     QString agentPathFromModem(const QString &modemPath);
@@ -56,11 +59,19 @@ private:
     void setup(const QString &path);
 
 private:
-    static bool save(int id, QByteArray vcard, CommHistory::MessagePart& part);
+    class StagedCard;
+    class StageTask;
+    class SweepTask;
+
+    static QString stagingDir();
+    static bool stage(StagedCard *card);
 
 private:
-    QSharedPointer<QOfonoManager> ofonoManager;
-    QHash<QString,QOfonoSmartMessaging*> interfaces;
+    ModemRegistry *modemRegistry;
+    // Received vCards are written to disk on a worker thread
+    QThreadPool stagingPool;
+    QHash<int,StagedCard*> stagedCards;
+    int lastToken;
     QHash<QString,QOfonoSmartMessagingAgent*> agents;
     QHash<QString,QString> agentToModemPaths;
 };
@@ -31,7 +31,7 @@ TARGET = commhistoryd
 # -----------------------------------------------------------------------------
 # dependencies
 # -----------------------------------------------------------------------------
-QT += dbus contacts versit
+QT += dbus sql contacts versit
 QT -= gui
 
 PKGCONFIG += ngf-qt5 mce nemonotifications-qt5
@@ -59,6 +59,7 @@ HEADERS += logger.h \
            serialisable.h \
            personalnotification.h \
            commhistoryifadaptor.h \
+           statsifadaptor.h \
            commhistoryservice.h \
            locstrings.h \
            messagereviver.h \
@@ -72,10 +73,28 @@ HEADERS += logger.h \
            lastdialedcache.h \
            debug.h \
            fscleanup.h \
+           dirremover.h \
            mmshandler.h \
            mmspart.h \
            messagehandlerbase.h \
-           smartmessaging.h
+           smartmessaging.h \
+           modemregistry.h \
+           roamingwatcher.h \
+           mmssendqueue.h \
+           mmstransfermanager.h \
+           ingestionmetrics.h \
+           ingestionscheduler.h \
+           daemonstats.h \
+           daemonapplication.h \
+           stallwatchdog.h \
+           flightrecorder.h \
+           startupscheduler.h \
+           groupcache.h \
+           messageheader.h \
+           pendingmessagequeue.h \
+           structurepeek.h \
+           readonlydatabase.h \
+           duplicatefilter.h
 
 SOURCES += main.cpp \
            logger.cpp \
@@ -87,6 +106,7 @@ SOURCES += main.cpp \
            serialisable.cpp \
            personalnotification.cpp \
            commhistoryifadaptor.cpp \
+           statsifadaptor.cpp \
            commhistoryservice.cpp \
            messagereviver.cpp \
            connectionutils.cpp \
@@ -97,10 +117,35 @@ SOURCES += main.cpp \
            accountpresenceservice.cpp \
            lastdialedcache.cpp \
            fscleanup.cpp \
+           dirremover.cpp \
            mmshandler.cpp \
            mmspart.cpp \
            messagehandlerbase.cpp \
-           smartmessaging.cpp
+           smartmessaging.cpp \
+           modemregistry.cpp \
+           roamingwatcher.cpp \
+           mmssendqueue.cpp \
+           mmstransfermanager.cpp \
+           ingestionmetrics.cpp \
+           ingestionscheduler.cpp \
+           daemonstats.cpp \
+           daemonapplication.cpp \
+           stallwatchdog.cpp \
+           flightrecorder.cpp \
+           startupscheduler.cpp \
+           groupcache.cpp \
+           messageheader.cpp \
+           pendingmessagequeue.cpp \
+           structurepeek.cpp \
+           readonlydatabase.cpp \
+           duplicatefilter.cpp
+
+# Startup profiling harness, enabled at run time with --profile-startup
+startup_profiler {
+    DEFINES += COMMHISTORYD_STARTUP_PROFILER
+    HEADERS += startupprofiler.h
+    SOURCES += startupprofiler.cpp
+}
 
 DBUS_ADAPTORS += mmshandler
 mmshandler.files = org.nemomobile.MmsHandler.xml
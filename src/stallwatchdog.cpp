@@ -0,0 +1,138 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "stallwatchdog.h"
+#include "daemonapplication.h"
+#include "daemonstats.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <QMutexLocker>
+#include <QTimer>
+
+StallWatchdog *StallWatchdog::s_instance = 0;
+
+StallWatchdog *StallWatchdog::create(QObject *parent)
+{
+    bool ok = false;
+    const int threshold = qgetenv("COMMHISTORYD_STALL_THRESHOLD").toInt(&ok);
+    if (!ok || threshold <= 0 || s_instance)
+        return s_instance;
+
+    s_instance = new StallWatchdog(threshold, parent);
+    DaemonApplication::setDispatchTracking(true);
+    s_instance->start(QThread::LowPriority);
+    qCDebug(lcCommhistoryd) << "StallWatchdog: started with threshold" << threshold << "ms";
+    return s_instance;
+}
+
+StallWatchdog *StallWatchdog::instance()
+{
+    return s_instance;
+}
+
+StallWatchdog::StallWatchdog(int threshold, QObject *parent)
+    : QThread(parent)
+    , m_threshold(threshold)
+    , m_heartbeat(new QTimer(this))
+{
+    m_clock.start();
+    m_lastBeat.store(0);
+
+    m_heartbeat->setInterval(WATCHDOG_HEARTBEAT_INTERVAL);
+    connect(m_heartbeat, SIGNAL(timeout()), SLOT(heartbeat()));
+    m_heartbeat->start();
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    DaemonApplication::setDispatchTracking(false);
+    requestInterruption();
+    wait();
+    s_instance = 0;
+}
+
+void StallWatchdog::heartbeat()
+{
+    m_lastBeat.store(m_clock.elapsed());
+}
+
+void StallWatchdog::run()
+{
+    bool stalled = false;
+    Stall stall = Stall();
+    qint64 expected = 0;
+
+    while (!isInterruptionRequested()) {
+        msleep(WATCHDOG_HEARTBEAT_INTERVAL / 2);
+
+        const qint64 lastBeat = m_lastBeat.load();
+        const qint64 late = m_clock.elapsed() - lastBeat - WATCHDOG_HEARTBEAT_INTERVAL;
+
+        if (!stalled && late > m_threshold) {
+            // Whatever is being dispatched now is most likely the culprit
+            DaemonApplication::Dispatch dispatch = DaemonApplication::currentDispatch();
+            stalled = true;
+            expected = lastBeat + WATCHDOG_HEARTBEAT_INTERVAL;
+            stall.when = QDateTime::currentDateTime().addMSecs(-late);
+            stall.receiver = dispatch.receiver;
+            stall.parent = dispatch.parent;
+            stall.eventType = dispatch.eventType;
+        } else if (stalled && lastBeat >= expected) {
+            stalled = false;
+            stall.duration = lastBeat - expected;
+            addStall(stall);
+        }
+    }
+}
+
+void StallWatchdog::addStall(const Stall &stall)
+{
+    qWarning() << "StallWatchdog: main loop stalled for" << stall.duration << "ms in"
+               << (stall.receiver ? stall.receiver : "?") << "of"
+               << (stall.parent ? stall.parent : "-") << "handling event" << stall.eventType;
+    DaemonStats::instance()->increment(QStringLiteral("eventLoopStalls"));
+
+    QMutexLocker lock(&m_mutex);
+    int i = 0;
+    while (i < m_stalls.count() && m_stalls.at(i).duration >= stall.duration)
+        i++;
+    if (i < WATCHDOG_STALL_HISTORY) {
+        m_stalls.insert(i, stall);
+        if (m_stalls.count() > WATCHDOG_STALL_HISTORY)
+            m_stalls.removeLast();
+    }
+}
+
+QStringList StallWatchdog::stalls() const
+{
+    QStringList result;
+    QMutexLocker lock(&m_mutex);
+    foreach (const Stall &stall, m_stalls) {
+        result.append(QString::fromLatin1("%1 ms at %2 in %3 of %4, event %5")
+                      .arg(stall.duration)
+                      .arg(stall.when.toString(Qt::ISODate))
+                      .arg(QLatin1String(stall.receiver ? stall.receiver : "?"))
+                      .arg(QLatin1String(stall.parent ? stall.parent : "-"))
+                      .arg(stall.eventType));
+    }
+    return result;
+}
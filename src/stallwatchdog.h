@@ -0,0 +1,90 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QThread>
+#include <QAtomicInteger>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QStringList>
+
+class QTimer;
+
+/*!
+ * \class StallWatchdog
+ * \brief Measures main loop latency and records the worst stalls.
+ *
+ * A timer on the main thread beats at a fixed interval. The watchdog
+ * thread notices when a beat is late by more than the threshold, and
+ * remembers what DaemonApplication was dispatching at that moment.
+ * Only the worst stalls are kept.
+ */
+class StallWatchdog : public QThread
+{
+    Q_OBJECT
+
+public:
+    /*!
+     * \brief Starts the watchdog if enabled with COMMHISTORYD_STALL_THRESHOLD.
+     * The variable holds the threshold in ms. Returns 0 when not enabled.
+     */
+    static StallWatchdog *create(QObject *parent);
+    static StallWatchdog *instance();
+
+    ~StallWatchdog();
+
+    QStringList stalls() const;
+
+protected:
+    void run();
+
+private Q_SLOTS:
+    void heartbeat();
+
+private:
+    StallWatchdog(int threshold, QObject *parent);
+
+    struct Stall {
+        qint64 duration;
+        QDateTime when;
+        const char *receiver;
+        const char *parent;
+        int eventType;
+    };
+
+    void addStall(const Stall &stall);
+
+private:
+    static StallWatchdog *s_instance;
+
+    const int m_threshold;
+    QTimer *m_heartbeat;
+    QElapsedTimer m_clock;
+    QAtomicInteger<qint64> m_lastBeat;
+    mutable QMutex m_mutex;
+    QList<Stall> m_stalls;
+};
+
+#endif // STALLWATCHDOG_H
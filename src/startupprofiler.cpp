@@ -0,0 +1,194 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "startupprofiler.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTimer>
+
+namespace {
+StartupProfiler *profiler = 0;
+}
+
+void StartupProfiler::enable()
+{
+    if (!profiler)
+        profiler = new StartupProfiler;
+}
+
+StartupProfiler *StartupProfiler::instance()
+{
+    return profiler;
+}
+
+StartupProfiler::StartupProfiler()
+    : QObject(qApp)
+    , m_timeout(new QTimer(this))
+    , m_written(false)
+{
+    m_clock.start();
+    m_processAge = processAge();
+
+    m_pending << QStringLiteral("accountManagerReady")
+              << QStringLiteral("notificationsSynced")
+              << QStringLiteral("fsCleanupWatching")
+              << QStringLiteral("modemRegistered");
+
+    // Not every device has a modem, don't wait forever
+    m_timeout->setSingleShot(true);
+    m_timeout->setInterval(STARTUP_PROFILE_TIMEOUT);
+    connect(m_timeout, SIGNAL(timeout()), SLOT(write()));
+    m_timeout->start();
+}
+
+qint64 StartupProfiler::processAge()
+{
+    // Time since the process was forked in us, which includes the time
+    // spent in the dynamic linker and static constructors. -1 if unknown.
+    QFile stat(QStringLiteral("/proc/self/stat"));
+    if (!stat.open(QIODevice::ReadOnly))
+        return -1;
+
+    const QByteArray line(stat.readAll());
+    const QList<QByteArray> fields(line.mid(line.lastIndexOf(')') + 2).split(' '));
+    // starttime is the 22nd field, the 20th after the command name
+    bool ok = false;
+    const qint64 startTicks = fields.value(19).toLongLong(&ok);
+    struct timespec ts;
+    if (!ok || clock_gettime(CLOCK_BOOTTIME, &ts))
+        return -1;
+
+    const qint64 bootTime = qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    return bootTime - startTicks * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+void StartupProfiler::begin(const char *name)
+{
+    Span span;
+    span.name = name;
+    span.begin = now();
+    span.end = -1;
+    m_spans.append(span);
+}
+
+void StartupProfiler::end(const char *name)
+{
+    for (int i = m_spans.count() - 1; i >= 0; i--) {
+        if (m_spans[i].end < 0 && !qstrcmp(m_spans[i].name, name)) {
+            m_spans[i].end = now();
+            return;
+        }
+    }
+}
+
+void StartupProfiler::ready(const char *name)
+{
+    const QString milestone(QString::fromLatin1(name));
+    foreach (const Milestone &m, m_milestones) {
+        if (m.name == milestone)
+            return;
+    }
+
+    Milestone m;
+    m.name = milestone;
+    m.time = now();
+    m_milestones.append(m);
+    qCDebug(lcCommhistoryd) << "StartupProfiler:" << name << "at" << m.time << "us";
+
+    m_pending.remove(milestone);
+    if (m_pending.isEmpty() && !m_written)
+        QMetaObject::invokeMethod(this, "write", Qt::QueuedConnection);
+}
+
+QString StartupProfiler::write()
+{
+    if (m_written)
+        return QString();
+    m_written = true;
+    m_timeout->stop();
+
+    QJsonObject report;
+    report.insert(QStringLiteral("version"), 1);
+    report.insert(QStringLiteral("date"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+#ifdef HAS_BOOSTER
+    report.insert(QStringLiteral("booster"), true);
+#else
+    report.insert(QStringLiteral("booster"), false);
+#endif
+    // Time between fork and the profiler clock starting in main()
+    report.insert(QStringLiteral("processAgeUs"), double(m_processAge));
+    report.insert(QStringLiteral("completeUs"), double(now()));
+
+    QJsonArray components;
+    foreach (const Span &span, m_spans) {
+        QJsonObject o;
+        o.insert(QStringLiteral("name"), QString::fromLatin1(span.name));
+        o.insert(QStringLiteral("beginUs"), double(span.begin));
+        o.insert(QStringLiteral("endUs"), double(span.end));
+        components.append(o);
+    }
+    report.insert(QStringLiteral("components"), components);
+
+    QJsonArray milestones;
+    foreach (const Milestone &m, m_milestones) {
+        QJsonObject o;
+        o.insert(QStringLiteral("name"), m.name);
+        o.insert(QStringLiteral("timeUs"), double(m.time));
+        milestones.append(o);
+    }
+    report.insert(QStringLiteral("milestones"), milestones);
+
+    QJsonArray missing;
+    foreach (const QString &name, m_pending)
+        missing.append(name);
+    report.insert(QStringLiteral("missing"), missing);
+
+    const QString dir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+                      + QStringLiteral("/commhistoryd"));
+    QDir().mkpath(dir);
+    const QString filePath(dir + QStringLiteral("/startup-profile-")
+                           + QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmss"))
+                           + QStringLiteral(".json"));
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            || file.write(QJsonDocument(report).toJson()) < 0
+            || !file.commit()) {
+        qWarning() << "StartupProfiler: cannot write" << filePath << file.errorString();
+        return QString();
+    }
+
+    qWarning() << "StartupProfiler: report written to" << filePath;
+    return filePath;
+}
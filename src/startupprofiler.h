@@ -0,0 +1,124 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef STARTUPPROFILER_H
+#define STARTUPPROFILER_H
+
+/*
+ * Startup profiling is compiled in with "qmake CONFIG+=startup_profiler"
+ * and enabled at run time with --profile-startup. Otherwise the macros
+ * below expand to nothing.
+ *
+ * STARTUP_PROFILE_SCOPE(name)          times the construction of a component
+ * STARTUP_PROFILE_READY(name)          marks the first readiness of something
+ */
+
+#ifdef COMMHISTORYD_STARTUP_PROFILER
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSet>
+#include <QString>
+
+class QTimer;
+
+/*!
+ * \class StartupProfiler
+ * \brief Timestamps component construction and readiness during startup.
+ *
+ * The report is written as JSON to the commhistoryd cache directory once
+ * all expected milestones have been reached, or when STARTUP_PROFILE_TIMEOUT
+ * expires.
+ */
+class StartupProfiler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static void enable();
+    static StartupProfiler *instance();
+
+    void begin(const char *name);
+    void end(const char *name);
+    void ready(const char *name);
+
+public Q_SLOTS:
+    QString write();
+
+private:
+    StartupProfiler();
+
+    qint64 now() const { return m_clock.nsecsElapsed() / 1000; }
+    static qint64 processAge();
+
+    struct Span {
+        const char *name;
+        qint64 begin;
+        qint64 end;
+    };
+    struct Milestone {
+        QString name;
+        qint64 time;
+    };
+
+    QElapsedTimer m_clock;
+    qint64 m_processAge;
+    QTimer *m_timeout;
+    QList<Span> m_spans;
+    QList<Milestone> m_milestones;
+    QSet<QString> m_pending;
+    bool m_written;
+};
+
+class StartupProfileScope
+{
+public:
+    explicit StartupProfileScope(const char *name) : m_name(name)
+    {
+        if (StartupProfiler *p = StartupProfiler::instance())
+            p->begin(m_name);
+    }
+    ~StartupProfileScope()
+    {
+        if (StartupProfiler *p = StartupProfiler::instance())
+            p->end(m_name);
+    }
+
+private:
+    const char *m_name;
+};
+
+#define STARTUP_PROFILE_CONCAT_(a, b) a ## b
+#define STARTUP_PROFILE_CONCAT(a, b) STARTUP_PROFILE_CONCAT_(a, b)
+#define STARTUP_PROFILE_SCOPE(name) \
+    StartupProfileScope STARTUP_PROFILE_CONCAT(startupProfileScope, __LINE__)(name)
+#define STARTUP_PROFILE_READY(name) \
+    do { if (StartupProfiler *p = StartupProfiler::instance()) p->ready(name); } while (0)
+
+#else
+
+#define STARTUP_PROFILE_SCOPE(name)
+#define STARTUP_PROFILE_READY(name) do { } while (0)
+
+#endif // COMMHISTORYD_STARTUP_PROFILER
+
+#endif // STARTUPPROFILER_H
@@ -0,0 +1,118 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "startupscheduler.h"
+#include "ingestionmetrics.h"
+#include "daemonstats.h"
+#include "startupprofiler.h"
+#include "constants.h"
+#include "debug.h"
+
+#include <QCoreApplication>
+#include <QTimer>
+
+StartupScheduler *StartupScheduler::instance()
+{
+    static StartupScheduler *obj = 0;
+    if (!obj)
+        obj = new StartupScheduler(qApp);
+    return obj;
+}
+
+StartupScheduler::StartupScheduler(QObject *parent)
+    : QObject(parent)
+    , m_timer(new QTimer(this))
+    , m_firstMessage(-1)
+    , m_finished(false)
+{
+    m_clock.start();
+
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(STARTUP_SLICE_INTERVAL);
+    connect(m_timer, SIGNAL(timeout()), SLOT(runNext()));
+
+    connect(IngestionMetrics::instance(), SIGNAL(firstCommit()), SLOT(onFirstCommit()));
+
+    DaemonStats *stats = DaemonStats::instance();
+    stats->addGauge(this, QStringLiteral("startupFirstMessageMs"),
+                    [this] { return m_firstMessage; });
+    stats->addGauge(this, QStringLiteral("startupPendingComponents"), [this] {
+        qint64 pending = 0;
+        for (int i = 0; i < PriorityCount; i++)
+            pending += m_tasks[i].count();
+        return pending;
+    });
+}
+
+void StartupScheduler::schedule(const char *name, Priority priority, const Task &task)
+{
+    if (m_finished) {
+        qWarning() << "StartupScheduler: startup already finished, creating" << name << "right away";
+        task();
+        return;
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.task = task;
+    m_tasks[priority].append(entry);
+
+    // The timer only fires once the main loop is running
+    if (!m_timer->isActive())
+        m_timer->start();
+}
+
+void StartupScheduler::runNext()
+{
+    for (int i = 0; i < PriorityCount; i++) {
+        if (m_tasks[i].isEmpty())
+            continue;
+
+        const Entry entry(m_tasks[i].takeFirst());
+        QElapsedTimer timer;
+        timer.start();
+        {
+            STARTUP_PROFILE_SCOPE(entry.name);
+            entry.task();
+        }
+        qCDebug(lcCommhistoryd) << "StartupScheduler:" << entry.name << "created in"
+                                << timer.elapsed() << "ms at" << m_clock.elapsed() << "ms";
+
+        m_timer->start();
+        return;
+    }
+
+    m_finished = true;
+    qCDebug(lcCommhistoryd) << "StartupScheduler: startup finished in" << m_clock.elapsed() << "ms";
+    STARTUP_PROFILE_READY("startupFinished");
+    emit finished();
+}
+
+void StartupScheduler::onFirstCommit()
+{
+    if (m_firstMessage >= 0)
+        return;
+
+    m_firstMessage = m_clock.elapsed();
+    STARTUP_PROFILE_READY("firstMessageLogged");
+    qCDebug(lcCommhistoryd) << "StartupScheduler: first message logged" << m_firstMessage
+                            << "ms after startup";
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef STARTUPSCHEDULER_H
+#define STARTUPSCHEDULER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+
+#include <functional>
+
+class QTimer;
+
+/*!
+ * \class StartupScheduler
+ * \brief Brings up the components of the daemon in stages.
+ *
+ * Whatever is needed to accept channels is created directly in main().
+ * The rest is scheduled here and created one component per main loop
+ * iteration once the event loop runs, higher priorities first, so that
+ * channels dispatched during startup don't wait for all of it.
+ *
+ * The time from the creation of the scheduler to the first message
+ * committed to the database is reported as the startupFirstMessageMs
+ * statistic.
+ */
+class StartupScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority {
+        High,       // user visible: notifications, MMS
+        Normal,     // services used by other processes
+        Low,        // housekeeping
+        PriorityCount
+    };
+
+    typedef std::function<void()> Task;
+
+    static StartupScheduler *instance();
+
+    void schedule(const char *name, Priority priority, const Task &task);
+    bool isFinished() const { return m_finished; }
+
+    qint64 elapsed() const { return m_clock.elapsed(); }
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void runNext();
+    void onFirstCommit();
+
+private:
+    StartupScheduler(QObject *parent = 0);
+
+    struct Entry {
+        const char *name;
+        Task task;
+    };
+
+    QElapsedTimer m_clock;
+    QTimer *m_timer;
+    QList<Entry> m_tasks[PriorityCount];
+    qint64 m_firstMessage;
+    bool m_finished;
+};
+
+#endif // STARTUPSCHEDULER_H
@@ -0,0 +1,60 @@
+/*
+ * This file was generated by qdbusxml2cpp version 0.8
+ * Command line was: qdbusxml2cpp -c StatsIfAdaptor -a statsifadaptor StatsIf.xml
+ *
+ * qdbusxml2cpp is Copyright (C) 2013 Digia Plc and/or its subsidiary(-ies).
+ *
+ * This is an auto-generated file.
+ * This file may have been hand-edited. Look for HAND-EDIT comments
+ * before re-generating it.
+ */
+
+#include "statsifadaptor.h"
+#include "daemonstats.h"
+#include "flightrecorder.h"
+#include "stallwatchdog.h"
+#include <QtCore/QMetaObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVariant>
+
+/*
+ * Implementation of adaptor class StatsIfAdaptor
+ */
+
+StatsIfAdaptor::StatsIfAdaptor(QObject *parent)
+    : QDBusAbstractAdaptor(parent)
+{
+    // constructor
+    setAutoRelaySignals(true);
+}
+
+StatsIfAdaptor::~StatsIfAdaptor()
+{
+    // destructor
+}
+
+QString StatsIfAdaptor::dumpFlightRecorder()
+{
+    // handle method call org.nemomobile.CommHistory.Stats.dumpFlightRecorder
+    // HAND-EDIT: the recorder is not tied to the parent object
+    return FlightRecorder::instance()->dump();
+}
+
+QStringList StatsIfAdaptor::stalls()
+{
+    // handle method call org.nemomobile.CommHistory.Stats.stalls
+    // HAND-EDIT: empty unless the watchdog is enabled
+    StallWatchdog *watchdog = StallWatchdog::instance();
+    return watchdog ? watchdog->stalls() : QStringList();
+}
+
+QVariantMap StatsIfAdaptor::stats()
+{
+    // handle method call org.nemomobile.CommHistory.Stats.stats
+    // HAND-EDIT: the statistics are not tied to the parent object
+    return DaemonStats::instance()->stats();
+}
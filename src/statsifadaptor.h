@@ -0,0 +1,59 @@
+/*
+ * This file was generated by qdbusxml2cpp version 0.8
+ * Command line was: qdbusxml2cpp -c StatsIfAdaptor -a statsifadaptor StatsIf.xml
+ *
+ * qdbusxml2cpp is Copyright (C) 2013 Digia Plc and/or its subsidiary(-ies).
+ *
+ * This is an auto-generated file.
+ * This file may have been hand-edited. Look for HAND-EDIT comments
+ * before re-generating it.
+ */
+
+#ifndef STATSIFADAPTOR_H
+#define STATSIFADAPTOR_H
+
+#include <QtCore/QObject>
+#include <QtDBus/QtDBus>
+QT_BEGIN_NAMESPACE
+class QByteArray;
+template<class T> class QList;
+template<class Key, class Value> class QMap;
+class QString;
+class QStringList;
+class QVariant;
+QT_END_NAMESPACE
+
+/*
+ * Adaptor class for interface org.nemomobile.CommHistory.Stats
+ */
+class StatsIfAdaptor: public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.nemomobile.CommHistory.Stats")
+    Q_CLASSINFO("D-Bus Introspection", ""
+"  <interface name=\"org.nemomobile.CommHistory.Stats\">\n"
+"    <method name=\"stats\">\n"
+"      <arg direction=\"out\" type=\"a{sv}\" name=\"values\"/>\n"
+"      <annotation value=\"QVariantMap\" name=\"org.qtproject.QtDBus.QtTypeName.Out0\"/>\n"
+"    </method>\n"
+"    <method name=\"dumpFlightRecorder\">\n"
+"      <arg direction=\"out\" type=\"s\" name=\"path\"/>\n"
+"    </method>\n"
+"    <method name=\"stalls\">\n"
+"      <arg direction=\"out\" type=\"as\" name=\"stalls\"/>\n"
+"    </method>\n"
+"  </interface>\n"
+        "")
+public:
+    StatsIfAdaptor(QObject *parent);
+    virtual ~StatsIfAdaptor();
+
+public: // PROPERTIES
+public Q_SLOTS: // METHODS
+    QString dumpFlightRecorder();
+    QStringList stalls();
+    QVariantMap stats();
+Q_SIGNALS: // SIGNALS
+};
+
+#endif
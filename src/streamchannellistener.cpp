@@ -22,6 +22,7 @@
 
 #include "streamchannellistener.h"
 #include "notificationmanager.h"
+#include "daemonstats.h"
 #include "debug.h"
 
 // libcommhistory
@@ -99,6 +100,9 @@ StreamChannelListener::StreamChannelListener(const Tp::AccountPtr &account,
     // postpone adding event for incoming event to speed up call handling
     if (m_Direction == CommHistory::Event::Outbound && !addEvent())
         qWarning() << Q_FUNC_INFO << "failed to add event";
+
+    DaemonStats::instance()->addGauge(this, QStringLiteral("streamChannelListeners"),
+                                      [] { return qint64(1); });
 }
 
 StreamChannelListener::~StreamChannelListener()
@@ -344,6 +348,7 @@ void StreamChannelListener::timerEvent(QTimerEvent *event)
     if (event->timerId() == m_LoggingTimerId && m_EventAdded) {
         m_Event.setEndTime(QDateTime::currentDateTime());
         m_eventCommitted = false;
+        DatabaseQueryTimer queryTimer;
         eventModel().modifyEvent(m_Event);
     }
 }
@@ -354,6 +359,7 @@ bool StreamChannelListener::addEvent()
 
     bool result = false;
 
+    DatabaseQueryTimer queryTimer;
     if (m_EventAdded) {
         m_eventCommitted = false;
         result = eventModel().modifyEvent(m_Event);
@@ -0,0 +1,52 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#include "structurepeek.h"
+
+#include <QDBusArgument>
+#include <QVariant>
+
+namespace RTComLogger
+{
+
+bool peekStructureFields(const QDBusArgument &element, int *id, int *type)
+{
+    // Reading from a copy detaches it, element stays where it was
+    QDBusArgument peek(element);
+    if (peek.currentType() != QDBusArgument::StructureType)
+        return false;
+
+    peek.beginStructure();
+    bool ok = (peek.currentType() == QDBusArgument::BasicType);
+    if (ok) {
+        *id = peek.asVariant().toInt(&ok);
+        if (ok && type) {
+            ok = (peek.currentType() == QDBusArgument::BasicType);
+            if (ok)
+                *type = peek.asVariant().toInt(&ok);
+        }
+    }
+    peek.endStructure();
+    return ok;
+}
+
+} // namespace RTComLogger
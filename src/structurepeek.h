@@ -0,0 +1,43 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#ifndef STRUCTUREPEEK_H
+#define STRUCTUREPEEK_H
+
+class QDBusArgument;
+
+namespace RTComLogger
+{
+
+/*!
+ * \brief Reads the leading fields of a marshalled Event or Group structure
+ * without demarshalling the whole thing.
+ *
+ * Both start with the id, events continue with the type. The element
+ * itself is left where it was, so it can still be decoded in full.
+ * Returns false if the data doesn't look like that.
+ */
+bool peekStructureFields(const QDBusArgument &element, int *id, int *type = 0);
+
+} // namespace RTComLogger
+
+#endif // STRUCTUREPEEK_H
@@ -23,6 +23,7 @@
 
 // QT
 #include <QtDBus/QtDBus>
+#include <QElapsedTimer>
 
 // MeegoTouch
 #include <MLocale>
@@ -32,7 +33,6 @@
 
 // libcommhistory
 #include <CommHistory/EventModel>
-#include <CommHistory/GroupModel>
 #include <CommHistory/Event>
 #include <CommHistory/Group>
 #include <CommHistory/commonutils.h>
@@ -64,39 +64,29 @@
 
 #include "textchannellistener.h"
 #include "notificationmanager.h"
+#include "groupcache.h"
+#include "messageheader.h"
+#include "pendingmessagequeue.h"
+#include "duplicatefilter.h"
+#include "ingestionmetrics.h"
+#include "ingestionscheduler.h"
+#include "daemonstats.h"
+#include "flightrecorder.h"
 #include "locstrings.h"
 #include "constants.h"
 #include "debug.h"
 
 // LOCAL DEFINITIONS
-// delivery report
-#define DELIVERY_STATUS       QLatin1String("delivery-status")
-#define DELIVERY_TOKEN        QLatin1String("delivery-token")
-#define DELIVERY_TO           QLatin1String("delivery-to")
-#define DELIVERY_DBUSERROR    QLatin1String("delivery-dbus-error")
-#define DELIVERY_ERRORMESSAGE QLatin1String("delivery-error-message")
-#define DELIVERY_ECHO         QLatin1String("delivery-echo")
-
 // errors
 #define MODEM_ERROR_SMSC_ADDRESS_NOT_AVAILABLE         "com.nokia.Modem.SMS.Errors.SMSCAddressNotAvailable"
 #define MODEM_ERROR_DESTINATION_ADDRESS_FDN_RESTRICTED "com.nokia.Modem.SMS.Errors.DestinationAddressFDNRestricted"
 #define MODEM_ERROR_SMS_ADDRESS_FDN_RESTRICTED         "com.nokia.Modem.SMS.Errors.SMSCAddressFDNRestricted"
 
-// voicemail
-#define TXT_VOICE            QLatin1String("voice")
-#define MAILBOX_NOTIFICATION QLatin1String("x-nokia-mailbox-notification")
-#define VOICEMAIL_TYPE       QLatin1String("x-nokia-voicemail-type")
-#define MAILBOX_UNREAD_COUNT QLatin1String("x-nokia-mailbox-unread-count")
-#define MAILBOX_HAS_UNREAD   QLatin1String("x-nokia-mailbox-has-unread")
-
 // content
 #define PART_CONTENT       QLatin1String("content")
 #define PART_CONTENT_TYPE  QLatin1String("content-type")
 #define TXT_CONTENT_TYPE   QLatin1String("text/plain")
 
-// message editing support
-#define SUPERSEDES_TOKEN    QLatin1String("supersedes")
-
 #define PROTOCOL_TEL QLatin1String("tel")
 
 // tp properties
@@ -104,10 +94,7 @@
 #define CHANNEL_PROPERTY_SUBJECT QLatin1String("subject")
 #define CHANNEL_PROPERTY_SUBJECT_CONTACT QLatin1String("subject-contact")
 
-#define PENDING_MESSAGE_ID_PROPERTY_NAME QLatin1String("pending-message-id")
-
 #define SUBSCRIBER_ID_PROPERTY_NAME ("SubscriberIdentity")
-#define SUBSCRIBER_IDENTITY_HEADER_KEY ("subscriber-identity")
 
 #define MAX_SAVE_ATTEMPTS 3
 #define RESAVE_INTERVAL 5000 //ms
@@ -145,62 +132,6 @@ CommHistory::Event::PropertySet deliveryHandlingProperties = CommHistory::Event:
                                                  << CommHistory::Event::ReportRead;
 
 
-template<typename T>
-T partValue(const Tp::MessagePart &part, const QString &key, const T &defaultValue = T())
-{
-    if (part.contains(key)) {
-        const QVariant var(part.value(key).variant());
-        if (var.isValid())
-            return var.value<T>();
-    }
-
-    return defaultValue;
-}
-
-bool isVoicemail(const Tp::MessagePart &header)
-{
-    return (partValue<QString>(header, MAILBOX_NOTIFICATION) == TXT_VOICE);
-}
-
-QString replaceType(const Tp::MessagePart &header)
-{
-    return partValue<QString>(header, REPLACE_TYPE);
-}
-
-QString voicemailType(const Tp::MessagePart &header)
-{
-    // check whether it's skype or sms voicemail, aka
-    // "x-nokia-voicemail-type" is "skype" or "tel"
-    // Both SMS and Skype voicemail notifications (x-nokia-mailbox-notification
-    // with value "voice") MUST have this header
-    return partValue<QString>(header, VOICEMAIL_TYPE);
-}
-
-bool mailboxHasUnread(const Tp::MessagePart &header)
-{
-    return partValue<bool>(header, MAILBOX_HAS_UNREAD, false);
-}
-
-uint mailboxUnreadCount(const Tp::MessagePart &header)
-{
-    return partValue<uint>(header, MAILBOX_UNREAD_COUNT, 0u);
-}
-
-QString supersedesToken(const Tp::MessagePart &header)
-{
-    return partValue<QString>(header, SUPERSEDES_TOKEN);
-}
-
-uint pendingId(const Tp::ReceivedMessage &message)
-{
-    return partValue<uint>(message.header(), PENDING_MESSAGE_ID_PROPERTY_NAME, 0u);
-}
-
-QString subscriberIdentity(const Tp::MessagePart &header)
-{
-    return partValue<QString>(header, SUBSCRIBER_IDENTITY_HEADER_KEY);
-}
-
 void showErrorNote(const QString &errorMsg, const QString &category = ErrorCategory)
 {
     if (!errorMsg.isEmpty()) {
@@ -215,26 +146,50 @@ void showErrorNote(const QString &errorMsg, const QString &category = ErrorCateg
 
 } // anonymous namespace
 
-QMultiHash<QString,uint> TextChannelListener::m_pendingMessageIds;
+QHash<QString, QSet<uint> > TextChannelListener::m_pendingMessageIds;
 
 TextChannelListener::TextChannelListener(const Tp::AccountPtr &account,
                                          const Tp::ChannelPtr &channel,
                                          const Tp::MethodInvocationContextPtr<> &context,
                                          QObject *parent)
     : ChannelListener(account, channel, context, parent),
-      m_GroupModel(0),
+      m_GroupCache(0),
       m_GroupRequested(false),
       m_ShowOfflineChatError(true),
       m_isClassZeroSMS(false),
+      m_EventType(CommHistory::Event::UnknownType),
       m_PropertiesIf(0),
       m_IsGroupChat(false),
       m_channelClosed(false),
       m_FailedSaveCount(0),
-      m_pConversationModel(0)
+      m_pConversationModel(0),
+      m_chunkSize(MESSAGE_CHUNK_MIN),
+      m_replayedMessages(0),
+      m_replayingBacklog(false)
 {
     qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__;
     makeChannelReady(Tp::TextChannel::FeatureMessageQueue
                      | Tp::TextChannel::FeatureMessageSentSignal);
+
+    DaemonStats *stats = DaemonStats::instance();
+    static bool sharedGaugesAdded = false;
+    if (!sharedGaugesAdded) {
+        sharedGaugesAdded = true;
+        stats->addGauge(stats, QStringLiteral("pendingMessageIds"),
+                        [] {
+                            qint64 count = 0;
+                            foreach (const QSet<uint> &ids, m_pendingMessageIds)
+                                count += ids.size();
+                            return count;
+                        });
+    }
+    stats->addGauge(this, QStringLiteral("textChannelListeners"), [] { return qint64(1); });
+    stats->addGauge(this, QStringLiteral("messageQueueDepth"),
+                    [this] { return qint64(m_messageQueue.size()); });
+    stats->addGauge(this, QStringLiteral("pendingCommits"),
+                    [this] { return qint64(m_commitingEvents.size()); });
+    stats->addGauge(this, QStringLiteral("expungeBacklog"),
+                    [this] { return qint64(m_expungeTokens.size()); });
 }
 
 void TextChannelListener::channelListenerReady()
@@ -272,16 +227,7 @@ void TextChannelListener::channelListenerReady()
                  SLOT( slotMessageSent(const Tp::Message&, Tp::MessageSendingFlags, const QString&) ),
                  Qt::UniqueConnection );
 
-        // check if channel is meant to be used for class 0 sms messages
-        QVariantMap properties = textChannel->immutableProperties();
-
-        QVariant property = properties.value(TP_QT_IFACE_CHANNEL_INTERFACE_SMS + QLatin1String(".Flash"), QVariant());
-        if (property.isValid() && property.value<bool>() == true) {
-            qCDebug(lcCommhistoryd) << __FUNCTION__ << "Channel contains class 0 property";
-            m_isClassZeroSMS = true;
-        }
-
-        handleMessages();
+        scheduleMessages();
     } else {
         qCritical() << Q_FUNC_INFO << "Wrong channel - Null";
     }
@@ -301,75 +247,66 @@ bool TextChannelListener::checkStoredMessagesIf()
 void TextChannelListener::requestConversationId()
 {
     if (!m_GroupRequested) {
-        m_GroupModel = NotificationManager::instance()->groupModel();
-        if (m_GroupModel) {
-            m_GroupRequested = true;
-
-            connect(m_GroupModel, SIGNAL(rowsAboutToBeRemoved(const QModelIndex&,int,int)),
-                    SLOT(slotGroupRemoved(const QModelIndex&,int,int)));
-            connect(m_GroupModel, SIGNAL(dataChanged(const QModelIndex&,const QModelIndex&)),
-                    SLOT(slotGroupDataChanged(const QModelIndex&,const QModelIndex&)));
-            connect(m_GroupModel, SIGNAL(rowsInserted(const QModelIndex &, int, int)),
-                    this, SLOT(slotGroupInserted(const QModelIndex &, int, int)));
-
-            if (m_GroupModel->isReady()) {
-                slotOnModelReady(true);
-            } else {
-                connect(m_GroupModel, SIGNAL(modelReady(bool)), SLOT(slotOnModelReady(bool)));
-            }
-        } else {
-            qCritical() << "Failed to create group model";
+        m_GroupRequested = true;
+        m_GroupCache = GroupCache::instance();
+
+        if (m_Account) {
+            // Only changes of this conversation are delivered to the listener
+            m_GroupCache->addObserver(this, m_TargetRecipient);
+
+            // if group exist, read group id right away
+            // otherwise add a new group only when a new message(received/sent) comes
+            updateCurrentGroup();
         }
+
+        channelListenerReady();
     }
 }
 
 TextChannelListener::~TextChannelListener()
 {
+    if (m_GroupCache)
+        m_GroupCache->removeObserver(this);
+    IngestionScheduler::instance()->removeClient(this);
+    if (m_replayingBacklog)
+        NotificationManager::instance()->publishBacklogSummary();
 }
 
-void TextChannelListener::slotGroupDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+void TextChannelListener::groupUpdated(const CommHistory::Group &group)
 {
     if (!m_Group.isValid())
         return;
 
-    if (!topLeft.isValid() || !bottomRight.isValid()) {
-        qWarning() << Q_FUNC_INFO << "Invalid indexes";
-        return;
-    }
-
     bool pendingGroupsHandled = false;
-
-    for (int i = topLeft.row(); i <= bottomRight.row(); i++) {
-        QModelIndex row = m_GroupModel->index(i, 0);
-        CommHistory::Group group = m_GroupModel->group(row);
-        if (group.isValid()) {
-            if (m_pendingGroups.contains(group.id())) {
-                pendingGroupsHandled = true;
-                m_pendingGroups.removeAll(group.id());
-            }
-
-            if (m_Group.id() == group.id())
-                m_Group = group;
-        }
+    if (m_pendingGroups.contains(group.id())) {
+        pendingGroupsHandled = true;
+        m_pendingGroups.removeAll(group.id());
     }
 
+    if (m_Group.id() == group.id())
+        m_Group = group;
+
     if (pendingGroupsHandled)
-        handleMessages();
+        scheduleMessages();
 
     tryToClose();
 }
 
-void TextChannelListener::slotGroupInserted(const QModelIndex &index, int start, int end)
+void TextChannelListener::groupAdded(const CommHistory::Group &group)
 {
-    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Account path handled by this listener: " << m_Account->objectPath();
+    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Account path handled by this listener: " << m_AccountPath;
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Target handled by this listener: " << targetId();
 
-    updateCurrentGroup(start, end, index);
+    // A multi-member group only if there's nothing better
+    if (group.recipients().count() == 1 || !m_Group.isValid()) {
+        setCurrentGroup(group);
+        qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "found new group:" << m_Group.id();
+    }
 }
 
-void TextChannelListener::slotGroupRemoved(const QModelIndex &index, int start, int end)
+void TextChannelListener::groupDeleted(int groupId)
 {
-    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Account path handled by this listener: " << m_Account->objectPath();
+    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Account path handled by this listener: " << m_AccountPath;
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Target handled by this listener: " << targetId();
 
     if (!m_Group.isValid())
@@ -378,14 +315,10 @@ void TextChannelListener::slotGroupRemoved(const QModelIndex &index, int start,
         return;
     }
 
-    for (int i = start; i <= end; i++) {
-        QModelIndex row = m_GroupModel->index(i, 0, index);
-        CommHistory::Group group = m_GroupModel->group(row);
-        if (group == m_Group) {
-            qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Removed group belongs to this listener!";
-            m_Group.setId(-1); // Invalidate the current group in this listener.
-            break;
-        }
+    if (m_Group.id() == groupId) {
+        qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Removed group belongs to this listener!";
+        m_Group.setId(-1); // Invalidate the current group in this listener.
+        m_GroupCache->setObservedGroup(this, -1);
     }
 }
 
@@ -395,14 +328,14 @@ int TextChannelListener::groupId()
     if (!m_Group.isValid()) {
         qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Group is not valid!";
 
-        if (m_GroupModel->isReady()
+        if (m_GroupCache
             && m_Account) { // m_Account not need to be ready
 
             CommHistory::Group group;
-            group.setLocalUid(m_Account->objectPath());
+            group.setLocalUid(m_AccountPath);
 
             qCDebug(lcCommhistoryd) << Q_FUNC_INFO << targetId();
-            group.setRecipients(Recipient(m_Account->objectPath(), targetId()));
+            group.setRecipients(m_TargetRecipient);
 
             if (m_IsGroupChat) {
                 CommHistory::Group::ChatType chatType = CommHistory::Group::ChatTypeP2P;
@@ -417,13 +350,13 @@ int TextChannelListener::groupId()
                     group.setChatName(m_GroupChatName);
             }
 
-            if (!m_GroupModel->addGroup(group)) {
+            if (!m_GroupCache->addGroup(group)) {
 
                 qCritical() << Q_FUNC_INFO << "error adding group";
             }
             else {
 
-                m_Group = group;
+                setCurrentGroup(group);
                 qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "added new group:" << m_Group.id();
             }
         }
@@ -537,291 +470,425 @@ void TextChannelListener::slotGetPropertiesFinished(QDBusPendingCallWatcher *wat
     watcher->deleteLater();
 }
 
-void TextChannelListener::slotOnModelReady(bool status)
-{
-    qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << m_Account->objectPath() << targetId();
-
-    disconnect(m_GroupModel, SIGNAL(modelReady(bool)),
-               this, SLOT(slotOnModelReady(bool)));
-
-    if (!status) {
-        qCritical() << "Group model failed to load";
-        return;
-    }
-
-    // if group exist, read group id right away
-    // otherwise add a new group only when a new message(received/sent) comes
-    const int groupCount = m_GroupModel->rowCount();
-    if (groupCount > 0 && m_Account) {
-        updateCurrentGroup(0, groupCount - 1);
-    }
-
-    channelListenerReady();
-}
-
 void TextChannelListener::slotMessageReceived(const Tp::ReceivedMessage &message)
 {
     Q_UNUSED(message);
     qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__;
 
-    handleMessages();
+    scheduleMessages();
 }
 
 void TextChannelListener::slotPendingMessageRemoved(const Tp::ReceivedMessage &message)
 {
     qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__;
 
-    uint id = pendingId(message);
+    uint id = MessageHeader::pendingId(message.header());
 
     qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Pending message (pending id = " << id << ") having content "
              << message.text() << " acked and removed from channel's message queue.";
 
-    if (m_pendingMessageIds.remove(m_Channel->objectPath(), id) > 0) {
+    QHash<QString, QSet<uint> >::iterator ids = m_pendingMessageIds.find(m_Channel->objectPath());
+    if (ids != m_pendingMessageIds.end() && ids->remove(id)) {
+        if (ids->isEmpty())
+            m_pendingMessageIds.erase(ids);
         qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Removing message from channel " << m_Channel->objectPath()
                  << " having pending id " << id << " from pending messages list of all text channel listeners";
     }
 }
 
-void TextChannelListener::handleMessages()
+void TextChannelListener::scheduleMessages()
+{
+    IngestionScheduler::instance()->schedule(this, m_Account->objectPath());
+}
+
+bool TextChannelListener::ingest(int quota)
 {
-    QList<CommHistory::Event> scrollbackEvents;
-    QList<CommHistory::Event> addEvents;
-    QHash<int, QList<CommHistory::Event> > modifyEvents; // separate list for each group
-    QList<Tp::ReceivedMessage> processedMessages;
-    QList<Tp::ReceivedMessage> addMessages;
-    QHash<int, QList<Tp::ReceivedMessage> > modifyMessages;
-    // expunge tokens for committing events
-    QHash<int, QMultiHash<int, QString> > modifyTokens;
-    bool hasReplaceMessage = false;
+    return handleMessages(quota);
+}
 
-    NotificationManager* nManager = NotificationManager::instance();
+int TextChannelListener::pendingMessages() const
+{
+    return m_messageQueue.size();
+}
+
+bool TextChannelListener::handleMessages(int quota)
+{
+    IngestionMetrics *metrics = IngestionMetrics::instance();
 
     Tp::TextChannelPtr textChannel = Tp::TextChannelPtr::dynamicCast(m_Channel);
     if (!textChannel) {
         qCritical() << "TextChannelListener has non text channel";
-        return;
+        return false;
     }
 
+    QElapsedTimer turn;
+    turn.start();
+
     // Add to our local message queue only those messages that are not yet pending:
-    foreach (Tp::ReceivedMessage me, textChannel->messageQueue()) {
-        uint id = pendingId(me);
-        if (!m_pendingMessageIds.contains(m_Channel->objectPath(), id)) {
-            m_messageQueue << me;
-            m_pendingMessageIds.insertMulti(m_Channel->objectPath(), id);
+    const QList<Tp::ReceivedMessage> channelQueue(textChannel->messageQueue());
+    if (!channelQueue.isEmpty()) {
+        QSet<uint> &pendingIds(m_pendingMessageIds[m_Channel->objectPath()]);
+        foreach (const Tp::ReceivedMessage &me, channelQueue) {
+            const MessageHeader header(me);
+            uint id = header.pendingMessageId;
+            if (pendingIds.contains(id))
+                continue;
+
+            // class 0 is a property of the channel rather than of the message
+            m_messageQueue.append(me, m_isClassZeroSMS ? PendingMessageQueue::Urgent
+                                                       : PendingMessageQueue::lane(me, header));
+            pendingIds.insert(id);
+            if (me.isRescued() || me.isScrollback())
+                m_replayedMessages++;
+            metrics->begin(me.messageToken());
+            FlightRecorder::instance()->record(FlightRecorder::MessageReceived, 0,
+                                               me.messageToken(), me.messageType());
         }
     }
 
     qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Number of messages in local message queue: " << m_messageQueue.size();
 
-    foreach(Tp::ReceivedMessage message, m_messageQueue) {
-        CommHistory::Event event;
-        Tp::ChannelTextMessageType type = message.messageType();
-        bool wait = false;
-
-        qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Handling message from channel " << m_Channel->objectPath()
-                 << " with content " << message.text() << " and with pending id " << pendingId(message);
-
-        switch (type) {
-        case Tp::ChannelTextMessageTypeDeliveryReport: {
-            DeliveryHandlingStatus status = handleDeliveryReport(message, event);
-            switch (status) {
-            case DeliveryHandlingResolved:
-                if (m_pendingGroups.contains(event.groupId())) {
-                    wait = true;
-                    break;
-                }
+    // Many replayed messages (rescued after the daemon was restarted, or
+    // scrollback) are logged without a popup for each message, see
+    // publishBacklogSummary() below. A burst of new messages is not a backlog.
+    if (m_replayedMessages >= MESSAGE_BACKLOG_THRESHOLD)
+        m_replayingBacklog = true;
+
+    // Lanes are handled in priority order, each with its own commit
+    int handled = 0;
+    bool yielded = false;
+    bool progress = false;
+    for (int i = 0; i < PendingMessageQueue::LaneCount && !yielded; i++) {
+        const PendingMessageQueue::Lane lane = PendingMessageQueue::Lane(i);
+        MessageBatch batch;
+
+        for (PendingMessageQueue::const_iterator it = m_messageQueue.begin(lane);
+             it != m_messageQueue.end(lane); ++it) {
+            // Still queued after an earlier turn, e.g. a replace type SMS
+            // or a failed commit; don't log and notify it again
+            const uint pendingId = PendingMessageQueue::pendingId(*it);
+            if (m_handedOffIds.contains(pendingId))
+                continue;
+
+            // Commit what we have and continue on the next event loop turn,
+            // so that a backlog does not block the daemon. The quota from
+            // IngestionScheduler caps the adaptive chunk size.
+            if (handled >= qMin(quota, m_chunkSize)
+                || (handled > 0 && turn.elapsed() >= MESSAGE_HANDLING_BUDGET)) {
+                yielded = true;
+                break;
+            }
 
-                if (event.isValid()) {
-                    int groupId = event.groupId();
-                    modifyEvents[groupId] << event;
-                    modifyMessages[groupId] << message;
+            // The rest of the lane waits for this message
+            if (!handleMessage(*it, batch))
+                break;
+            m_handedOffIds.insert(pendingId);
+            handled++;
+        }
 
-                    QString token = message.messageToken();
-                    if (token.isEmpty())
-                        token = event.messageToken();
+        commitBatch(batch, lane);
+        if (!batch.processedMessages.isEmpty())
+            progress = true;
+    }
 
-                    modifyTokens[groupId].insertMulti(event.id(), token);
+    // Keep each turn within the budget, but do not make tiny commits
+    // when the messages are cheap to handle
+    const qint64 elapsed = turn.elapsed();
+    if (elapsed > MESSAGE_HANDLING_BUDGET)
+        m_chunkSize = qMax(MESSAGE_CHUNK_MIN, m_chunkSize / 2);
+    else if (yielded && elapsed < MESSAGE_HANDLING_BUDGET / 2)
+        m_chunkSize = qMin(MESSAGE_CHUNK_MAX, m_chunkSize * 2);
 
-                } else {
-                    qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Ignoring recovered message from delivery echo";
-                }
+    // Continue only if this turn made progress, otherwise wait for the
+    // next change like before
+    if (yielded && progress)
+        return true;
 
-                break;
-            case DeliveryHandlingFailed:
-                expungeMessage(message.messageToken());
-                processedMessages << message;
-                break;
-            case DeliveryHandlingPending:
+    // Failed commits are retried with the next change, like before; replace
+    // type SMS wait for the conversation model
+    m_handedOffIds.clear();
+    foreach (const Tp::ReceivedMessage &message, m_replaceMessages)
+        m_handedOffIds.insert(PendingMessageQueue::pendingId(message));
+
+    m_replayedMessages = 0;
+    if (m_replayingBacklog) {
+        m_replayingBacklog = false;
+        NotificationManager::instance()->publishBacklogSummary();
+    }
+    return false;
+}
+
+bool TextChannelListener::handleMessage(const Tp::ReceivedMessage &message, MessageBatch &batch)
+{
+    NotificationManager* nManager = NotificationManager::instance();
+    CommHistory::Event event;
+    Tp::ChannelTextMessageType type = message.messageType();
+    const MessageHeader header(message);
+    bool wait = false;
+
+    qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Handling message from channel " << m_Channel->objectPath()
+             << " with content " << message.text() << " and with pending id " << header.pendingMessageId;
+
+    switch (type) {
+    case Tp::ChannelTextMessageTypeDeliveryReport: {
+        DeliveryHandlingStatus status = handleDeliveryReport(message, header, event);
+        switch (status) {
+        case DeliveryHandlingResolved:
+            if (m_pendingGroups.contains(event.groupId())) {
                 wait = true;
                 break;
-            default:
-                qCritical() << "Unknown DeliveryHandlingStatus" << status;
             }
+
+            if (event.isValid()) {
+                FlightRecorder::instance()->record(FlightRecorder::DeliveryReport, event.id(),
+                                                   message.messageToken(), event.status());
+                int groupId = event.groupId();
+                batch.modifyEvents[groupId] << event;
+                batch.modifyMessages[groupId] << message;
+
+                QString token = message.messageToken();
+                if (token.isEmpty())
+                    token = event.messageToken();
+
+                batch.modifyTokens[groupId].insertMulti(event.id(), token);
+
+            } else {
+                qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Ignoring recovered message from delivery echo";
+            }
+
+            break;
+        case DeliveryHandlingFailed:
+            expungeMessage(message.messageToken());
+            batch.processedMessages << message;
+            break;
+        case DeliveryHandlingPending:
+            wait = true;
             break;
+        default:
+            qCritical() << "Unknown DeliveryHandlingStatus" << status;
         }
-        case Tp::ChannelTextMessageTypeNormal: {
-            // fills event properties
-            handleReceivedMessage(message, event);
-
-            QString replaceTypeValue = replaceType(message.header());
-
-            // class 0 sms
-            if (m_isClassZeroSMS) {
-                qCDebug(lcCommhistoryd) << __FUNCTION__ << "Handling class 0 sms";
-                processedMessages << message;
-                nManager->playClass0SMSAlert();
-                nManager->requestClass0Notification(event);
-                expungeMessage(event.messageToken());
-            // Replace sms
-            } else if (!replaceTypeValue.isEmpty()) {
-                qCDebug(lcCommhistoryd) << __FUNCTION__ << "Replace type of sms";
-                m_replaceEvents << event;
-                m_replaceMessages << message;
-                hasReplaceMessage = true;
-                if (event.direction() != CommHistory::Event::Outbound) {
-                    nManager->showNotification(event, targetId(), m_Group.chatType());
-                }
-              // Normal sms
-            } else {
-                QString supersedes = supersedesToken(message.header());
-                bool silent = message.isSilent();
-
-                if (!supersedes.isEmpty()) {
-                    CommHistory::Event originalEvent;
-                    getEventForToken(supersedes, QString(), m_Group.id(), originalEvent);
-                    if (!originalEvent.isValid()) {
-                        // handle as a new message
-                        // use original's message token to be able to handle updates
-                        // for this message
-                        event.setMessageToken(supersedes);
-                        addEvents << event;
-                        addMessages << message;
-                        if (!silent) {
-                            nManager->showNotification(event, targetId(), m_Group.chatType());
-                        }
-                    } else {
-                        //update message
-                        originalEvent.setFreeText(event.freeText());
-                        originalEvent.setStartTime(event.startTime());
-                        if (originalEvent.isRead())
-                            originalEvent.setIsRead(false);
-
-                        modifyEvents[event.groupId()] << originalEvent;
-                        modifyMessages[event.groupId()] << message;
-                        modifyTokens[event.groupId()].insertMulti(originalEvent.id(),originalEvent.messageToken());
-
-                        if (!silent) {
-                            nManager->showNotification(originalEvent, targetId(), m_Group.chatType());
-                        }
+        break;
+    }
+    case Tp::ChannelTextMessageTypeNormal: {
+        // fills event properties
+        handleReceivedMessage(message, header, event);
+
+        // class 0 sms
+        if (m_isClassZeroSMS) {
+            qCDebug(lcCommhistoryd) << __FUNCTION__ << "Handling class 0 sms";
+            batch.processedMessages << message;
+            nManager->playClass0SMSAlert();
+            nManager->requestClass0Notification(event);
+            expungeMessage(event.messageToken());
+        // Replace sms
+        } else if (!header.replaceType.isEmpty()) {
+            qCDebug(lcCommhistoryd) << __FUNCTION__ << "Replace type of sms";
+            m_replaceEvents << event;
+            m_replaceMessages << message;
+            batch.hasReplaceMessage = true;
+            if (event.direction() != CommHistory::Event::Outbound) {
+                showMessageNotification(event);
+            }
+          // Normal sms
+        } else {
+            const QString &supersedes(header.supersedes);
+            bool silent = message.isSilent();
+
+            if (!supersedes.isEmpty()) {
+                CommHistory::Event originalEvent;
+                getEventForToken(supersedes, QString(), m_Group.id(), originalEvent);
+                if (!originalEvent.isValid()) {
+                    // handle as a new message
+                    // use original's message token to be able to handle updates
+                    // for this message
+                    event.setMessageToken(supersedes);
+                    batch.addEvents << event;
+                    batch.addMessages << message;
+                    if (!silent) {
+                        showMessageNotification(event);
                     }
                 } else {
-                    if (message.isScrollback()) {
-                        scrollbackEvents << event;
-                    } else {
-                        addEvents << event;
+                    //update message
+                    originalEvent.setFreeText(event.freeText());
+                    originalEvent.setStartTime(event.startTime());
+                    if (originalEvent.isRead())
+                        originalEvent.setIsRead(false);
+
+                    batch.modifyEvents[event.groupId()] << originalEvent;
+                    batch.modifyMessages[event.groupId()] << message;
+                    batch.modifyTokens[event.groupId()].insertMulti(originalEvent.id(),originalEvent.messageToken());
+
+                    if (!silent) {
+                        showMessageNotification(originalEvent);
                     }
-                    addMessages << message;
+                }
+            } else if (isDuplicate(message, event)) {
+                expungeMessage(message.messageToken());
+                batch.processedMessages << message;
+            } else {
+                if (message.isScrollback()) {
+                    batch.scrollbackEvents << event;
+                } else {
+                    batch.addEvents << event;
+                }
+                batch.addMessages << message;
 
-                    if (event.direction() != CommHistory::Event::Outbound) {
-                        if (!silent) {
-                            nManager->showNotification(event, targetId(), m_Group.chatType());
-                        }
+                if (event.direction() != CommHistory::Event::Outbound) {
+                    if (!silent) {
+                        showMessageNotification(event);
                     }
                 }
             }
-            break;
         }
-        case Tp::ChannelTextMessageTypeNotice: {
-            // Telepathy can add a new type for mailbox notification in future
-            Tp::MessagePart header = message.header();
-            if (isVoicemail(header)) {
-                QString type = voicemailType(header);
-
-                if (type == PROTOCOL_TEL) {
-                    int unread = 0;
-
-                    if (mailboxHasUnread(header)) {
-                        unread = mailboxUnreadCount(message.header());
-                        if (unread == 0)
-                            unread = -1; // set count to -1 if unread flag is set
-                                         // but count is not available
-                                         // as requiried by USIM MWI notation
-                    }
-
-                    nManager->showVoicemailNotification(unread);
+        break;
+    }
+    case Tp::ChannelTextMessageTypeNotice: {
+        // Telepathy can add a new type for mailbox notification in future
+        if (header.voicemail) {
+            if (header.voicemailType == PROTOCOL_TEL) {
+                int unread = 0;
+
+                if (header.mailboxHasUnread) {
+                    unread = header.mailboxUnreadCount;
+                    if (unread == 0)
+                        unread = -1; // set count to -1 if unread flag is set
+                                     // but count is not available
+                                     // as requiried by USIM MWI notation
                 }
-                // TODO skype voicemail support
+
+                nManager->showVoicemailNotification(unread);
             }
+            // TODO skype voicemail support
+        }
+        expungeMessage(message.messageToken());
+        batch.processedMessages << message;
+        break;
+    }
+    case Tp::ChannelTextMessageTypeAction: {
+        handleReceivedMessage(message, header, event);
+        event.setIsAction(true);
+
+        if (isDuplicate(message, event)) {
             expungeMessage(message.messageToken());
-            processedMessages << message;
+            batch.processedMessages << message;
             break;
         }
-        case Tp::ChannelTextMessageTypeAction: {
-            handleReceivedMessage(message, event);
-            event.setIsAction(true);
-
-            if (message.isScrollback()) {
-                scrollbackEvents << event;
-            } else {
-                addEvents << event;
-            }
-            addMessages << message;
 
-            if (event.direction() != CommHistory::Event::Outbound) {
-                nManager->showNotification(event, targetId(), m_Group.chatType());
-            }
-        break;
-        }
-        default:
-            qCDebug(lcCommhistoryd) << "onMessageReceived: type " << type << " not supported";
-            break;
+        if (message.isScrollback()) {
+            batch.scrollbackEvents << event;
+        } else {
+            batch.addEvents << event;
         }
+        batch.addMessages << message;
 
-        if (wait)
-            break;
+        if (event.direction() != CommHistory::Event::Outbound) {
+            showMessageNotification(event);
+        }
+    break;
     }
+    default:
+        qCDebug(lcCommhistoryd) << "onMessageReceived: type " << type << " not supported";
+        break;
+    }
+
+
+    return !wait;
+}
 
-    if (!scrollbackEvents.isEmpty()) {
-        if (eventModel().addEvents(scrollbackEvents, true)) {
-            processedMessages << addMessages;
+void TextChannelListener::commitBatch(MessageBatch &batch, PendingMessageQueue::Lane lane)
+{
+    static const IngestionMetrics::Stage laneStages[PendingMessageQueue::LaneCount] = {
+        IngestionMetrics::Urgent,
+        IngestionMetrics::Inbound,
+        IngestionMetrics::Delivery,
+        IngestionMetrics::Scrollback
+    };
+
+    IngestionMetrics *metrics = IngestionMetrics::instance();
+
+    foreach (const Tp::ReceivedMessage &message, batch.addMessages)
+        metrics->mark(message.messageToken(), IngestionMetrics::Queue);
+
+    if (!batch.scrollbackEvents.isEmpty()) {
+        if (eventModel().addEvents(batch.scrollbackEvents, true)) {
+            batch.processedMessages << batch.addMessages;
+            foreach (const CommHistory::Event &e, batch.scrollbackEvents)
+                DuplicateFilter::instance()->add(e);
         } else {
             qWarning() << "Adding events failed";
         }
     }
 
-    if (!addEvents.isEmpty()) {
-        if (eventModel().addEvents(addEvents)) {
-            processedMessages << addMessages;
-            foreach (CommHistory::Event e, addEvents)
+    if (!batch.addEvents.isEmpty()) {
+        bool added;
+        {
+            IngestionSpan span(IngestionMetrics::Store);
+            DatabaseQueryTimer queryTimer;
+            added = eventModel().addEvents(batch.addEvents);
+        }
+        if (added) {
+            batch.processedMessages << batch.addMessages;
+            foreach (CommHistory::Event e, batch.addEvents) {
                 m_EventTokens.insertMulti(e.id(), e.messageToken());
+                FlightRecorder::instance()->record(FlightRecorder::EventAdded, e.id(), e.messageToken());
+                DuplicateFilter::instance()->add(e);
+            }
         } else {
             qWarning() << "Adding events failed";
         }
     }
 
-    if (hasReplaceMessage) {
+    if (batch.hasReplaceMessage) {
         if (conversationModel().isReady())
             conversationModel().getEvents(m_Group.id());
     }
 
-    if (!modifyEvents.isEmpty()) {
+    if (!batch.modifyEvents.isEmpty()) {
         QHash<int, QList<CommHistory::Event> >::iterator i;
-        for (i = modifyEvents.begin(); i != modifyEvents.end(); ++i) {
+        for (i = batch.modifyEvents.begin(); i != batch.modifyEvents.end(); ++i) {
             CommHistory::Group group = getGroupById(i.key());
-            if (group.isValid() && eventModel().modifyEventsInGroup(i.value(), group)) {
-                processedMessages << modifyMessages[i.key()];
-                m_EventTokens += modifyTokens[i.key()];
+            bool modified;
+            {
+                DatabaseQueryTimer queryTimer;
+                modified = group.isValid() && eventModel().modifyEventsInGroup(i.value(), group);
+            }
+            if (modified) {
+                batch.processedMessages << batch.modifyMessages[i.key()];
+                m_EventTokens += batch.modifyTokens[i.key()];
             } else {
                 qWarning() << "Modify events failed for group" << i.key();
             }
         }
     }
 
-    foreach (Tp::ReceivedMessage message, processedMessages) {
-        m_messageQueue.removeOne(message);
+    foreach (const Tp::ReceivedMessage &message, batch.processedMessages) {
+        metrics->record(message.messageToken(), laneStages[lane]);
+        m_messageQueue.remove(message);
     }
 }
 
+bool TextChannelListener::isDuplicate(const Tp::ReceivedMessage &message,
+                                      const CommHistory::Event &event)
+{
+    // Without a sent time the start time is when we received the message,
+    // which doesn't identify a retransmission
+    if (!DuplicateFilter::instance()->isDuplicate(event, message.sent().isValid()))
+        return false;
+
+    qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "Ignoring already logged message"
+                            << message.messageToken() << "in group" << event.groupId();
+    return true;
+}
+
+void TextChannelListener::showMessageNotification(const CommHistory::Event &event)
+{
+    NotificationManager *nManager = NotificationManager::instance();
+    if (m_replayingBacklog)
+        nManager->showBacklogNotification(event, targetId(), m_Group.chatType());
+    else
+        nManager->showNotification(event, targetId(), m_Group.chatType());
+}
+
 CommHistory::ConversationModel& TextChannelListener::conversationModel()
 {
     if (!m_pConversationModel) {
@@ -857,7 +924,7 @@ void TextChannelListener::slotConvModelReady(bool success)
             qWarning() << "Adding replace type of event failed!";
         }
 
-        m_messageQueue.removeOne(m_replaceMessages.takeFirst());
+        m_messageQueue.remove(m_replaceMessages.takeFirst());
     }
 }
 
@@ -900,22 +967,19 @@ void TextChannelListener::slotConvEventsCommitted(const QList<CommHistory::Event
     slotConvModelReady(true);
 }
 
-bool TextChannelListener::recoverDeliveryEcho(const Tp::Message &message,
+bool TextChannelListener::recoverDeliveryEcho(const MessageHeader &header,
                                               CommHistory::Event &event)
 {
     bool result = false;
-    QVariant echoVar = message.header().value(DELIVERY_ECHO).variant();
+    const Tp::MessagePartList &parts(header.deliveryEcho);
 
-    if (echoVar.isValid()) {
-        Tp::MessagePartList parts = qdbus_cast<Tp::MessagePartList>(echoVar);
-        if (parts.size() > 1) { // first one is header
-            QString contentType = parts[1].value(PART_CONTENT_TYPE).variant().toString();
-            QString content = parts[1].value(PART_CONTENT).variant().toString();
+    if (parts.size() > 1) { // first one is header
+        QString contentType = parts[1].value(PART_CONTENT_TYPE).variant().toString();
+        QString content = parts[1].value(PART_CONTENT).variant().toString();
 
-            if (contentType == TXT_CONTENT_TYPE) {
-                event.setFreeText(content.trimmed());
-                result = true;
-            }
+        if (contentType == TXT_CONTENT_TYPE) {
+            event.setFreeText(content.trimmed());
+            result = true;
         }
     }
 
@@ -931,6 +995,7 @@ bool TextChannelListener::getEventForToken(const QString &token,
     model.setQueryMode(CommHistory::SingleEventModel::SyncQuery);
     model.setPropertyMask(deliveryHandlingProperties);
 
+    DatabaseQueryTimer queryTimer;
     if (model.getEventByTokens(token, mmsId, groupId)) {
         if (model.rowCount() > 0)
             event = model.event();
@@ -946,6 +1011,7 @@ bool TextChannelListener::getEventById(int eventId, CommHistory::Event &event)
     CommHistory::SingleEventModel model;
     model.setQueryMode(CommHistory::SingleEventModel::SyncQuery);
 
+    DatabaseQueryTimer queryTimer;
     if (model.getEventById(eventId)) {
         if (model.rowCount() > 0)
             event = model.event();
@@ -957,6 +1023,7 @@ bool TextChannelListener::getEventById(int eventId, CommHistory::Event &event)
 }
 
 TextChannelListener::DeliveryHandlingStatus TextChannelListener::handleDeliveryReport(const Tp::ReceivedMessage &message,
+                                                                                      const MessageHeader &header,
                                                                                       CommHistory::Event &event)
 {
     DeliveryHandlingStatus result = DeliveryHandlingFailed;
@@ -968,15 +1035,9 @@ TextChannelListener::DeliveryHandlingStatus TextChannelListener::handleDeliveryR
     }
 
     // if we find message with the same token, update its status
-    Tp::MessagePart header = message.header();
-    QVariant tokenVar = header.value(DELIVERY_TOKEN).variant();
-
-    QString deliveryToken;
-    if (tokenVar.isValid()) {
-        deliveryToken = tokenVar.value<QString>();
-    } else {
+    const QString &deliveryToken(header.deliveryToken);
+    if (deliveryToken.isEmpty())
         qWarning() << "[DELIVERY] Cannot fetch delivery token";
-    }
 
     qCDebug(lcCommhistoryd) << "[DELIVERY] Message token is: " << deliveryToken;
 
@@ -985,9 +1046,6 @@ TextChannelListener::DeliveryHandlingStatus TextChannelListener::handleDeliveryR
         return DeliveryHandlingPending;
     }
 
-    // get status
-    QVariant status = header.value(DELIVERY_STATUS).variant();
-
     bool messageFound = false;
     if (!deliveryToken.isEmpty()) {
         if (!getEventForToken(deliveryToken, QString(), m_Group.id(), event))
@@ -998,17 +1056,17 @@ TextChannelListener::DeliveryHandlingStatus TextChannelListener::handleDeliveryR
     // echo recovery
     if (!messageFound) {
         result = DeliveryHandlingFailed;
-        messageFound = recoverDeliveryEcho(message, event);
+        messageFound = recoverDeliveryEcho(header, event);
         if (messageFound) {
             event.setMessageToken(deliveryToken);
-            event.setType(eventType());
-            event.setLocalUid(m_Account->objectPath());
+            event.setType(m_EventType);
+            event.setLocalUid(m_AccountPath);
             if (!m_isClassZeroSMS) {
                 event.setGroupId(groupId());
             }
             event.setIsRead(true);
             event.setDirection(CommHistory::Event::Outbound);
-            event.setRecipients(Recipient(m_Account->objectPath(), targetId()));
+            event.setRecipients(m_TargetRecipient);
 
             QDateTime sentTime = QDateTime::currentDateTime();
             event.setStartTime(sentTime);
@@ -1029,8 +1087,8 @@ TextChannelListener::DeliveryHandlingStatus TextChannelListener::handleDeliveryR
     qCDebug(lcCommhistoryd) << "[DELIVERY] Event match: id:" << event.id()
              << "token:" << event.messageToken();
 
-    // If variant is not valid, then we cant update status
-    if (!status.isValid())
+    // If there's no status, then we cant update it
+    if (!header.hasDeliveryStatus)
         return result;
 
     QDateTime deliveryTime;
@@ -1041,7 +1099,7 @@ TextChannelListener::DeliveryHandlingStatus TextChannelListener::handleDeliveryR
     else
         deliveryTime = QDateTime::currentDateTime();
 
-    int deliveryStatus = status.value<int>();
+    int deliveryStatus = header.deliveryStatus;
     qCDebug(lcCommhistoryd) << "[DELIVERY] Message delivery status: " << deliveryStatus;
 
     switch (deliveryStatus) {
@@ -1067,7 +1125,7 @@ TextChannelListener::DeliveryHandlingStatus TextChannelListener::handleDeliveryR
         } else {
             event.setStatus(CommHistory::Event::TemporarilyFailedStatus);
         }
-        handleMessageFailed(message, event);
+        handleMessageFailed(message, header, event);
 
         break;
     }
@@ -1110,6 +1168,7 @@ bool TextChannelListener::areRemotePartiesOffline()
 }
 
 void TextChannelListener::handleMessageFailed(const Tp::ReceivedMessage &message,
+                                              const MessageHeader &header,
                                               const CommHistory::Event &event)
 {
     qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << "message type:" << message.messageType();
@@ -1118,11 +1177,10 @@ void TextChannelListener::handleMessageFailed(const Tp::ReceivedMessage &message
     if (message.messageType() == Tp::ChannelTextMessageTypeDeliveryReport) {
 
         // see if the message is actually an error message
-        Tp::MessagePart part = message.header();
-        int status = part.value(DELIVERY_STATUS).variant().toInt();
-        QString messageToken = part.value(DELIVERY_TOKEN).variant().toString();
-        QString dbusError = part.value(DELIVERY_DBUSERROR).variant().toString();
-        QString errorMessage = part.value(DELIVERY_ERRORMESSAGE).variant().toString();
+        int status = header.deliveryStatus;
+        const QString &messageToken(header.deliveryToken);
+        const QString &dbusError(header.deliveryDBusError);
+        const QString &errorMessage(header.deliveryErrorMessage);
 
         qCDebug(lcCommhistoryd) << "status:"        << status
                  << "message token:" << messageToken
@@ -1190,35 +1248,47 @@ void TextChannelListener::handleMessageFailed(const Tp::ReceivedMessage &message
     }
 }
 
-CommHistory::Event::EventType TextChannelListener::eventType() const
+void TextChannelListener::initChannelContext()
 {
-    CommHistory::Event::EventType type = CommHistory::Event::UnknownType;
-    if (m_Account->protocolName() == PROTOCOL_TEL) {
-        if (m_isClassZeroSMS) {
-            type = CommHistory::Event::ClassZeroSMSEvent;
+    // Nothing of this changes during the lifetime of the channel
+    const QVariantMap properties = m_Channel->immutableProperties();
+
+    // check if channel is meant to be used for class 0 sms messages
+    QVariant property = properties.value(TP_QT_IFACE_CHANNEL_INTERFACE_SMS + QLatin1String(".Flash"), QVariant());
+    if (property.isValid() && property.value<bool>() == true) {
+        qCDebug(lcCommhistoryd) << __FUNCTION__ << "Channel contains class 0 property";
+        m_isClassZeroSMS = true;
+    }
+
+    m_SubscriberId = properties.value(SUBSCRIBER_ID_PROPERTY_NAME).toString();
+
+    if (m_Account) {
+        m_AccountPath = m_Account->objectPath();
+        m_TargetRecipient = Recipient(m_AccountPath, targetId());
+
+        if (m_Account->protocolName() == PROTOCOL_TEL) {
+            m_EventType = m_isClassZeroSMS ? CommHistory::Event::ClassZeroSMSEvent
+                                           : CommHistory::Event::SMSEvent;
         } else {
-            type = CommHistory::Event::SMSEvent;
+            m_EventType = CommHistory::Event::IMEvent;
         }
-    } else {
-        type = CommHistory::Event::IMEvent;
     }
-    return type;
 }
 
 void TextChannelListener::fillEventFromMessage(const Tp::Message &message,
+                                               const MessageHeader &header,
                                                CommHistory::Event &event)
 {
-    event.setType(eventType());
+    event.setType(m_EventType);
 
     // Check for possible sms-replace-number header in Tp::Message:
-    QString replaceTypeString = replaceType(message.header());
-    if (!replaceTypeString.isEmpty()) {
+    if (!header.replaceType.isEmpty()) {
         QHash<QString, QString> replaceTypeHeader;
-        replaceTypeHeader.insert(REPLACE_TYPE, replaceTypeString);
+        replaceTypeHeader.insert(REPLACE_TYPE, header.replaceType);
         event.setHeaders(replaceTypeHeader);
     }
 
-    event.setLocalUid(m_Account->objectPath());
+    event.setLocalUid(m_AccountPath);
     event.setFreeText(message.text().trimmed());
 
     // do not set / create group id for class0 messages
@@ -1228,6 +1298,7 @@ void TextChannelListener::fillEventFromMessage(const Tp::Message &message,
 }
 
 void TextChannelListener::handleReceivedMessage(const Tp::ReceivedMessage &message,
+                                                const MessageHeader &header,
                                                 CommHistory::Event &event)
 {
     QString remoteId;
@@ -1249,10 +1320,10 @@ void TextChannelListener::handleReceivedMessage(const Tp::ReceivedMessage &messa
     }
 
     qCDebug(lcCommhistoryd) << "Handling received message: " << remoteId << (fromSelf ? "<-" : "->")
-             << m_Account->objectPath() << messageText;
+             << m_AccountPath << messageText;
 
-    fillEventFromMessage(message, event);
-    event.setRecipients(Recipient(m_Account->objectPath(), remoteId));
+    fillEventFromMessage(message, header, event);
+    event.setRecipients(remoteId == targetId() ? m_TargetRecipient : Recipient(m_AccountPath, remoteId));
 
     if (fromSelf) {
         event.setDirection(CommHistory::Event::Outbound);
@@ -1283,10 +1354,8 @@ void TextChannelListener::handleReceivedMessage(const Tp::ReceivedMessage &messa
     event.setMessageToken(message.messageToken());
     qCDebug(lcCommhistoryd) << "Message token is: " << message.messageToken();
 
-    const Tp::MessagePart &header(message.header());
-    const QString subscriberId(subscriberIdentity(header));
-    if (!subscriberId.isEmpty())
-        event.setSubscriberIdentity(subscriberId);
+    if (!header.subscriberIdentity.isEmpty())
+        event.setSubscriberIdentity(header.subscriberIdentity);
 }
 
 void TextChannelListener::slotMessageSent(const Tp::Message &message,
@@ -1294,22 +1363,23 @@ void TextChannelListener::slotMessageSent(const Tp::Message &message,
                                         const QString &messageToken)
 {
     QString messageText = message.text();
-    QString remoteUid = targetId();
+    const QString &remoteUid(targetId());
 
     if (remoteUid.isEmpty())
         qCritical() << "Empty target id";
 
-    int existingEventId = message.header().value("x-commhistory-event-id", QDBusVariant(-1)).variant().toInt();
-    qCDebug(lcCommhistoryd) << "Handling sent message: " << m_Account->objectPath() << "->" << remoteUid << messageText;
+    const MessageHeader header(message);
+    int existingEventId = header.existingEventId;
+    qCDebug(lcCommhistoryd) << "Handling sent message: " << m_AccountPath << "->" << remoteUid << messageText;
 
     CommHistory::Event event;
     if (existingEventId >= 0 && getEventById(existingEventId, event) && event.isValid()) {
         qCDebug(lcCommhistoryd) << "Sent message has an existing event" << existingEventId;
     } else {
-        fillEventFromMessage(message, event);
+        fillEventFromMessage(message, header, event);
         event.setIsRead(true);
         event.setDirection(CommHistory::Event::Outbound);
-        event.setRecipients(Recipient(m_Account->objectPath(), remoteUid));
+        event.setRecipients(m_TargetRecipient);
         if (message.messageType() == Tp::ChannelTextMessageTypeAction)
             event.setIsAction(true);
     }
@@ -1327,13 +1397,10 @@ void TextChannelListener::slotMessageSent(const Tp::Message &message,
     event.setMessageToken(messageToken);
     qCDebug(lcCommhistoryd) << "Message token is: " << messageToken;
 
-    const QVariantMap properties = m_Channel->immutableProperties();
-    const QVariant &siProp = properties.value(SUBSCRIBER_ID_PROPERTY_NAME);
-    if (siProp.isValid()) {
-        event.setSubscriberIdentity(siProp.toString());
-    }
+    if (!m_SubscriberId.isEmpty())
+        event.setSubscriberIdentity(m_SubscriberId);
 
-    if (m_Account->protocolName() == PROTOCOL_TEL) {
+    if (m_EventType != CommHistory::Event::IMEvent) {
         // Flag the message as Sending-in-progress
         event.setStatus(CommHistory::Event::SendingStatus);
     } else {
@@ -1409,13 +1476,13 @@ void TextChannelListener::updateGroupChatName(ChangedChannelProperty changedChan
             qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "updating group chat name...";
             m_Group.setChatName(m_GroupChatName);
 
-            if (m_GroupModel) {
+            if (m_GroupCache) {
 
                 // Group is already in the database
                 CommHistory::Group modGroup;
                 modGroup.setId(m_Group.id());
                 modGroup.setChatName(m_Group.chatName());
-                if (!m_GroupModel->modifyGroup(modGroup))
+                if (!m_GroupCache->modifyGroup(modGroup))
                     qCritical() << "failed to modify group in database";
 
                 if (suppressGroupChatEvents) {
@@ -1478,7 +1545,7 @@ void TextChannelListener::sendGroupChatEvent(const QString &message)
     event.setType( CommHistory::Event::StatusMessageEvent );
     event.setDirection( CommHistory::Event::Inbound );
     event.setGroupId( m_Group.id() );
-    event.setLocalUid( m_Account->objectPath() );
+    event.setLocalUid( m_AccountPath );
     event.setFreeText( message );
     event.setStartTime( QDateTime::currentDateTime() );
     event.setEndTime( QDateTime::currentDateTime() );
@@ -1490,43 +1557,16 @@ void TextChannelListener::sendGroupChatEvent(const QString &message)
      }
 }
 
-void TextChannelListener::updateCurrentGroup(int start, int end, const QModelIndex &parent)
+void TextChannelListener::updateCurrentGroup()
 {
-    qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__ << start << end;
-
-    const Recipient recipient(m_Account->objectPath(), targetId());
-    int fallbackRow = -1;
-    int row = start;
-    for ( ; row <= end; row++) {
-        const QModelIndex &index = m_GroupModel->index(row, 0, parent);
-        const CommHistory::Group &group = m_GroupModel->group(index);
-
-        qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Inserted group's account: " << group.localUid();
-        qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "Inserted group's first target: " << group.recipients().value(0).remoteUid();
+    qCDebug(lcCommhistoryd) << __PRETTY_FUNCTION__;
 
-        if (group.isValid()) {
-            const CommHistory::RecipientList &recipients = group.recipients();
-            if (recipients.count() > 1) {
-                qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "has multiple recipients" << recipients.count();
-                // This is a multi-member group; prefer to continue searching for an exact match
-                if (fallbackRow == -1 && recipients.containsMatch(recipient)) {
-                    qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "set fallbackRow" << fallbackRow;
-                    fallbackRow = row;
-                }
-            } else if (recipients.containsMatch(recipient)) {
-                m_Group = group;
-                qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "found existing group:" << m_Group.id();
-                break;
-            }
-        }
-    }
-    if (row == end) {
-        if (fallbackRow != -1) {
-            m_Group = m_GroupModel->group(m_GroupModel->index(fallbackRow, 0));
-            qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "found existing multi-member group:" << m_Group.id();
-        } else {
-            qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "no existing group found for targetId:" << targetId();
-        }
+    const CommHistory::Group group(m_GroupCache->findGroup(m_TargetRecipient));
+    if (group.isValid()) {
+        setCurrentGroup(group);
+        qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "found existing group:" << m_Group.id();
+    } else {
+        qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "no existing group found for targetId:" << targetId();
     }
 }
 
@@ -1538,8 +1578,12 @@ void TextChannelListener::slotEventsCommitted(QList<CommHistory::Event> events,
     foreach (CommHistory::Event e, events) {
         if (m_EventTokens.contains(e.id())) {
             QString token = m_EventTokens.values(e.id()).last();
-            if (status)
+            if (status) {
+                IngestionMetrics::instance()->mark(token, IngestionMetrics::Commit);
                 expungeMessage(token);
+            }
+            FlightRecorder::instance()->record(status ? FlightRecorder::EventCommitted
+                                                      : FlightRecorder::CommitFailed, e.id(), token);
             m_EventTokens.remove(e.id(), token);
         }
         if (m_commitingEvents.remove(e.messageToken()))
@@ -1564,7 +1608,7 @@ void TextChannelListener::slotEventsCommitted(QList<CommHistory::Event> events,
 
     // handle delivery reports pending for event commits
     if (removed)
-        handleMessages();
+        scheduleMessages();
 
     tryToClose();
 }
@@ -1591,6 +1635,13 @@ void TextChannelListener::slotExpungeMessages()
     if (storedMessages) {
         qCDebug(lcCommhistoryd) << Q_FUNC_INFO << m_expungeTokens;
         storedMessages->ExpungeMessages(m_expungeTokens);
+
+        IngestionMetrics *metrics = IngestionMetrics::instance();
+        foreach (const QString &token, m_expungeTokens) {
+            metrics->mark(token, IngestionMetrics::Expunge);
+            metrics->finish(token);
+            FlightRecorder::instance()->record(FlightRecorder::MessageExpunged, 0, token);
+        }
         m_expungeTokens.clear();
     } else {
         qCritical() << Q_FUNC_INFO << "No stored messages interface present";
@@ -1636,9 +1687,9 @@ void TextChannelListener::slotPresenceChanged(const Tp::Presence &presence)
         CommHistory::Event event;
         event.setType(CommHistory::Event::StatusMessageEvent);
         event.setDirection(CommHistory::Event::Inbound);
-        event.setRecipients(Recipient(m_Account->objectPath(), remoteId));
+        event.setRecipients(Recipient(m_AccountPath, remoteId));
         event.setGroupId(groupId());
-        event.setLocalUid(m_Account->objectPath());
+        event.setLocalUid(m_AccountPath);
         event.setFreeText(newStatusMessage);
         event.setStartTime(QDateTime::currentDateTime());
         event.setEndTime(QDateTime::currentDateTime());
@@ -1656,6 +1707,8 @@ void TextChannelListener::channelReady()
     qCDebug(lcCommhistoryd) << Q_FUNC_INFO;
 
     if (m_Channel && m_Connection) {
+        initChannelContext();
+
         if (m_Channel->targetHandleType() == Tp::HandleTypeRoom) {
             qCDebug(lcCommhistoryd) << Q_FUNC_INFO << "group chat: HandleTypeRoom";
             m_IsGroupChat = true;
@@ -2016,26 +2069,27 @@ void TextChannelListener::finishedWithError(const QString& errorName,
     tryToClose();
 }
 
+void TextChannelListener::setCurrentGroup(const CommHistory::Group &group)
+{
+    m_Group = group;
+    m_GroupCache->setObservedGroup(this, m_Group.id());
+}
+
 CommHistory::Group TextChannelListener::getGroupById(int groupId) const
 {
     // Check most common case first
     if (m_Group.isValid() && m_Group.id() == groupId)
         return m_Group;
 
-    if (!m_GroupModel || !m_GroupModel->isReady()) {
-        qWarning() << Q_FUNC_INFO << "Can't read group model";
+    if (!m_GroupCache) {
+        qWarning() << Q_FUNC_INFO << "Can't read groups";
         return CommHistory::Group();
     }
 
-    for (int row = 0; row < m_GroupModel->rowCount(); row++) {
-        QModelIndex index = m_GroupModel->index(row, 0);
-        CommHistory::Group group = m_GroupModel->group(index);
-        if (group.isValid() && group.id() == groupId)
-            return group;
-    }
-
-    qWarning() << Q_FUNC_INFO << "Didn't find matching group";
-    return CommHistory::Group();
+    CommHistory::Group group(m_GroupCache->group(groupId));
+    if (!group.isValid())
+        qWarning() << Q_FUNC_INFO << "Didn't find matching group";
+    return group;
 }
 
 bool TextChannelListener::pendingCommit(const QString &messageToken)
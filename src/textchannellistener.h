@@ -25,14 +25,17 @@
 
 #include <QList>
 #include <QMultiHash>
+#include <QSet>
 
 #include <CommHistory/Group>
 
 #include "channellistener.h"
+#include "groupcache.h"
+#include "ingestionscheduler.h"
+#include "pendingmessagequeue.h"
 #include "constants.h"
 
 namespace CommHistory {
-    class GroupModel;
     class Event;
     class SingleEventModel;
     class ConversationModel;
@@ -53,12 +56,14 @@ namespace Tp {
 namespace RTComLogger
 {
 
+class MessageHeader;
+
 /*!
  * \class TextChannelListener
  * \brief class responsible for listening and logging activity on a text channel
  * chats, sms
  */
-class TextChannelListener : public ChannelListener
+class TextChannelListener : public ChannelListener, public GroupObserver, public IngestionClient
 {
     Q_OBJECT
 
@@ -71,6 +76,15 @@ public:
 
     virtual ~TextChannelListener();
 
+    // GroupObserver
+    void groupAdded(const CommHistory::Group &group);
+    void groupUpdated(const CommHistory::Group &group);
+    void groupDeleted(int groupId);
+
+    // IngestionClient
+    bool ingest(int quota);
+    int pendingMessages() const;
+
 Q_SIGNALS:
     /*!
      * \brief emitted when message saving fails
@@ -82,11 +96,7 @@ private Q_SLOTS:
     void slotMessageSent(const Tp::Message &message,
                        Tp::MessageSendingFlags flags,
                        const QString &messageToken);
-    void slotOnModelReady(bool status);
     void slotPresenceChanged(const Tp::Presence &presence);
-    void slotGroupRemoved(const QModelIndex &index, int start, int end);
-    void slotGroupInserted(const QModelIndex &index, int start, int end);
-    void slotGroupDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
     void slotEventsCommitted(QList<CommHistory::Event> events, bool status);
     void slotContactsReady(Tp::PendingOperation* operation);
     void slotPropertiesChanged(const Tp::PropertyValueList &props, bool listProps = false);
@@ -127,6 +137,7 @@ private:
     };
 
     void channelReady();
+    void initChannelContext();
     void channelListenerReady();
     void requestConversationId();
     int groupId();
@@ -136,14 +147,39 @@ private:
 
     // delivery report
     DeliveryHandlingStatus handleDeliveryReport(const Tp::ReceivedMessage &message,
+                                                const MessageHeader &header,
                                                 CommHistory::Event &event);
     // MMS
     // normal message
-    void fillEventFromMessage(const Tp::Message &message, CommHistory::Event &event);
+    void fillEventFromMessage(const Tp::Message &message, const MessageHeader &header,
+                              CommHistory::Event &event);
     void handleReceivedMessage(const Tp::ReceivedMessage &message,
+                               const MessageHeader &header,
                                CommHistory::Event &event);
 
-    void handleMessages();
+    // events and messages of one priority lane, committed together
+    struct MessageBatch {
+        MessageBatch() : hasReplaceMessage(false) { }
+
+        QList<CommHistory::Event> scrollbackEvents;
+        QList<CommHistory::Event> addEvents;
+        QHash<int, QList<CommHistory::Event> > modifyEvents; // separate list for each group
+        QList<Tp::ReceivedMessage> processedMessages;
+        QList<Tp::ReceivedMessage> addMessages;
+        QHash<int, QList<Tp::ReceivedMessage> > modifyMessages;
+        // expunge tokens for committing events
+        QHash<int, QMultiHash<int, QString> > modifyTokens;
+        bool hasReplaceMessage;
+    };
+
+    void scheduleMessages();
+    bool handleMessages(int quota);
+    // false if the message has to wait, e.g. for its event to be committed
+    bool handleMessage(const Tp::ReceivedMessage &message, MessageBatch &batch);
+    void commitBatch(MessageBatch &batch, PendingMessageQueue::Lane lane);
+    // already logged, e.g. replayed scrollback or a retransmitted SMS
+    bool isDuplicate(const Tp::ReceivedMessage &message, const CommHistory::Event &event);
+    void showMessageNotification(const CommHistory::Event &event);
     bool checkStoredMessagesIf();
     void expungeMessage(const QString &token);
     void updateGroupChatName(ChangedChannelProperty changedChannelProperty,
@@ -151,14 +187,15 @@ private:
 
     void fetchContacts();
     void handleMessageFailed(const Tp::ReceivedMessage &message,
+                             const MessageHeader &header,
                              const CommHistory::Event &event);
     void sendGroupChatEvent(const QString &message);
-    void updateCurrentGroup(int start, int end, const QModelIndex &parent = QModelIndex());
+    void updateCurrentGroup();
+    void setCurrentGroup(const CommHistory::Group &group);
 
     // attempt to read original message from delivery report
-    bool recoverDeliveryEcho(const Tp::Message &message, CommHistory::Event &event);
+    bool recoverDeliveryEcho(const MessageHeader &header, CommHistory::Event &event);
 
-    CommHistory::Event::EventType eventType() const;
     bool getEventForToken(const QString &token, const QString &mmsId,
                           int groupId, CommHistory::Event &event);
     bool getEventById(int eventId, CommHistory::Event &event);
@@ -185,7 +222,7 @@ private:
     // TODO: only for 1-1 chat, should be fixed later
     Tp::ContactPtr m_TargetContact;
 
-    CommHistory::GroupModel *m_GroupModel;
+    GroupCache *m_GroupCache;
     CommHistory::Group m_Group;
     bool m_GroupRequested;
 
@@ -202,6 +239,12 @@ private:
     // indicates that channel contains class0 messages
     bool m_isClassZeroSMS;
 
+    // channel identity, resolved once the channel is ready
+    QString m_AccountPath;
+    CommHistory::Recipient m_TargetRecipient;
+    CommHistory::Event::EventType m_EventType;
+    QString m_SubscriberId;
+
     Tp::HandleIdentifierMap m_HandleOwnerNames;
     Tp::Client::PropertiesInterfaceInterface *m_PropertiesIf;
     QHash<QString, Tp::PropertySpec> m_Properties;
@@ -216,7 +259,7 @@ private:
     QString m_PersistentId;
 
     // internal copy of message queue
-    QList<Tp::ReceivedMessage> m_messageQueue;
+    PendingMessageQueue m_messageQueue;
     // flag to destroy listener as soon as all pending operations (updating events, expunging) complete
     bool m_channelClosed;
     // groups that have added events but have not yet emitted updated signal
@@ -229,12 +272,23 @@ private:
     uint m_FailedSaveCount;
     QList<CommHistory::Event> m_failedSaveEvents;
 
-    // Global storage, among all text channel listeners, of ids of messages not acknowledged yet by mui:
-    static QMultiHash<QString,uint> m_pendingMessageIds;
+    // Global storage, among all text channel listeners, of ids of messages not acknowledged yet by mui,
+    // per channel path:
+    static QHash<QString, QSet<uint> > m_pendingMessageIds;
 
     QList<Tp::ReceivedMessage> m_replaceMessages;
     QList<CommHistory::Event> m_replaceEvents;
     CommHistory::ConversationModel* m_pConversationModel;
+
+    // messages handled per event loop turn, adapted to the time budget
+    int m_chunkSize;
+    // pending ids of queued messages already handled since the queue was
+    // last drained
+    QSet<uint> m_handedOffIds;
+    // rescued and scrollback messages queued since the last backlog
+    int m_replayedMessages;
+    // notifications are quiet until the backlog has been handled
+    bool m_replayingBacklog;
 #ifdef UNIT_TEST
     friend class Ut_TextChannelListener;
 #endif
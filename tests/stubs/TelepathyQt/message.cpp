@@ -491,6 +491,18 @@ bool ReceivedMessage::isScrollback() const
     return booleanFromPart(mPriv->parts, 0, "scrollback", false);
 }
 
+/**
+ * Return whether the incoming message was seen in a previous channel during
+ * the lifetime of this Connection, but was not acknowledged before that
+ * channel closed.
+ *
+ * \return whether the rescued flag is set
+ */
+bool ReceivedMessage::isRescued() const
+{
+    return booleanFromPart(mPriv->parts, 0, "rescued", false);
+}
+
 /**
  * Return whether the incoming message should trigger a user notification.
  *
@@ -1,4 +1,3 @@
-#include <CommHistory/GroupModel>
 #include <QCoreApplication>
 
 #include "notificationmanager.h"
@@ -8,18 +7,12 @@ using namespace RTComLogger;
 NotificationManager* NotificationManager::m_pInstance = 0;
 
 NotificationManager::NotificationManager(QObject *parent) :
-    QObject(parent)
+    QObject(parent),
+    backlogNotifications(0),
+    backlogSummaries(0)
 {
     // Temporary override until qtpim supports QTCONTACTS_MANAGER_OVERRIDE
     m_pContactManager = new QContactManager(QString::fromLatin1("org.nemomobile.contacts.sqlite"));
-    m_GroupModel = new CommHistory::GroupModel(this);
-    m_GroupModel->setResolveContacts(CommHistory::GroupManager::DoNotResolve);
-
-    if (!m_GroupModel->getGroups()) {
-        qCritical() << "Failed to request group ";
-        delete m_GroupModel;
-        m_GroupModel = 0;
-    }
 }
 
 NotificationManager* NotificationManager::instance()
@@ -41,10 +34,26 @@ void NotificationManager::showNotification(const CommHistory::Event& event,
     n.event = event;
     n.channelTargetId = channelTargetId;
     n.chatType = chatType;
+    n.quiet = false;
 
     postedNotifications.append(n);
 }
 
+void NotificationManager::showBacklogNotification(const CommHistory::Event& event,
+                      const QString &channelTargetId,
+                      CommHistory::Group::ChatType chatType)
+{
+    showNotification(event, channelTargetId, chatType);
+    postedNotifications.last().quiet = true;
+    backlogNotifications++;
+}
+
+void NotificationManager::publishBacklogSummary()
+{
+    if (backlogNotifications)
+        backlogSummaries++;
+    backlogNotifications = 0;
+}
 
 void NotificationManager::showVoicemailNotification(int count)
 {
@@ -59,11 +68,6 @@ void NotificationManager::requestClass0Notification(const CommHistory::Event &)
 {
 }
 
-CommHistory::GroupModel* NotificationManager::groupModel()
-{
-    return m_GroupModel;
-}
-
 QContactManager* NotificationManager::contactManager()
 {
     return m_pContactManager;
@@ -10,10 +10,6 @@
 
 QTCONTACTS_USE_NAMESPACE
 
-namespace CommHistory {
-    class GroupModel;
-}
-
 namespace RTComLogger {
 
 class NotificationManager : public QObject
@@ -27,8 +23,11 @@ public:
                           const QString &channelTargetId = QString(),
                           CommHistory::Group::ChatType chatType = CommHistory::Group::ChatTypeP2P,
                           const QString &details = QString());
+    void showBacklogNotification(const CommHistory::Event& event,
+                                 const QString &channelTargetId = QString(),
+                                 CommHistory::Group::ChatType chatType = CommHistory::Group::ChatTypeP2P);
+    void publishBacklogSummary();
 
-    CommHistory::GroupModel* groupModel();
     void showVoicemailNotification(int count);
     void playClass0SMSAlert();
     void requestClass0Notification(const CommHistory::Event &event);
@@ -40,12 +39,14 @@ public:
         CommHistory::Event event;
         QString channelTargetId;
         CommHistory::Group::ChatType chatType;
+        bool quiet;
     };
     QList<Notification> postedNotifications;
+    int backlogNotifications;
+    int backlogSummaries;
 
     static NotificationManager* m_pInstance;
     QContactManager *m_pContactManager;
-    CommHistory::GroupModel *m_GroupModel;
 };
 
 }
@@ -26,7 +26,12 @@ TEMPLATE = subdirs
 SUBDIRS = ut_notificationmanager \
           ut_textchannellistener \
           ut_streamchannellistener \
-          ut_messagereviver
+          ut_messagereviver \
+          ut_messageheader \
+          ut_pendingmessagequeue \
+          ut_ingestionscheduler \
+          ut_structurepeek \
+          ut_duplicatefilter
 
 # make sure the destination path exists
 !system( mkdir -p $${OUT_PWD}/bin ) : \
@@ -0,0 +1,300 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#include "ut_duplicatefilter.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QScopedPointer>
+#include <QTest>
+
+#include <CommHistory/EventModel>
+#include <CommHistory/GroupModel>
+#include <CommHistory/Recipient>
+
+#include "duplicatefilter.h"
+#include "daemonstats.h"
+#include "constants.h"
+
+using namespace RTComLogger;
+using namespace CommHistory;
+
+namespace {
+    const QString AccountPath(QLatin1String("/org/freedesktop/Telepathy/Account/ring/tel/account0"));
+    const QString RemoteUid(QLatin1String("+358401234567"));
+}
+
+void Ut_DuplicateFilter::initTestCase()
+{
+    QVERIFY(m_cacheDir.isValid());
+
+    GroupModel model;
+    model.setResolveContacts(GroupManager::DoNotResolve);
+    Group group;
+    group.setLocalUid(AccountPath);
+    group.setRecipients(Recipient(AccountPath, RemoteUid));
+    QVERIFY(model.addGroup(group));
+    m_groupId = group.id();
+}
+
+void Ut_DuplicateFilter::cleanupTestCase()
+{
+    GroupModel model;
+    model.deleteGroups(QList<int>() << m_groupId);
+}
+
+DuplicateFilter *Ut_DuplicateFilter::newFilter()
+{
+    // Each test function starts without saved filters
+    DuplicateFilter *filter = new DuplicateFilter;
+    filter->m_dir = m_cacheDir.path() + QLatin1Char('/') + QLatin1String(QTest::currentTestFunction());
+    return filter;
+}
+
+Event Ut_DuplicateFilter::storeEvent(const QString &token, const QString &text)
+{
+    static int sequence = 0;
+
+    Event event;
+    event.setType(Event::SMSEvent);
+    event.setDirection(Event::Inbound);
+    event.setLocalUid(AccountPath);
+    event.setGroupId(m_groupId);
+    event.setRecipients(Recipient(AccountPath, RemoteUid));
+    // Distinct second resolution start times
+    event.setStartTime(QDateTime::fromTime_t(1580000000 + ++sequence));
+    event.setEndTime(event.startTime());
+    event.setFreeText(text);
+    event.setMessageToken(token);
+
+    EventModel model;
+    if (!model.addEvent(event))
+        event.setId(-1);
+    return event;
+}
+
+qint64 Ut_DuplicateFilter::counter(const QString &name) const
+{
+    return DaemonStats::instance()->stats().value(name).toLongLong();
+}
+
+void Ut_DuplicateFilter::tokenMatch()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    const Event stored(storeEvent(QLatin1String("ut-duplicate-token"), QLatin1String("Token")));
+    QVERIFY(stored.id() > 0);
+    filter->add(stored);
+
+    // A retransmission with the same token, but e.g. a different text
+    Event received(stored);
+    received.setId(-1);
+    received.setFreeText(QLatin1String("Token, again"));
+    const qint64 duplicates = counter(QLatin1String("duplicateMessages"));
+    QVERIFY(filter->isDuplicate(received, false));
+    QCOMPARE(counter(QLatin1String("duplicateMessages")), duplicates + 1);
+}
+
+void Ut_DuplicateFilter::contentMatch()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    const Event stored(storeEvent(QString(), QLatin1String("Content")));
+    QVERIFY(stored.id() > 0);
+    filter->add(stored);
+
+    // The same message from the scrollback, with a token of its own
+    Event received(stored);
+    received.setId(-1);
+    received.setMessageToken(QLatin1String("ut-duplicate-scrollback"));
+    QVERIFY(filter->isDuplicate(received, true));
+
+    // Without a sent time the content is not reliable and not matched
+    QVERIFY(!filter->isDuplicate(received, false));
+}
+
+void Ut_DuplicateFilter::noMatch()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    const Event stored(storeEvent(QLatin1String("ut-duplicate-known"), QLatin1String("Known")));
+    QVERIFY(stored.id() > 0);
+    filter->add(stored);
+
+    // The common case doesn't touch the database
+    Event received(stored);
+    received.setId(-1);
+    received.setMessageToken(QLatin1String("ut-duplicate-new"));
+    received.setFreeText(QLatin1String("New"));
+    const qint64 queries = counter(QLatin1String("databaseQueries"));
+    QVERIFY(!filter->isDuplicate(received, true));
+    QCOMPARE(counter(QLatin1String("databaseQueries")), queries);
+}
+
+void Ut_DuplicateFilter::falsePositive()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    // In the filter, but not in the database
+    Event event;
+    event.setType(Event::SMSEvent);
+    event.setGroupId(m_groupId);
+    event.setRecipients(Recipient(AccountPath, RemoteUid));
+    event.setStartTime(QDateTime::fromTime_t(1570000000));
+    event.setFreeText(QLatin1String("Never stored"));
+    event.setMessageToken(QLatin1String("ut-duplicate-never-stored"));
+    filter->add(event);
+
+    const qint64 falsePositives = counter(QLatin1String("duplicateFilterFalsePositives"));
+    QVERIFY(!filter->isDuplicate(event, true));
+    QCOMPARE(counter(QLatin1String("duplicateFilterFalsePositives")), falsePositives + 1);
+}
+
+void Ut_DuplicateFilter::reload()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+    // Loaded (rebuilt) before the new events are stored
+    filter->filter(m_groupId);
+
+    const Event first(storeEvent(QLatin1String("ut-duplicate-saved"), QLatin1String("Saved")));
+    QVERIFY(first.id() > 0);
+    filter->add(first);
+
+    // Only in the saved filter, to tell a loaded filter from a rebuilt one
+    Event phantom(first);
+    phantom.setId(-1);
+    phantom.setMessageToken(QLatin1String("ut-duplicate-phantom"));
+    filter->add(phantom);
+
+    const int savedCount = filter->m_filters.value(m_groupId).count;
+    QCOMPARE(filter->m_filters.value(m_groupId).watermark, first.id());
+    filter->save();
+    filter.reset();
+
+    // Stored while the filter wasn't around, e.g. within the save delay
+    // or by another process
+    const Event second(storeEvent(QLatin1String("ut-duplicate-unsaved"), QLatin1String("Unsaved")));
+    QVERIFY(second.id() > 0);
+
+    filter.reset(newFilter());
+    const DuplicateFilter::Filter &f(filter->filter(m_groupId));
+    QCOMPARE(f.count, savedCount + 1);
+    QCOMPARE(f.watermark, second.id());
+    QVERIFY(f.dirty);
+
+    Event received(second);
+    received.setId(-1);
+    QVERIFY(filter->isDuplicate(received, false));
+}
+
+void Ut_DuplicateFilter::rebuildOverfull()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    const Event stored(storeEvent(QLatin1String("ut-duplicate-overfull"), QLatin1String("Overfull")));
+    QVERIFY(stored.id() > 0);
+
+    DuplicateFilter::Filter full;
+    full.bits.fill(char(0xff), DUPLICATE_FILTER_BITS / 8);
+    full.count = DUPLICATE_FILTER_CAPACITY + 1;
+    full.watermark = stored.id();
+    full.dirty = false;
+    QVERIFY(filter->write(m_groupId, full));
+
+    const DuplicateFilter::Filter &f(filter->filter(m_groupId));
+    QVERIFY(f.count > 0);
+    QVERIFY(f.count <= DUPLICATE_FILTER_REBUILD_LIMIT);
+    QCOMPARE(f.watermark, stored.id());
+    QVERIFY(f.bits.count(char(0xff)) < f.bits.size());
+}
+
+void Ut_DuplicateFilter::rebuildInvalid()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    const Event stored(storeEvent(QLatin1String("ut-duplicate-invalid"), QLatin1String("Invalid")));
+    QVERIFY(stored.id() > 0);
+
+    QDir().mkpath(filter->m_dir);
+    QFile file(filter->m_dir + QLatin1Char('/') + QString::number(m_groupId));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QDataStream out(&file);
+    out << quint32(1) << qint32(1) << QByteArray(16, char(0xff));
+    file.close();
+
+    DuplicateFilter::Filter invalid;
+    QVERIFY(!filter->read(m_groupId, invalid));
+
+    const DuplicateFilter::Filter &f(filter->filter(m_groupId));
+    QVERIFY(f.count > 0);
+    QCOMPARE(f.watermark, stored.id());
+
+    // The rebuilt filter replaces the invalid file
+    filter->save();
+    DuplicateFilter::Filter saved;
+    QVERIFY(filter->read(m_groupId, saved));
+    QCOMPARE(saved.count, f.count);
+    QCOMPARE(saved.watermark, stored.id());
+}
+
+void Ut_DuplicateFilter::evictDirty()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    const Event stored(storeEvent(QLatin1String("ut-duplicate-evicted"), QLatin1String("Evicted")));
+    QVERIFY(stored.id() > 0);
+    filter->add(stored);
+    const int count = filter->m_filters.value(m_groupId).count;
+    QVERIFY(filter->m_filters.value(m_groupId).dirty);
+
+    // Groups which don't exist, the filters stay empty
+    for (int i = 1; i <= DUPLICATE_FILTER_GROUPS; i++)
+        filter->filter(-m_groupId - i);
+
+    QVERIFY(!filter->m_filters.contains(m_groupId));
+    QCOMPARE(filter->m_filters.count(), int(DUPLICATE_FILTER_GROUPS));
+
+    // Written on eviction, not only when the save timer fires
+    DuplicateFilter::Filter evicted;
+    QVERIFY(filter->read(m_groupId, evicted));
+    QCOMPARE(evicted.count, count);
+    QCOMPARE(evicted.watermark, stored.id());
+}
+
+void Ut_DuplicateFilter::groupDeleted()
+{
+    QScopedPointer<DuplicateFilter> filter(newFilter());
+
+    const Event stored(storeEvent(QLatin1String("ut-duplicate-deleted"), QLatin1String("Deleted")));
+    QVERIFY(stored.id() > 0);
+    filter->add(stored);
+    filter->save();
+    QVERIFY(QFile::exists(filter->filePath(m_groupId)));
+
+    filter->onGroupsDeleted(QList<int>() << m_groupId);
+    QVERIFY(!filter->m_filters.contains(m_groupId));
+    QVERIFY(!filter->m_groups.contains(m_groupId));
+    QVERIFY(!QFile::exists(filter->filePath(m_groupId)));
+}
+
+QTEST_MAIN(Ut_DuplicateFilter)
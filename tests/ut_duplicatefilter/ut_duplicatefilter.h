@@ -0,0 +1,64 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#ifndef UT_DUPLICATEFILTER_H
+#define UT_DUPLICATEFILTER_H
+
+#include <QObject>
+#include <QTemporaryDir>
+
+#include <CommHistory/Event>
+
+class DuplicateFilter;
+
+namespace RTComLogger {
+
+class Ut_DuplicateFilter : public QObject
+{
+    Q_OBJECT
+
+// Test functions
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void tokenMatch();
+    void contentMatch();
+    void noMatch();
+    void falsePositive();
+    void reload();
+    void rebuildOverfull();
+    void rebuildInvalid();
+    void evictDirty();
+    void groupDeleted();
+
+private:
+    DuplicateFilter *newFilter();
+    CommHistory::Event storeEvent(const QString &token, const QString &text);
+    qint64 counter(const QString &name) const;
+
+    QTemporaryDir m_cacheDir;
+    int m_groupId;
+};
+
+}
+#endif // UT_DUPLICATEFILTER_H
@@ -0,0 +1,60 @@
+###############################################################################
+#
+# This file is part of commhistory-daemon.
+#
+# Copyright (C) 2020 Open Mobile Platform LLC.
+#
+# This library is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License version 2.1 as
+# published by the Free Software Foundation.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+# License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this library; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+#
+###############################################################################
+
+#-----------------------------------------------------------------------------
+# Project file for test ut_duplicatefilter
+#-----------------------------------------------------------------------------
+
+#-----------------------------------------------------------------------------
+# common test configuration
+#-----------------------------------------------------------------------------
+!include(../tests.pri) : error( "Unable to include test.pri" )
+
+!include( ../stubs/stubs.pri ) : error("Unable to include stubs/stubs.pri")
+INCLUDEPATH = ../stubs/ $${INCLUDEPATH}
+
+#-----------------------------------------------------------------------------
+# test specific configuration
+#-----------------------------------------------------------------------------
+
+TARGET = ut_duplicatefilter
+
+TEST_SOURCES += $$COMMHISTORYDSRCDIR/duplicatefilter.cpp \
+                $$COMMHISTORYDSRCDIR/groupcache.cpp \
+                $$COMMHISTORYDSRCDIR/readonlydatabase.cpp \
+                $$COMMHISTORYDSRCDIR/daemonstats.cpp
+
+TEST_HEADERS += $$COMMHISTORYDSRCDIR/duplicatefilter.h \
+                $$COMMHISTORYDSRCDIR/groupcache.h \
+                $$COMMHISTORYDSRCDIR/readonlydatabase.h \
+                $$COMMHISTORYDSRCDIR/daemonstats.h
+
+HEADERS     += ut_duplicatefilter.h \
+            $$TEST_HEADERS
+
+SOURCES     += ut_duplicatefilter.cpp \
+            $$TEST_SOURCES
+
+DESTDIR = ../bin
+QT += dbus sql
+QT -= gui
+
+# End of File
@@ -0,0 +1,110 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#include "ut_ingestionscheduler.h"
+
+#include <QTest>
+
+#include "ingestionscheduler.h"
+#include "daemonstats.h"
+#include "constants.h"
+
+using namespace RTComLogger;
+
+namespace {
+    const QString ringAccount(QLatin1String("/org/freedesktop/Telepathy/Account/ring/tel/account0"));
+    const QString imAccount(QLatin1String("/org/freedesktop/Telepathy/Account/gabble/jabber/account0"));
+
+    class Client : public IngestionClient
+    {
+    public:
+        explicit Client(int pending) : pending(pending), handled(0), turns(0) { }
+
+        bool ingest(int quota)
+        {
+            const int count = qMin(quota, pending);
+            pending -= count;
+            handled += count;
+            turns++;
+            return pending > 0;
+        }
+
+        int pendingMessages() const { return pending; }
+
+        int pending;
+        int handled;
+        int turns;
+    };
+}
+
+void Ut_IngestionScheduler::weights()
+{
+    IngestionScheduler *scheduler = IngestionScheduler::instance();
+    QCOMPARE(scheduler->weight(ringAccount), int(INGESTION_WEIGHT_RING));
+    QCOMPARE(scheduler->weight(imAccount), int(INGESTION_WEIGHT_DEFAULT));
+}
+
+void Ut_IngestionScheduler::fairShare()
+{
+    IngestionScheduler *scheduler = IngestionScheduler::instance();
+
+    // One flooded chat room and two chat rooms of the same account, against a few SMS
+    Client room(10000);
+    Client otherRoom(10000);
+    Client sms(3 * INGESTION_WEIGHT_RING * INGESTION_TURN_SHARE);
+    scheduler->schedule(&room, imAccount);
+    scheduler->schedule(&otherRoom, imAccount);
+    scheduler->schedule(&sms, ringAccount);
+
+    QTRY_COMPARE(sms.pending, 0);
+    QCOMPARE(sms.turns, 3);
+
+    // The chat rooms got their share on the same turns, split between them
+    const int share = INGESTION_WEIGHT_DEFAULT * INGESTION_TURN_SHARE / 2;
+    QVERIFY(room.turns >= 2);
+    QCOMPARE(room.handled, room.turns * share);
+    QVERIFY(qAbs(room.turns - otherRoom.turns) <= 1);
+
+    scheduler->removeClient(&room);
+    scheduler->removeClient(&otherRoom);
+    scheduler->removeClient(&sms);
+}
+
+void Ut_IngestionScheduler::removeClient()
+{
+    IngestionScheduler *scheduler = IngestionScheduler::instance();
+
+    const QString gauge(QLatin1String("ingestionQueueDepth:gabble/jabber/account0"));
+
+    Client client(1000);
+    scheduler->schedule(&client, imAccount);
+    QCOMPARE(DaemonStats::instance()->stats().value(gauge).toLongLong(), qint64(1000));
+    scheduler->removeClient(&client);
+
+    QTest::qWait(10);
+    QCOMPARE(client.turns, 0);
+
+    // The account has no clients left, its gauge goes away with it
+    QVERIFY(!DaemonStats::instance()->stats().contains(gauge));
+}
+
+QTEST_MAIN(Ut_IngestionScheduler)
@@ -0,0 +1,173 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "ut_messageheader.h"
+
+#include <QTest>
+#include <QtDBus/QtDBus>
+
+#include "TelepathyQt/Types"
+#include "TelepathyQt/Message"
+
+#include "messageheader.h"
+
+using namespace RTComLogger;
+
+namespace {
+    Tp::MessagePart receivedHeader()
+    {
+        Tp::MessagePart header;
+        header.insert(QLatin1String("message-token"), QDBusVariant(QLatin1String("a0b1c2d3-e4f5")));
+        header.insert(QLatin1String("message-received"), QDBusVariant(qlonglong(1580000000)));
+        header.insert(QLatin1String("message-sent"), QDBusVariant(qlonglong(1579999990)));
+        header.insert(QLatin1String("message-sender"), QDBusVariant(uint(12)));
+        header.insert(QLatin1String("message-sender-id"), QDBusVariant(QLatin1String("+358401234567")));
+        header.insert(QLatin1String("message-type"), QDBusVariant(uint(Tp::ChannelTextMessageTypeNormal)));
+        header.insert(QLatin1String("pending-message-id"), QDBusVariant(uint(42)));
+        header.insert(QLatin1String("subscriber-identity"), QDBusVariant(QLatin1String("244910123456789")));
+        header.insert(QLatin1String("sms-replace-number"), QDBusVariant(QLatin1String("1")));
+        return header;
+    }
+
+    Tp::MessagePart deliveryReportHeader()
+    {
+        Tp::MessagePart echoHeader;
+        echoHeader.insert(QLatin1String("message-type"), QDBusVariant(uint(Tp::ChannelTextMessageTypeNormal)));
+        Tp::MessagePart echoBody;
+        echoBody.insert(QLatin1String("content-type"), QDBusVariant(QLatin1String("text/plain")));
+        echoBody.insert(QLatin1String("content"), QDBusVariant(QLatin1String("Hello")));
+
+        Tp::MessagePart header;
+        header.insert(QLatin1String("message-token"), QDBusVariant(QLatin1String("report-1")));
+        header.insert(QLatin1String("message-type"), QDBusVariant(uint(Tp::ChannelTextMessageTypeDeliveryReport)));
+        header.insert(QLatin1String("pending-message-id"), QDBusVariant(uint(7)));
+        header.insert(QLatin1String("delivery-token"), QDBusVariant(QLatin1String("sent-1")));
+        header.insert(QLatin1String("delivery-status"), QDBusVariant(uint(Tp::DeliveryStatusPermanentlyFailed)));
+        header.insert(QLatin1String("delivery-dbus-error"), QDBusVariant(QLatin1String("com.example.Error")));
+        header.insert(QLatin1String("delivery-error-message"), QDBusVariant(QLatin1String("failed")));
+        header.insert(QLatin1String("delivery-echo"),
+                      QDBusVariant(QVariant::fromValue(Tp::MessagePartList() << echoHeader << echoBody)));
+        return header;
+    }
+
+    template<typename T>
+    T partValue(const Tp::MessagePart &part, const QString &key, const T &defaultValue = T())
+    {
+        if (part.contains(key)) {
+            const QVariant var(part.value(key).variant());
+            if (var.isValid())
+                return var.value<T>();
+        }
+
+        return defaultValue;
+    }
+}
+
+void Ut_MessageHeader::decodeReceived()
+{
+    const MessageHeader header(receivedHeader());
+
+    QCOMPARE(header.pendingMessageId, 42u);
+    QCOMPARE(header.subscriberIdentity, QString("244910123456789"));
+    QCOMPARE(header.replaceType, QString("1"));
+    QVERIFY(header.supersedes.isEmpty());
+    QVERIFY(!header.voicemail);
+    QVERIFY(!header.hasDeliveryStatus);
+    QVERIFY(header.deliveryEcho.isEmpty());
+    QCOMPARE(header.existingEventId, -1);
+}
+
+void Ut_MessageHeader::decodeDeliveryReport()
+{
+    const MessageHeader header(deliveryReportHeader());
+
+    QCOMPARE(header.pendingMessageId, 7u);
+    QCOMPARE(header.deliveryToken, QString("sent-1"));
+    QVERIFY(header.hasDeliveryStatus);
+    QCOMPARE(header.deliveryStatus, int(Tp::DeliveryStatusPermanentlyFailed));
+    QCOMPARE(header.deliveryDBusError, QString("com.example.Error"));
+    QCOMPARE(header.deliveryErrorMessage, QString("failed"));
+    QCOMPARE(header.deliveryEcho.size(), 2);
+    QCOMPARE(header.deliveryEcho.at(1).value(QLatin1String("content")).variant().toString(),
+             QString("Hello"));
+}
+
+void Ut_MessageHeader::decodeVoicemail()
+{
+    Tp::MessagePart part;
+    part.insert(QLatin1String("x-nokia-mailbox-notification"), QDBusVariant(QLatin1String("voice")));
+    part.insert(QLatin1String("x-nokia-voicemail-type"), QDBusVariant(QLatin1String("tel")));
+    part.insert(QLatin1String("x-nokia-mailbox-has-unread"), QDBusVariant(true));
+    part.insert(QLatin1String("x-nokia-mailbox-unread-count"), QDBusVariant(uint(3)));
+
+    MessageHeader header(part);
+    QVERIFY(header.voicemail);
+    QCOMPARE(header.voicemailType, QString("tel"));
+    QVERIFY(header.mailboxHasUnread);
+    QCOMPARE(header.mailboxUnreadCount, 3u);
+
+    part.insert(QLatin1String("x-nokia-mailbox-notification"), QDBusVariant(QLatin1String("fax")));
+    header = MessageHeader(part);
+    QVERIFY(!header.voicemail);
+}
+
+void Ut_MessageHeader::pendingId()
+{
+    QCOMPARE(MessageHeader::pendingId(receivedHeader()), 42u);
+    QCOMPARE(MessageHeader::pendingId(Tp::MessagePart()), 0u);
+
+    Tp::Message message(Tp::MessagePartList() << deliveryReportHeader() << Tp::MessagePart());
+    QCOMPARE(MessageHeader(message).pendingMessageId, 7u);
+}
+
+void Ut_MessageHeader::benchmarkDecode()
+{
+    const Tp::MessagePart part(receivedHeader());
+    uint pendingId = 0;
+
+    QBENCHMARK {
+        const MessageHeader header(part);
+        pendingId += header.pendingMessageId;
+    }
+
+    QVERIFY(pendingId > 0);
+}
+
+void Ut_MessageHeader::benchmarkFieldLookup()
+{
+    // The lookups done for each received message before the header was
+    // decoded in one pass, for comparison with benchmarkDecode
+    const Tp::MessagePart part(receivedHeader());
+    uint pendingId = 0;
+
+    QBENCHMARK {
+        pendingId += partValue<uint>(part, QLatin1String("pending-message-id"), 0u);
+        partValue<QString>(part, QLatin1String("sms-replace-number"));
+        partValue<QString>(part, QLatin1String("sms-replace-number"));
+        partValue<QString>(part, QLatin1String("supersedes"));
+        partValue<QString>(part, QLatin1String("subscriber-identity"));
+        pendingId += partValue<uint>(part, QLatin1String("pending-message-id"), 0u);
+    }
+
+    QVERIFY(pendingId > 0);
+}
+
+QTEST_MAIN(Ut_MessageHeader)
@@ -39,10 +39,12 @@ INCLUDEPATH = ../stubs/ $${INCLUDEPATH}
 TARGET = ut_messagereviver
 
 TEST_SOURCES += $$COMMHISTORYDSRCDIR/messagereviver.cpp \
-                $$COMMHISTORYDSRCDIR/connectionutils.cpp
+                $$COMMHISTORYDSRCDIR/connectionutils.cpp \
+                $$COMMHISTORYDSRCDIR/daemonstats.cpp
 
 TEST_HEADERS += $$COMMHISTORYDSRCDIR/messagereviver.h \
-                $$COMMHISTORYDSRCDIR/connectionutils.h
+                $$COMMHISTORYDSRCDIR/connectionutils.h \
+                $$COMMHISTORYDSRCDIR/daemonstats.h
 
 HEADERS     += ut_messagereviver.h \
             $$TEST_HEADERS
@@ -39,11 +39,21 @@ PKGCONFIG += mlocale5 TelepathyQt5 ngf-qt5 nemonotifications-qt5
 TEST_SOURCES += $$COMMHISTORYDSRCDIR/notificationmanager.cpp \
                 $$COMMHISTORYDSRCDIR/personalnotification.cpp \
                 $$COMMHISTORYDSRCDIR/serialisable.cpp \
-                $$COMMHISTORYDSRCDIR/commhistoryservice.cpp
+                $$COMMHISTORYDSRCDIR/commhistoryservice.cpp \
+                $$COMMHISTORYDSRCDIR/modemregistry.cpp \
+                $$COMMHISTORYDSRCDIR/ingestionmetrics.cpp \
+                $$COMMHISTORYDSRCDIR/daemonstats.cpp \
+                $$COMMHISTORYDSRCDIR/flightrecorder.cpp \
+                $$COMMHISTORYDSRCDIR/groupcache.cpp
 TEST_HEADERS += $$COMMHISTORYDSRCDIR/notificationmanager.h \
                 $$COMMHISTORYDSRCDIR/personalnotification.h \
                 $$COMMHISTORYDSRCDIR/serialisable.h \
-                $$COMMHISTORYDSRCDIR/commhistoryservice.h
+                $$COMMHISTORYDSRCDIR/commhistoryservice.h \
+                $$COMMHISTORYDSRCDIR/modemregistry.h \
+                $$COMMHISTORYDSRCDIR/ingestionmetrics.h \
+                $$COMMHISTORYDSRCDIR/daemonstats.h \
+                $$COMMHISTORYDSRCDIR/flightrecorder.h \
+                $$COMMHISTORYDSRCDIR/groupcache.h
 
 HEADERS     += ut_notificationmanager.h \
             $$TEST_HEADERS
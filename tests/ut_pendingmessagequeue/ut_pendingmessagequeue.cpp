@@ -0,0 +1,187 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "ut_pendingmessagequeue.h"
+
+#include <QTest>
+#include <QtDBus/QtDBus>
+
+#include "TelepathyQt/Types"
+#include "TelepathyQt/Message"
+
+#include "pendingmessagequeue.h"
+
+using namespace RTComLogger;
+
+namespace {
+    Tp::ReceivedMessage message(uint pendingId,
+                                Tp::ChannelTextMessageType type = Tp::ChannelTextMessageTypeNormal,
+                                bool scrollback = false)
+    {
+        Tp::MessagePart header;
+        header.insert(QLatin1String("pending-message-id"), QDBusVariant(pendingId));
+        header.insert(QLatin1String("message-token"), QDBusVariant(QString::number(pendingId)));
+        header.insert(QLatin1String("message-type"), QDBusVariant(uint(type)));
+        if (scrollback)
+            header.insert(QLatin1String("scrollback"), QDBusVariant(true));
+        if (type == Tp::ChannelTextMessageTypeNotice)
+            header.insert(QLatin1String("x-nokia-mailbox-notification"), QDBusVariant(QLatin1String("voice")));
+
+        Tp::MessagePart body;
+        body.insert(QLatin1String("content-type"), QDBusVariant(QLatin1String("text/plain")));
+        body.insert(QLatin1String("content"), QDBusVariant(QString("Message %1").arg(pendingId)));
+
+        return Tp::ReceivedMessage(Tp::MessagePartList() << header << body);
+    }
+
+    QList<Tp::ReceivedMessage> backlog(int count)
+    {
+        QList<Tp::ReceivedMessage> messages;
+        for (int i = 0; i < count; i++)
+            messages << message(i);
+        return messages;
+    }
+
+    QList<uint> ids(const PendingMessageQueue &queue)
+    {
+        QList<uint> result;
+        for (int lane = 0; lane < PendingMessageQueue::LaneCount; lane++) {
+            for (PendingMessageQueue::const_iterator it = queue.begin(PendingMessageQueue::Lane(lane));
+                 it != queue.end(PendingMessageQueue::Lane(lane)); ++it)
+                result << PendingMessageQueue::pendingId(*it);
+        }
+        return result;
+    }
+}
+
+void Ut_PendingMessageQueue::order()
+{
+    PendingMessageQueue queue;
+    QVERIFY(queue.isEmpty());
+
+    QVERIFY(queue.append(message(3)));
+    QVERIFY(queue.append(message(1)));
+    QVERIFY(queue.append(message(2)));
+
+    QCOMPARE(queue.size(), 3);
+    QCOMPARE(ids(queue), QList<uint>() << 3 << 1 << 2);
+}
+
+void Ut_PendingMessageQueue::duplicates()
+{
+    PendingMessageQueue queue;
+    QVERIFY(queue.append(message(0)));
+    QVERIFY(!queue.append(message(0)));
+    QCOMPARE(queue.size(), 1);
+    QVERIFY(queue.contains(0));
+    QVERIFY(!queue.contains(1));
+}
+
+void Ut_PendingMessageQueue::removal()
+{
+    PendingMessageQueue queue;
+    foreach (const Tp::ReceivedMessage &m, backlog(5))
+        queue.append(m);
+
+    QVERIFY(queue.remove(2));
+    QVERIFY(!queue.remove(2));
+    QVERIFY(queue.remove(message(4)));
+    QCOMPARE(ids(queue), QList<uint>() << 0 << 1 << 3);
+
+    // Removed ids can be queued again, at the end
+    QVERIFY(queue.append(message(2)));
+    QCOMPARE(ids(queue), QList<uint>() << 0 << 1 << 3 << 2);
+
+    queue.clear();
+    QVERIFY(queue.isEmpty());
+    QVERIFY(!queue.contains(0));
+}
+
+void Ut_PendingMessageQueue::lanes()
+{
+    PendingMessageQueue queue;
+    QVERIFY(queue.append(message(0, Tp::ChannelTextMessageTypeNormal, true)));
+    QVERIFY(queue.append(message(1, Tp::ChannelTextMessageTypeDeliveryReport)));
+    QVERIFY(queue.append(message(2)));
+    QVERIFY(queue.append(message(3, Tp::ChannelTextMessageTypeNotice)));
+    QVERIFY(queue.append(message(4), PendingMessageQueue::Urgent));
+
+    QCOMPARE(queue.size(PendingMessageQueue::Urgent), 2);
+    QCOMPARE(queue.size(PendingMessageQueue::Inbound), 1);
+    QCOMPARE(queue.size(PendingMessageQueue::Delivery), 1);
+    QCOMPARE(queue.size(PendingMessageQueue::Scrollback), 1);
+    QCOMPARE(ids(queue), QList<uint>() << 3 << 4 << 2 << 1 << 0);
+
+    // The id is unique across lanes
+    QVERIFY(!queue.append(message(2), PendingMessageQueue::Urgent));
+    QVERIFY(queue.remove(4));
+    QCOMPARE(queue.size(PendingMessageQueue::Urgent), 1);
+    QCOMPARE(ids(queue), QList<uint>() << 3 << 2 << 1 << 0);
+}
+
+void Ut_PendingMessageQueue::benchmarkDrain_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("100") << 100;
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("10000") << 10000;
+}
+
+void Ut_PendingMessageQueue::benchmarkDrain()
+{
+    QFETCH(int, count);
+    const QList<Tp::ReceivedMessage> messages(backlog(count));
+
+    // Processed from the back, as when the oldest messages are still
+    // waiting for their delivery reports
+    QBENCHMARK {
+        PendingMessageQueue queue;
+        foreach (const Tp::ReceivedMessage &m, messages)
+            queue.append(m);
+        for (int i = messages.size() - 1; i >= 0; i--)
+            queue.remove(messages.at(i));
+        QVERIFY(queue.isEmpty());
+    }
+}
+
+void Ut_PendingMessageQueue::benchmarkDrainList_data()
+{
+    benchmarkDrain_data();
+}
+
+void Ut_PendingMessageQueue::benchmarkDrainList()
+{
+    // The plain list the listener used before, for comparison
+    QFETCH(int, count);
+    const QList<Tp::ReceivedMessage> messages(backlog(count));
+
+    QBENCHMARK {
+        QList<Tp::ReceivedMessage> queue;
+        foreach (const Tp::ReceivedMessage &m, messages)
+            queue << m;
+        for (int i = messages.size() - 1; i >= 0; i--)
+            queue.removeOne(messages.at(i));
+        QVERIFY(queue.isEmpty());
+    }
+}
+
+QTEST_MAIN(Ut_PendingMessageQueue)
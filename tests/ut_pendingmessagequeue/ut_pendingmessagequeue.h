@@ -0,0 +1,49 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef UT_PENDINGMESSAGEQUEUE_H
+#define UT_PENDINGMESSAGEQUEUE_H
+
+#include <QObject>
+
+namespace RTComLogger {
+
+class Ut_PendingMessageQueue : public QObject
+{
+    Q_OBJECT
+
+// Test functions
+private Q_SLOTS:
+    void order();
+    void duplicates();
+    void removal();
+    void lanes();
+
+// Benchmarks
+private Q_SLOTS:
+    void benchmarkDrain_data();
+    void benchmarkDrain();
+    void benchmarkDrainList_data();
+    void benchmarkDrainList();
+};
+
+}
+#endif // UT_PENDINGMESSAGEQUEUE_H
@@ -0,0 +1,240 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#include "ut_structurepeek.h"
+
+#include <QElapsedTimer>
+#include <QTest>
+#include <QtDBus/QtDBus>
+
+#include <CommHistory/event.h>
+#include <CommHistory/group.h>
+
+#include "structurepeek.h"
+
+using namespace RTComLogger;
+using namespace CommHistory;
+
+namespace {
+    const QLatin1String PeerName("ut_structurepeek");
+    const QLatin1String SignalPath("/ut_structurepeek");
+    const QLatin1String SignalInterface("org.nemomobile.ut_structurepeek");
+    const QLatin1String SignalName("updated");
+
+    Event event(int id, Event::EventType type)
+    {
+        const QString localUid(QLatin1String("/org/freedesktop/Telepathy/Account/ring/tel/account0"));
+        Event e;
+        e.setId(id);
+        e.setType(type);
+        e.setGroupId(1);
+        e.setDirection(Event::Inbound);
+        e.setLocalUid(localUid);
+        e.setRecipients(Recipient(localUid, QLatin1String("+358401234567")));
+        e.setStartTime(QDateTime::currentDateTime());
+        e.setEndTime(e.startTime());
+        e.setFreeText(QLatin1String("The quick brown fox jumps over the lazy dog"));
+        e.setMessageToken(QLatin1String("a0b1c2d3-e4f5-") + QString::number(id));
+        e.setIsRead(true);
+        return e;
+    }
+
+    // A bulk mark-as-read: many text messages, a single MMS
+    QList<Event> bulkUpdate()
+    {
+        QList<Event> events;
+        for (int i = 1; i <= 200; i++)
+            events << event(i, i == 100 ? Event::MMSEvent : Event::SMSEvent);
+        return events;
+    }
+}
+
+void Ut_StructurePeek::initTestCase()
+{
+    qDBusRegisterMetaType<Event>();
+    qDBusRegisterMetaType<QList<Event> >();
+    qDBusRegisterMetaType<Group>();
+    qDBusRegisterMetaType<QList<Group> >();
+
+    // The peek has to read what libcommhistory actually puts on the wire,
+    // so the lists go through a real D-Bus connection. A private peer
+    // connection doesn't need a bus.
+    m_server = new QDBusServer(this);
+    QVERIFY(m_server->isConnected());
+    connect(m_server, SIGNAL(newConnection(QDBusConnection)),
+            this, SLOT(onNewConnection(QDBusConnection)));
+
+    QDBusConnection client(QDBusConnection::connectToPeer(m_server->address(), PeerName));
+    QVERIFY(client.isConnected());
+    QTRY_COMPARE(m_peers.count(), 1);
+}
+
+void Ut_StructurePeek::cleanupTestCase()
+{
+    QDBusConnection::disconnectFromPeer(PeerName);
+    m_peers.clear();
+}
+
+void Ut_StructurePeek::onNewConnection(const QDBusConnection &connection)
+{
+    QDBusConnection peer(connection);
+    peer.connect(QString(), SignalPath, SignalInterface, SignalName,
+                 this, SLOT(onSignal(QDBusMessage)));
+    m_peers << peer;
+}
+
+void Ut_StructurePeek::onSignal(const QDBusMessage &message)
+{
+    m_received = message;
+}
+
+QDBusMessage Ut_StructurePeek::roundTrip(const QVariant &value)
+{
+    QDBusMessage message(QDBusMessage::createSignal(SignalPath, SignalInterface, SignalName));
+    message << value;
+
+    m_received = QDBusMessage();
+    QDBusConnection client(PeerName);
+    if (!client.send(message))
+        return QDBusMessage();
+
+    QElapsedTimer timer;
+    timer.start();
+    while (m_received.type() != QDBusMessage::SignalMessage && timer.elapsed() < 5000)
+        QTest::qWait(10);
+    return m_received;
+}
+
+void Ut_StructurePeek::eventFields()
+{
+    QList<Event> events;
+    events << event(5, Event::SMSEvent) << event(7, Event::MMSEvent) << event(9, Event::IMEvent);
+
+    const QDBusMessage message(roundTrip(QVariant::fromValue(events)));
+    QCOMPARE(message.arguments().count(), 1);
+
+    const QDBusArgument arg(message.arguments().first().value<QDBusArgument>());
+    QCOMPARE(arg.currentType(), QDBusArgument::ArrayType);
+
+    int index = 0;
+    arg.beginArray();
+    while (!arg.atEnd()) {
+        const QDBusArgument element(arg.asVariant().value<QDBusArgument>());
+        int id = 0;
+        int type = Event::UnknownType;
+        QVERIFY(peekStructureFields(element, &id, &type));
+        QCOMPARE(id, events.at(index).id());
+        QCOMPARE(type, int(events.at(index).type()));
+
+        // Peeking must not have consumed anything
+        Event decoded;
+        element >> decoded;
+        QCOMPARE(decoded.id(), events.at(index).id());
+        QCOMPARE(decoded.type(), events.at(index).type());
+        QCOMPARE(decoded.freeText(), events.at(index).freeText());
+        index++;
+    }
+    arg.endArray();
+    QCOMPARE(index, events.count());
+}
+
+void Ut_StructurePeek::groupId()
+{
+    Group group;
+    group.setId(3);
+    group.setLocalUid(QLatin1String("/org/freedesktop/Telepathy/Account/ring/tel/account0"));
+    group.setRecipients(Recipient(group.localUid(), QLatin1String("+358401234567")));
+
+    const QDBusMessage message(roundTrip(QVariant::fromValue(QList<Group>() << group)));
+    QCOMPARE(message.arguments().count(), 1);
+
+    const QDBusArgument arg(message.arguments().first().value<QDBusArgument>());
+    arg.beginArray();
+    QVERIFY(!arg.atEnd());
+    const QDBusArgument element(arg.asVariant().value<QDBusArgument>());
+    int id = -1;
+    QVERIFY(peekStructureFields(element, &id));
+    QCOMPARE(id, 3);
+    arg.endArray();
+}
+
+void Ut_StructurePeek::notAStructure()
+{
+    const QDBusMessage message(roundTrip(QVariant::fromValue(QStringList() << QLatin1String("x"))));
+    QCOMPARE(message.arguments().count(), 1);
+
+    const QDBusArgument arg(message.arguments().first().value<QDBusArgument>());
+    arg.beginArray();
+    const QDBusArgument element(arg.asVariant().value<QDBusArgument>());
+    int id = -1;
+    QVERIFY(!peekStructureFields(element, &id));
+    arg.endArray();
+}
+
+void Ut_StructurePeek::benchmarkPeek()
+{
+    // What MmsHandler::onEventsUpdated does: peek every element, decode
+    // only the MMS events
+    const QDBusMessage message(roundTrip(QVariant::fromValue(bulkUpdate())));
+    QCOMPARE(message.arguments().count(), 1);
+    int decoded = 0;
+
+    QBENCHMARK {
+        const QDBusArgument arg(message.arguments().first().value<QDBusArgument>());
+        arg.beginArray();
+        while (!arg.atEnd()) {
+            const QDBusArgument element(arg.asVariant().value<QDBusArgument>());
+            int id = 0;
+            int type = Event::UnknownType;
+            if (peekStructureFields(element, &id, &type) && type != Event::MMSEvent)
+                continue;
+
+            Event event;
+            element >> event;
+            decoded++;
+        }
+        arg.endArray();
+    }
+
+    QVERIFY(decoded > 0);
+}
+
+void Ut_StructurePeek::benchmarkFullDecode()
+{
+    // The same update demarshalled into a list of events, as before the
+    // peek, for comparison with benchmarkPeek
+    const QDBusMessage message(roundTrip(QVariant::fromValue(bulkUpdate())));
+    QCOMPARE(message.arguments().count(), 1);
+    int mms = 0;
+
+    QBENCHMARK {
+        const QList<Event> events(qdbus_cast<QList<Event> >(message.arguments().first()));
+        foreach (const Event &event, events) {
+            if (event.type() == Event::MMSEvent)
+                mms++;
+        }
+    }
+
+    QVERIFY(mms > 0);
+}
+
+QTEST_MAIN(Ut_StructurePeek)
@@ -0,0 +1,66 @@
+/******************************************************************************
+**
+** This file is part of commhistory-daemon.
+**
+** Copyright (C) 2020 Open Mobile Platform LLC.
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+
+#ifndef UT_STRUCTUREPEEK_H
+#define UT_STRUCTUREPEEK_H
+
+#include <QObject>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QList>
+
+class QDBusServer;
+
+namespace RTComLogger {
+
+class Ut_StructurePeek : public QObject
+{
+    Q_OBJECT
+
+// Test functions
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void eventFields();
+    void groupId();
+    void notAStructure();
+
+// Benchmarks
+private Q_SLOTS:
+    void benchmarkPeek();
+    void benchmarkFullDecode();
+
+private Q_SLOTS:
+    void onNewConnection(const QDBusConnection &connection);
+    void onSignal(const QDBusMessage &message);
+
+private:
+    QDBusMessage roundTrip(const QVariant &value);
+
+    QDBusServer *m_server;
+    QList<QDBusConnection> m_peers;
+    QDBusMessage m_received;
+};
+
+}
+#endif // UT_STRUCTUREPEEK_H
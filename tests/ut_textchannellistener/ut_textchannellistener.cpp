@@ -45,6 +45,7 @@
 
 #include "textchannellistener.h"
 #include "notificationmanager.h"
+#include "constants.h"
 
 // constants
 #define IM_USERNAME QLatin1String("dut@localhost")
@@ -58,6 +59,8 @@
 #define TARGET_HANDLE 1
 #define SELF_HANDLE 0
 #define IM_REMOTE_ID QLatin1String("td@jabber.org")
+#define BACKLOG_USERNAME QLatin1String("backlog@localhost")
+#define BACKLOG_CHANNEL_PATH QLatin1String("/org/freedesktop/Telepathy/Connection/gabble/jabber/dut_40localhost0/backlog")
 
 #define VCARD_CONTENT QLatin1String("BEGIN:VCARD\n" \
                                     "VERSION:2.1\n" \
@@ -100,6 +103,46 @@ namespace {
         msg.ut_part(index).insert(QLatin1String(key),
                                   QDBusVariant(QLatin1String(value)));
     }
+
+    Tp::ReceivedMessage backlogMessage(int index, bool rescued)
+    {
+        Tp::ReceivedMessage msg(Tp::MessagePartList() << Tp::MessagePart() << Tp::MessagePart());
+        addMsgHeader(msg, 0, "pending-message-id", pendingMessageId++);
+        addMsgHeader(msg, 0, "received", QDateTime::currentDateTime().toTime_t());
+        addMsgHeader(msg, 0, "message-type", (uint)Tp::ChannelTextMessageTypeNormal);
+        addMsgHeader(msg, 0, "message-token", QUuid::createUuid().toString());
+        if (rescued)
+            addMsgHeader(msg, 0, "rescued", true);
+        addMsgHeader(msg, 1, "content-type", "text/plain");
+        addMsgHeader(msg, 1, "content", QString(QLatin1String("Backlog %1")).arg(index));
+
+        Tp::ContactPtr sender(new Tp::Contact());
+        sender->ut_setHandle(23);
+        sender->ut_setId(BACKLOG_USERNAME);
+        msg.ut_setSender(sender);
+        return msg;
+    }
+
+    QList<Tp::ReceivedMessage> backlogMessages(int count, bool rescued)
+    {
+        QList<Tp::ReceivedMessage> messages;
+        for (int i = 0; i < count; i++)
+            messages << backlogMessage(i, rescued);
+        return messages;
+    }
+
+    Tp::ChannelPtr backlogChannel(const Tp::ConnectionPtr &conn)
+    {
+        Tp::ChannelPtr ch(new Tp::TextChannel(BACKLOG_CHANNEL_PATH));
+        ch->ut_setIsRequested(false);
+        ch->ut_setTargetHandleType(Tp::HandleTypeContact);
+        ch->ut_setTargetHandle(TARGET_HANDLE);
+        QVariantMap immProp;
+        immProp.insert(TELEPATHY_INTERFACE_CHANNEL ".TargetID", BACKLOG_USERNAME);
+        ch->ut_setImmutableProperties(immProp);
+        ch->ut_setConnection(conn);
+        return ch;
+    }
 }
 
 Ut_TextChannelListener::Ut_TextChannelListener()
@@ -901,15 +944,19 @@ void Ut_TextChannelListener::groups()
     int firstGroup = tcl.m_Group.id();
 
     // delete group
-    QSignalSpy groupsCommitted(nm->m_GroupModel, SIGNAL(groupsCommitted(const QList<int>&, bool)));
-    nm->m_GroupModel->deleteAll();
-    QVERIFY(waitSignal(groupsCommitted, 5000));
+    {
+        CommHistory::GroupModel gm;
+        QSignalSpy groupsCommitted(&gm, SIGNAL(groupsCommitted(const QList<int>&, bool)));
+        QVERIFY(gm.deleteGroups(QList<int>() << firstGroup));
+        QVERIFY(waitSignal(groupsCommitted, 5000));
+    }
 
     g = fetchGroup(SMS_ACCOUNT_PATH, SMS_NUMBER, true);
 
     QVERIFY(!g.isValid());
 
-    QVERIFY(!tcl.m_Group.isValid());
+    // Deletion reaches the listener over D-Bus
+    QTRY_VERIFY(!tcl.m_Group.isValid());
     {
         // send received message
         Tp::ReceivedMessage msg(Tp::MessagePartList() << Tp::MessagePart() << Tp::MessagePart());
@@ -1151,4 +1198,217 @@ void Ut_TextChannelListener::supersedes()
     QCOMPARE(nm->postedNotifications.last().chatType, CommHistory::Group::ChatTypeP2P);
 }
 
+static Tp::ChannelPtr contextChannel(const Tp::ConnectionPtr &conn)
+{
+    Tp::ChannelPtr ch(new Tp::TextChannel(IM_CHANNEL_PATH));
+    ch->ut_setIsRequested(false);
+    ch->ut_setTargetHandleType(Tp::HandleTypeContact);
+    ch->ut_setTargetHandle(TARGET_HANDLE);
+    QVariantMap immProp;
+    immProp.insert(TELEPATHY_INTERFACE_CHANNEL ".TargetID", IM_USERNAME);
+    ch->ut_setImmutableProperties(immProp);
+    ch->ut_setConnection(conn);
+    return ch;
+}
+
+void Ut_TextChannelListener::channelContext()
+{
+    // setup connection
+    Tp::ConnectionPtr conn(new Tp::Connection());
+    conn->ut_setIsReady(true);
+
+    //setup account
+    Tp::AccountPtr acc(new Tp::Account(conn, IM_ACCOUNT_PATH));
+
+    //setup channel
+    Tp::ChannelPtr ch(contextChannel(conn));
+
+    Tp::MethodInvocationContextPtr<> ctx(new Tp::MethodInvocationContext<>());
+
+    TextChannelListener tcl(acc, ch, ctx);
+    waitInvocationContext(ctx, 5000);
+
+    QVERIFY(ctx->isFinished());
+    QVERIFY(!ctx->isError());
+
+    QCOMPARE(tcl.targetId(), IM_USERNAME);
+    QCOMPARE(tcl.m_AccountPath, IM_ACCOUNT_PATH);
+    QCOMPARE(tcl.m_TargetRecipient.localUid(), IM_ACCOUNT_PATH);
+    QCOMPARE(tcl.m_TargetRecipient.remoteUid(), IM_USERNAME);
+    QCOMPARE(tcl.m_EventType, CommHistory::Event::IMEvent);
+}
+
+void Ut_TextChannelListener::benchmarkChannelContext()
+{
+    Tp::ConnectionPtr conn(new Tp::Connection());
+    conn->ut_setIsReady(true);
+    Tp::AccountPtr acc(new Tp::Account(conn, IM_ACCOUNT_PATH));
+    Tp::ChannelPtr ch(contextChannel(conn));
+    Tp::MethodInvocationContextPtr<> ctx(new Tp::MethodInvocationContext<>());
+
+    TextChannelListener tcl(acc, ch, ctx);
+    waitInvocationContext(ctx, 5000);
+    QVERIFY(ctx->isFinished());
+
+    // Channel identity as applied to every logged message
+    CommHistory::Event event;
+    QBENCHMARK {
+        event.setType(tcl.m_EventType);
+        event.setLocalUid(tcl.m_AccountPath);
+        event.setRecipients(tcl.targetId() == IM_USERNAME ? tcl.m_TargetRecipient
+                                                         : CommHistory::Recipient());
+    }
+
+    QCOMPARE(event.recipients().value(0).remoteUid(), IM_USERNAME);
+}
+
+void Ut_TextChannelListener::benchmarkChannelLookup()
+{
+    // The lookups done for each logged message before the channel identity
+    // was cached, for comparison with benchmarkChannelContext
+    Tp::ConnectionPtr conn(new Tp::Connection());
+    conn->ut_setIsReady(true);
+    Tp::AccountPtr acc(new Tp::Account(conn, IM_ACCOUNT_PATH));
+    Tp::ChannelPtr ch(contextChannel(conn));
+
+    CommHistory::Event event;
+    QBENCHMARK {
+        event.setType(acc->protocolName() == QLatin1String("tel") ? CommHistory::Event::SMSEvent
+                                                                  : CommHistory::Event::IMEvent);
+        event.setLocalUid(acc->objectPath());
+
+        QString targetId;
+        const QVariantMap properties(ch->immutableProperties());
+        if (properties.contains(TELEPATHY_CHANNEL_INTERFACE_PERSISTENT_ID))
+            targetId = properties.value(TELEPATHY_CHANNEL_INTERFACE_PERSISTENT_ID).toString();
+        else if (properties.contains(TELEPATHY_INTERFACE_CHANNEL ".TargetID"))
+            targetId = properties.value(TELEPATHY_INTERFACE_CHANNEL ".TargetID").toString();
+
+        event.setRecipients(targetId == IM_USERNAME ? CommHistory::Recipient(acc->objectPath(), targetId)
+                                                    : CommHistory::Recipient());
+    }
+
+    QCOMPARE(event.recipients().value(0).remoteUid(), IM_USERNAME);
+}
+
+void Ut_TextChannelListener::backlogChunks()
+{
+    NotificationManager *nm = NotificationManager::instance();
+    nm->postedNotifications.clear();
+    nm->publishBacklogSummary();
+    const int summaries = nm->backlogSummaries;
+
+    Tp::ConnectionPtr conn(new Tp::Connection());
+    conn->ut_setIsReady(true);
+    Tp::AccountPtr acc(new Tp::Account(conn, IM_ACCOUNT_PATH));
+    Tp::ChannelPtr ch(backlogChannel(conn));
+    Tp::MethodInvocationContextPtr<> ctx(new Tp::MethodInvocationContext<>());
+
+    TextChannelListener tcl(acc, ch, ctx);
+    waitInvocationContext(ctx, 5000);
+    QVERIFY(ctx->isFinished());
+    QVERIFY(!ctx->isError());
+
+    // Messages rescued from before a restart, handled a quota at a time
+    // without going through the scheduler
+    const int count = MESSAGE_BACKLOG_THRESHOLD + 5;
+    Tp::TextChannelPtr::dynamicCast(ch)->ut_setMessageQueue(backlogMessages(count, true));
+
+    // Each turn stops at the quota, or earlier when over the time budget
+    const int quota = 5;
+    QVERIFY(tcl.ingest(quota));
+    const int firstTurn = nm->postedNotifications.size();
+    QVERIFY(firstTurn > 0 && firstTurn <= quota);
+    QCOMPARE(tcl.pendingMessages(), count - firstTurn);
+    QVERIFY(tcl.m_replayingBacklog);
+    QCOMPARE(nm->backlogNotifications, firstTurn);
+    QCOMPARE(nm->backlogSummaries, summaries);
+
+    // The next turn continues where the previous one stopped
+    QVERIFY(tcl.ingest(quota));
+    const int secondTurn = nm->postedNotifications.size() - firstTurn;
+    QVERIFY(secondTurn > 0 && secondTurn <= quota);
+    QCOMPARE(tcl.pendingMessages(), count - firstTurn - secondTurn);
+    QCOMPARE(nm->backlogSummaries, summaries);
+
+    // Done, one summary for the whole backlog
+    for (int turns = 0; tcl.ingest(count) && turns < count; turns++)
+        QCOMPARE(nm->backlogSummaries, summaries);
+    QCOMPARE(tcl.pendingMessages(), 0);
+    QVERIFY(!tcl.m_replayingBacklog);
+    QCOMPARE(nm->postedNotifications.size(), count);
+    foreach (const NotificationManager::Notification &n, nm->postedNotifications)
+        QVERIFY(n.quiet);
+    QCOMPARE(nm->backlogSummaries, summaries + 1);
+
+    // New messages after the backlog pop up as usual
+    QList<Tp::ReceivedMessage> queue(Tp::TextChannelPtr::dynamicCast(ch)->messageQueue());
+    queue << backlogMessage(count, false);
+    Tp::TextChannelPtr::dynamicCast(ch)->ut_setMessageQueue(queue);
+    QVERIFY(!tcl.ingest(quota));
+    QCOMPARE(nm->postedNotifications.size(), count + 1);
+    QVERIFY(!nm->postedNotifications.last().quiet);
+    QCOMPARE(nm->backlogSummaries, summaries + 1);
+}
+
+void Ut_TextChannelListener::backlogScheduled()
+{
+    NotificationManager *nm = NotificationManager::instance();
+    nm->postedNotifications.clear();
+    nm->publishBacklogSummary();
+    const int summaries = nm->backlogSummaries;
+
+    Tp::ConnectionPtr conn(new Tp::Connection());
+    conn->ut_setIsReady(true);
+    Tp::AccountPtr acc(new Tp::Account(conn, IM_ACCOUNT_PATH));
+    Tp::ChannelPtr ch(backlogChannel(conn));
+
+    // More than a turn's share, already queued when the channel comes up
+    const int count = 3 * INGESTION_TURN_SHARE;
+    Tp::TextChannelPtr::dynamicCast(ch)->ut_setMessageQueue(backlogMessages(count, true));
+
+    Tp::MethodInvocationContextPtr<> ctx(new Tp::MethodInvocationContext<>());
+    TextChannelListener tcl(acc, ch, ctx);
+    waitInvocationContext(ctx, 5000);
+    QVERIFY(ctx->isFinished());
+
+    // The scheduler keeps coming back until the queue is empty
+    QTRY_COMPARE(tcl.pendingMessages(), 0);
+    QTRY_COMPARE(nm->postedNotifications.size(), count);
+    QCOMPARE(nm->backlogSummaries, summaries + 1);
+    foreach (const NotificationManager::Notification &n, nm->postedNotifications)
+        QVERIFY(n.quiet);
+}
+
+void Ut_TextChannelListener::burstIsNotBacklog()
+{
+    NotificationManager *nm = NotificationManager::instance();
+    nm->postedNotifications.clear();
+    nm->publishBacklogSummary();
+    const int summaries = nm->backlogSummaries;
+
+    Tp::ConnectionPtr conn(new Tp::Connection());
+    conn->ut_setIsReady(true);
+    Tp::AccountPtr acc(new Tp::Account(conn, IM_ACCOUNT_PATH));
+    Tp::ChannelPtr ch(backlogChannel(conn));
+    Tp::MethodInvocationContextPtr<> ctx(new Tp::MethodInvocationContext<>());
+
+    TextChannelListener tcl(acc, ch, ctx);
+    waitInvocationContext(ctx, 5000);
+    QVERIFY(ctx->isFinished());
+
+    // Just as many messages, but new ones: each is notified as usual
+    const int count = MESSAGE_BACKLOG_THRESHOLD + 5;
+    Tp::TextChannelPtr::dynamicCast(ch)->ut_setMessageQueue(backlogMessages(count, false));
+
+    for (int turns = 0; tcl.ingest(count) && turns < count; turns++)
+        QVERIFY(!tcl.m_replayingBacklog);
+    QCOMPARE(tcl.pendingMessages(), 0);
+    QVERIFY(!tcl.m_replayingBacklog);
+    QCOMPARE(nm->postedNotifications.size(), count);
+    foreach (const NotificationManager::Notification &n, nm->postedNotifications)
+        QVERIFY(!n.quiet);
+    QCOMPARE(nm->backlogSummaries, summaries);
+}
+
 QTEST_MAIN(Ut_TextChannelListener)
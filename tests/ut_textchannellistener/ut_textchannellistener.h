@@ -57,6 +57,12 @@ private Q_SLOTS:
     void groups();
     void receivingFromSelf();
     void supersedes();
+    void channelContext();
+    void benchmarkChannelContext();
+    void benchmarkChannelLookup();
+    void backlogChunks();
+    void backlogScheduled();
+    void burstIsNotBacklog();
 
 private:
     CommHistory::Group fetchGroup(const QString &localUid, const QString &remoteUid, bool wait);
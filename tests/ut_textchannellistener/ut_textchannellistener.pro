@@ -41,10 +41,28 @@ TARGET = ut_textchannellistener
 PKGCONFIG += mlocale5
 
 TEST_SOURCES += $$COMMHISTORYDSRCDIR/textchannellistener.cpp \
-                $$COMMHISTORYDSRCDIR/channellistener.cpp
+                $$COMMHISTORYDSRCDIR/channellistener.cpp \
+                $$COMMHISTORYDSRCDIR/ingestionmetrics.cpp \
+                $$COMMHISTORYDSRCDIR/ingestionscheduler.cpp \
+                $$COMMHISTORYDSRCDIR/daemonstats.cpp \
+                $$COMMHISTORYDSRCDIR/flightrecorder.cpp \
+                $$COMMHISTORYDSRCDIR/groupcache.cpp \
+                $$COMMHISTORYDSRCDIR/messageheader.cpp \
+                $$COMMHISTORYDSRCDIR/pendingmessagequeue.cpp \
+                $$COMMHISTORYDSRCDIR/duplicatefilter.cpp \
+                $$COMMHISTORYDSRCDIR/readonlydatabase.cpp
 
 TEST_HEADERS += $$COMMHISTORYDSRCDIR/textchannellistener.h \
-                $$COMMHISTORYDSRCDIR/channellistener.h
+                $$COMMHISTORYDSRCDIR/channellistener.h \
+                $$COMMHISTORYDSRCDIR/ingestionmetrics.h \
+                $$COMMHISTORYDSRCDIR/ingestionscheduler.h \
+                $$COMMHISTORYDSRCDIR/daemonstats.h \
+                $$COMMHISTORYDSRCDIR/flightrecorder.h \
+                $$COMMHISTORYDSRCDIR/groupcache.h \
+                $$COMMHISTORYDSRCDIR/messageheader.h \
+                $$COMMHISTORYDSRCDIR/pendingmessagequeue.h \
+                $$COMMHISTORYDSRCDIR/duplicatefilter.h \
+                $$COMMHISTORYDSRCDIR/readonlydatabase.h
 
 HEADERS     += ut_textchannellistener.h \
             $$TEST_HEADERS
@@ -53,7 +71,7 @@ SOURCES     += ut_textchannellistener.cpp \
             $$TEST_SOURCES
 
 DESTDIR = ../bin
-QT += dbus
+QT += dbus sql
 
 # End of File
 